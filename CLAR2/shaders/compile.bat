@@ -1,5 +1,5 @@
-C:\VulkanSDK\1.3.283.0\Bin\glslc.exe shader.vert -o vert.spv
-C:\VulkanSDK\1.3.283.0\Bin\glslc.exe shader.frag -o frag.spv
+C:\VulkanSDK\1.3.283.0\Bin\glslc.exe shader.vert -o shader.vert.spv
+C:\VulkanSDK\1.3.283.0\Bin\glslc.exe shader.frag -o shader.frag.spv
 
 C:\VulkanSDK\1.3.283.0\Bin\glslc.exe grid.vert -o grid.vert.spv
 C:\VulkanSDK\1.3.283.0\Bin\glslc.exe grid.frag -o grid.frag.spv
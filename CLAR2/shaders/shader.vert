@@ -7,16 +7,36 @@ layout(binding = 0) uniform UniformBufferObject {
     mat4 proj;
 } ubo;
 
+// keep in sync with PACKED_VERTICES in clar_vertex.h
+#define PACKED_VERTICES
+
 layout(location = 0) in vec3 inPosition;
+#ifdef PACKED_VERTICES
+layout(location = 1) in vec2 inNormal; // octahedral
+#else
 layout(location = 1) in vec3 inNormal;
 layout(location = 2) in vec3 inColor;
+#endif
 layout(location = 3) in vec2 inTexCoord;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
 
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
 void main() {
 	gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+#ifdef PACKED_VERTICES
+	fragColor = octDecode(inNormal);
+#else
 	fragColor = inNormal;
+#endif
     fragTexCoord = inTexCoord;
 }
\ No newline at end of file
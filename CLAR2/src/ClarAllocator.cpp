@@ -1,19 +1,50 @@
 #include "ClarAllocator.h"
 
+#include <fstream>
+#include <optional>
+
 namespace CLAR {
 
+	// keeps a defragmentation pass to a few milliseconds of copies even on slow GPUs
+	static constexpr VkDeviceSize DefragmentationBytesPerPass = 32ull << 20;
+	static constexpr uint32_t DefragmentationMovesPerPass = 64;
+
+	const char* MemoryCategoryName(MemoryCategory category)
+	{
+		switch (category)
+		{
+		case MemoryCategory::Geometry: return "Geometry";
+		case MemoryCategory::AccelerationStructure: return "Acceleration structures";
+		case MemoryCategory::Texture: return "Textures";
+		case MemoryCategory::RenderTarget: return "Render targets";
+		case MemoryCategory::Staging: return "Staging";
+		default: return "Other";
+		}
+	}
+
 	Allocator::Allocator(Device& device)
 		: m_Device(device)
 	{
 		Init(device);
+		CreateMovablePool();
+		m_UploadHeap = std::make_unique<UploadHeap>(device, m_Allocator);
 	}
 
 	Allocator::~Allocator()
 	{
+		m_UploadHeap.reset();
+		if (m_Defragmentation != VK_NULL_HANDLE)
+		{
+			if (m_DefragmentationPassPending)
+				vmaEndDefragmentationPass(m_Allocator, m_Defragmentation, &m_DefragmentationPass);
+			vmaEndDefragmentation(m_Allocator, m_Defragmentation, nullptr);
+		}
+		if (m_MovablePool != VK_NULL_HANDLE)
+			vmaDestroyPool(m_Allocator, m_MovablePool);
 		vmaDestroyAllocator(m_Allocator);
 	}
 
-	Buffer Allocator::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags) const
+	Buffer Allocator::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags, MemoryCategory category) const
 	{
 		VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
 		bufferInfo.size = size;
@@ -28,16 +59,41 @@ namespace CLAR {
 		VmaAllocationInfo allocationInfo;
 
 		vmaCreateBuffer(m_Allocator, &bufferInfo, &allocInfo, &buffer, &allocation, &allocationInfo);
+		Track(allocation, category);
 		return { buffer, allocation, allocationInfo };
 	}
 
+	void Allocator::Upload(const Buffer& buffer, const void* data, VkDeviceSize size) const
+	{
+		// a mapped buffer the copy would land in later could overwrite what the caller writes in the meantime
+		if (buffer.allocationInfo.pMappedData != nullptr)
+		{
+			buffer.Write(data, size);
+			vmaFlushAllocation(m_Allocator, buffer.allocation, 0, size);
+			return;
+		}
+		m_UploadHeap->Upload(buffer.buffer, data, size);
+	}
+
+	void Allocator::Flush(const Buffer& buffer, VkDeviceSize offset, VkDeviceSize size) const
+	{
+		vmaFlushAllocation(m_Allocator, buffer.allocation, offset, size);
+	}
+
+	void Allocator::Invalidate(const Buffer& buffer, VkDeviceSize offset, VkDeviceSize size) const
+	{
+		vmaInvalidateAllocation(m_Allocator, buffer.allocation, offset, size);
+	}
+
 	void Allocator::DestroyBuffer(const Buffer& buffer) const
 	{
+		Untrack(buffer.allocation);
 		vmaDestroyBuffer(m_Allocator, buffer.buffer, buffer.allocation);
 	}
 
 	void Allocator::DestroyImage(const Image& image) const
 	{
+		Untrack(image.allocation);
 		vmaDestroyImage(m_Allocator, image.image, image.allocation);
 	}
 
@@ -54,7 +110,7 @@ namespace CLAR {
 		vkDestroyAccelerationStructureKHR(m_Device, as.handle, nullptr);
 	}
 
-	Image Allocator::CreateImage(VkExtent2D size, VkFormat format, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags, VkSampleCountFlagBits samples, uint32_t mipLevels) const
+	Image Allocator::CreateImage(VkExtent2D size, VkFormat format, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags, VkSampleCountFlagBits samples, uint32_t mipLevels, MemoryCategory category) const
 	{
 		VkImageCreateInfo imageInfo{
 			.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
@@ -84,6 +140,7 @@ namespace CLAR {
 		VmaAllocationInfo allocationInfo;
 
 		vmaCreateImage(m_Allocator, &imageInfo, &allocInfo, &image, &allocation, &allocationInfo);
+		Track(allocation, category);
 		return { image, allocation };
 	}
 
@@ -148,16 +205,311 @@ namespace CLAR {
 		return texture;
 	}
 
-	AccelerationStructure Allocator::CreateAccelerationStructure(VkAccelerationStructureCreateInfoKHR& createInfo) const
+	AccelerationStructure Allocator::CreateAccelerationStructure(VkAccelerationStructureCreateInfoKHR& createInfo, bool movable) const
 	{
-		Buffer buffer = CreateBuffer(createInfo.size, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+		VkBufferUsageFlags usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+		Buffer buffer = movable
+			? CreateMovableBuffer(createInfo.size, usage, MemoryCategory::AccelerationStructure)
+			: CreateBuffer(createInfo.size, usage, 0, MemoryCategory::AccelerationStructure);
 		VkAccelerationStructureKHR accelerationstructure{};
 
 		createInfo.buffer = buffer.buffer;
 		vkCreateAccelerationStructureKHR(m_Device, &createInfo, nullptr, &accelerationstructure);
+
+		if (movable)
+		{
+			std::lock_guard lock(m_MovableMutex);
+			if (auto entry = m_Movables.find(buffer.allocation); entry != m_Movables.end())
+			{
+				entry->second.as = accelerationstructure;
+				entry->second.asType = createInfo.type;
+			}
+		}
 		return { buffer, accelerationstructure };
 	}
 
+	Buffer Allocator::CreateMovableBuffer(VkDeviceSize size, VkBufferUsageFlags usage, MemoryCategory category) const
+	{
+		usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+		VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+		bufferInfo.size = size;
+		bufferInfo.usage = usage;
+
+		VmaAllocationCreateInfo allocInfo = {};
+		allocInfo.pool = m_MovablePool;
+
+		// a buffer that does not fit the pool's memory type stays where it is, in the default pools
+		Buffer buffer{};
+		if (m_MovablePool == VK_NULL_HANDLE ||
+			vmaCreateBuffer(m_Allocator, &bufferInfo, &allocInfo, &buffer.buffer, &buffer.allocation, &buffer.allocationInfo) != VK_SUCCESS)
+			return CreateBuffer(size, usage, 0, category);
+		Track(buffer.allocation, category);
+
+		std::lock_guard lock(m_MovableMutex);
+		m_Movables[buffer.allocation] = { buffer.buffer, usage, size };
+		return buffer;
+	}
+
+	void Allocator::SetRelocation(const Buffer& buffer, std::function<void(const Buffer&)> relocate) const
+	{
+		std::lock_guard lock(m_MovableMutex);
+		if (auto entry = m_Movables.find(buffer.allocation); entry != m_Movables.end())
+			entry->second.relocateBuffer = std::move(relocate);
+	}
+
+	void Allocator::SetRelocation(const AccelerationStructure& as, std::function<void(const AccelerationStructure&)> relocate) const
+	{
+		std::lock_guard lock(m_MovableMutex);
+		if (auto entry = m_Movables.find(as.buffer.allocation); entry != m_Movables.end())
+			entry->second.relocateAs = std::move(relocate);
+	}
+
+	VmaAllocation Allocator::AllocateMemory(const VkMemoryRequirements& requirements, bool lazy, MemoryCategory category) const
+	{
+		VmaAllocation allocation = VK_NULL_HANDLE;
+		VmaAllocationCreateInfo allocInfo = {};
+
+		if (lazy)
+		{
+			allocInfo.usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED;
+			if (vmaAllocateMemory(m_Allocator, &requirements, &allocInfo, &allocation, nullptr) == VK_SUCCESS)
+			{
+				Track(allocation, category);
+				return allocation;
+			}
+		}
+
+		allocInfo.usage = VMA_MEMORY_USAGE_UNKNOWN;
+		allocInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		if (vmaAllocateMemory(m_Allocator, &requirements, &allocInfo, &allocation, nullptr) != VK_SUCCESS)
+			throw std::runtime_error("failed to allocate image memory!");
+		Track(allocation, category);
+		return allocation;
+	}
+
+	void Allocator::BindImageMemory(VmaAllocation allocation, VkImage image) const
+	{
+		if (vmaBindImageMemory(m_Allocator, allocation, image) != VK_SUCCESS)
+			throw std::runtime_error("failed to bind image memory!");
+	}
+
+	void Allocator::FreeMemory(VmaAllocation allocation) const
+	{
+		Untrack(allocation);
+		vmaFreeMemory(m_Allocator, allocation);
+	}
+
+	bool Allocator::HasLazilyAllocatedMemory() const
+	{
+		const VkPhysicalDeviceMemoryProperties* memoryProperties;
+		vmaGetMemoryProperties(m_Allocator, &memoryProperties);
+
+		for (uint32_t i = 0; i < memoryProperties->memoryTypeCount; i++)
+		{
+			if (memoryProperties->memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+				return true;
+		}
+		return false;
+	}
+
+	void Allocator::CreateMovablePool()
+	{
+		// the memory type VMA picks for device local geometry and acceleration structures, on the GPUs we run on
+		// that is the same one for every buffer usage
+		VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+		bufferInfo.size = 1 << 16;
+		bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+			VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
+			VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+		VmaAllocationCreateInfo allocInfo = {};
+		allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+		uint32_t memoryType;
+		if (vmaFindMemoryTypeIndexForBufferInfo(m_Allocator, &bufferInfo, &allocInfo, &memoryType) != VK_SUCCESS)
+			return;
+
+		VmaPoolCreateInfo poolInfo = {};
+		poolInfo.memoryTypeIndex = memoryType;
+		if (vmaCreatePool(m_Allocator, &poolInfo, &m_MovablePool) != VK_SUCCESS)
+			m_MovablePool = VK_NULL_HANDLE;
+	}
+
+	uint32_t Allocator::Defragment(DeletionQueue& deletionQueue, std::chrono::microseconds budget)
+	{
+		if (m_MovablePool == VK_NULL_HANDLE || m_DefragmentationPassPending)
+			return 0;
+
+		auto start = std::chrono::steady_clock::now();
+
+		if (m_Defragmentation == VK_NULL_HANDLE)
+		{
+			// holes only come from frees, with none since the last run the pool is as compact as it was
+			if (m_MovableFrees == 0)
+				return 0;
+			m_MovableFrees = 0;
+
+			VmaDefragmentationInfo info = {};
+			info.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_FAST_BIT;
+			info.pool = m_MovablePool;
+			info.maxBytesPerPass = DefragmentationBytesPerPass;
+			info.maxAllocationsPerPass = DefragmentationMovesPerPass;
+			if (vmaBeginDefragmentation(m_Allocator, &info, &m_Defragmentation) != VK_SUCCESS)
+				return 0;
+		}
+
+		if (vmaBeginDefragmentationPass(m_Allocator, m_Defragmentation, &m_DefragmentationPass) == VK_SUCCESS)
+		{
+			vmaEndDefragmentation(m_Allocator, m_Defragmentation, nullptr);
+			m_Defragmentation = VK_NULL_HANDLE;
+			return 0;
+		}
+
+		struct Move {
+			Movable* movable;
+			VkBuffer from;
+			VkAccelerationStructureKHR fromAs;
+			AccelerationStructure to;
+		};
+		std::vector<Move> moves;
+		bool overBudget = false;
+		{
+			std::lock_guard lock(m_MovableMutex);
+			for (uint32_t i = 0; i < m_DefragmentationPass.moveCount; i++)
+			{
+				VmaDefragmentationMove& move = m_DefragmentationPass.pMoves[i];
+				overBudget |= std::chrono::steady_clock::now() - start > budget;
+
+				// nobody would learn about the new place of an allocation without a relocation
+				auto entry = m_Movables.find(move.srcAllocation);
+				if (overBudget || entry == m_Movables.end() || !(entry->second.relocateBuffer || entry->second.relocateAs))
+				{
+					move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+					continue;
+				}
+
+				Movable& movable = entry->second;
+				VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+				bufferInfo.size = movable.size;
+				bufferInfo.usage = movable.usage;
+
+				Move moved{ &movable, movable.buffer, movable.as, { { VK_NULL_HANDLE, move.srcAllocation }, VK_NULL_HANDLE } };
+				if (vkCreateBuffer(m_Device, &bufferInfo, nullptr, &moved.to.buffer.buffer) != VK_SUCCESS)
+				{
+					move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+					continue;
+				}
+				vmaBindBufferMemory(m_Allocator, move.dstTmpAllocation, moved.to.buffer.buffer);
+				vmaGetAllocationInfo(m_Allocator, move.dstTmpAllocation, &moved.to.buffer.allocationInfo);
+
+				if (movable.as != VK_NULL_HANDLE)
+				{
+					VkAccelerationStructureCreateInfoKHR createInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
+					createInfo.buffer = moved.to.buffer.buffer;
+					createInfo.size = movable.size;
+					createInfo.type = movable.asType;
+					vkCreateAccelerationStructureKHR(m_Device, &createInfo, nullptr, &moved.to.handle);
+				}
+				moves.push_back(moved);
+			}
+		}
+
+		if (moves.empty())
+		{
+			vmaEndDefragmentationPass(m_Allocator, m_Defragmentation, &m_DefragmentationPass);
+			// only unregistered allocations left, VMA would keep offering the same moves every frame
+			if (!overBudget)
+			{
+				vmaEndDefragmentation(m_Allocator, m_Defragmentation, nullptr);
+				m_Defragmentation = VK_NULL_HANDLE;
+			}
+			return 0;
+		}
+
+		// copies still headed for the old places land first, then everything after the moves reads the new ones
+		m_UploadHeap->Submit();
+		m_Device.SubmitAsync([&](VkCommandBuffer commandBuffer)
+			{
+				VkMemoryBarrier before{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+				before.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+				before.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+					VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &before, 0, nullptr, 0, nullptr);
+
+				for (const Move& move : moves)
+				{
+					if (move.to.handle != VK_NULL_HANDLE)
+					{
+						VkCopyAccelerationStructureInfoKHR copy{ VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR };
+						copy.src = move.fromAs;
+						copy.dst = move.to.handle;
+						copy.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_CLONE_KHR;
+						vkCmdCopyAccelerationStructureKHR(commandBuffer, &copy);
+					}
+					else
+					{
+						VkBufferCopy region{ 0, 0, move.movable->size };
+						vkCmdCopyBuffer(commandBuffer, move.from, move.to.buffer.buffer, 1, &region);
+					}
+				}
+
+				VkMemoryBarrier after{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+				after.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+				after.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+					VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &after, 0, nullptr, 0, nullptr);
+			});
+
+		// the owners switch over now, the old buffers and the source memory go once no frame reads them
+		std::vector<std::pair<VkBuffer, VkAccelerationStructureKHR>> retired;
+		std::vector<std::function<void()>> relocations;
+		{
+			std::lock_guard lock(m_MovableMutex);
+			for (const Move& move : moves)
+			{
+				retired.emplace_back(move.from, move.fromAs);
+				move.movable->buffer = move.to.buffer.buffer;
+				move.movable->as = move.to.handle;
+				m_DefragmentedBytes += move.movable->size;
+
+				if (move.to.handle != VK_NULL_HANDLE)
+					relocations.push_back([relocate = move.movable->relocateAs, to = move.to]() { relocate(to); });
+				else
+					relocations.push_back([relocate = move.movable->relocateBuffer, to = move.to.buffer]() { relocate(to); });
+			}
+		}
+		m_DefragmentedAllocations += moves.size();
+		// outside the lock, owners may register relocations for what they create in response
+		for (auto& relocate : relocations)
+			relocate();
+
+		m_DefragmentationPassPending = true;
+		deletionQueue.Push([this, retired = std::move(retired)]()
+			{
+				for (auto [buffer, as] : retired)
+				{
+					if (as != VK_NULL_HANDLE)
+						vkDestroyAccelerationStructureKHR(m_Device, as, nullptr);
+					vkDestroyBuffer(m_Device, buffer, nullptr);
+				}
+				EndDefragmentationPass();
+			});
+
+		return static_cast<uint32_t>(moves.size());
+	}
+
+	void Allocator::EndDefragmentationPass()
+	{
+		// VK_SUCCESS once the pool is as compact as VMA gets it
+		if (vmaEndDefragmentationPass(m_Allocator, m_Defragmentation, &m_DefragmentationPass) == VK_SUCCESS)
+		{
+			vmaEndDefragmentation(m_Allocator, m_Defragmentation, nullptr);
+			m_Defragmentation = VK_NULL_HANDLE;
+		}
+		m_DefragmentationPassPending = false;
+	}
+
 	void Allocator::Init(const Device& device)
 	{
 		VmaAllocatorCreateInfo allocatorInfo = {};
@@ -165,11 +517,118 @@ namespace CLAR {
 		allocatorInfo.device = device;
 		allocatorInfo.instance = device.GetInstance();
 		allocatorInfo.vulkanApiVersion = VK_API_VERSION_1_3;
-		allocatorInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT | VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+		allocatorInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+		// VMA requires the extension to be enabled on the device when asked to use it
+		if (device.HasMemoryBudget())
+			allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
 
 		vmaCreateAllocator(&allocatorInfo, &m_Allocator);
 	}
 
+	void Allocator::Track(VmaAllocation allocation, MemoryCategory category) const
+	{
+		if (allocation == VK_NULL_HANDLE)
+			return;
+
+		// the category rides along in the user data, so destruction finds it without a lookup table
+		vmaSetAllocationUserData(m_Allocator, allocation, reinterpret_cast<void*>(static_cast<uintptr_t>(category)));
+		vmaSetAllocationName(m_Allocator, allocation, MemoryCategoryName(category));
+
+		VmaAllocationInfo info;
+		vmaGetAllocationInfo(m_Allocator, allocation, &info);
+		auto& counters = m_Categories[static_cast<size_t>(category)];
+		counters.bytes += info.size;
+		counters.allocations++;
+	}
+
+	void Allocator::Untrack(VmaAllocation allocation) const
+	{
+		if (allocation == VK_NULL_HANDLE)
+			return;
+
+		{
+			std::lock_guard lock(m_MovableMutex);
+			if (m_Movables.erase(allocation) > 0)
+				m_MovableFrees++;
+		}
+
+		VmaAllocationInfo info;
+		vmaGetAllocationInfo(m_Allocator, allocation, &info);
+		auto& counters = m_Categories[reinterpret_cast<uintptr_t>(info.pUserData)];
+		counters.bytes -= info.size;
+		counters.allocations--;
+	}
+
+	std::array<MemoryCategoryStats, static_cast<size_t>(MemoryCategory::Count)> Allocator::GetCategoryStats() const
+	{
+		std::array<MemoryCategoryStats, static_cast<size_t>(MemoryCategory::Count)> stats;
+		for (size_t i = 0; i < stats.size(); i++)
+			stats[i] = { m_Categories[i].bytes.load(), m_Categories[i].allocations.load() };
+
+		auto& staging = stats[static_cast<size_t>(MemoryCategory::Staging)];
+		staging.bytes += m_UploadHeap->Capacity();
+		staging.allocations++;
+		return stats;
+	}
+
+	std::vector<MemoryHeapBudget> Allocator::GetHeapBudgets() const
+	{
+		const VkPhysicalDeviceMemoryProperties* memoryProperties;
+		vmaGetMemoryProperties(m_Allocator, &memoryProperties);
+
+		std::vector<VmaBudget> budgets(memoryProperties->memoryHeapCount);
+		vmaGetHeapBudgets(m_Allocator, budgets.data());
+
+		std::vector<MemoryHeapBudget> heaps;
+		heaps.reserve(budgets.size());
+		for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; i++)
+		{
+			heaps.push_back({
+				budgets[i].usage,
+				budgets[i].budget,
+				budgets[i].statistics.blockBytes,
+				budgets[i].statistics.allocationBytes,
+				(memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0
+				});
+		}
+		return heaps;
+	}
+
+	bool Allocator::FitsBudget(VkDeviceSize size) const
+	{
+		const VkPhysicalDeviceMemoryProperties* memoryProperties;
+		vmaGetMemoryProperties(m_Allocator, &memoryProperties);
+
+		// with resizable BAR there is a small second device local heap, the big one is the VRAM
+		std::optional<uint32_t> vram;
+		for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; i++)
+		{
+			const VkMemoryHeap& heap = memoryProperties->memoryHeaps[i];
+			if ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && (!vram || heap.size > memoryProperties->memoryHeaps[*vram].size))
+				vram = i;
+		}
+
+		if (!vram)
+			return true;
+		std::vector<MemoryHeapBudget> heaps = GetHeapBudgets();
+		return heaps[*vram].usage + size <= heaps[*vram].budget;
+	}
+
+	void Allocator::DumpStatistics(const std::filesystem::path& path) const
+	{
+		char* json = nullptr;
+		vmaBuildStatsString(m_Allocator, &json, VK_TRUE);
+
+		std::ofstream file(path);
+		if (!file)
+		{
+			vmaFreeStatsString(m_Allocator, json);
+			throw std::runtime_error("failed to open " + path.string() + "!");
+		}
+		file << json;
+		vmaFreeStatsString(m_Allocator, json);
+	}
+
 	void Buffer::Write(const void* src, VkDeviceSize size, VkDeviceSize offset) const
 	{
 		// if the buffer was not created with VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT first map the memory
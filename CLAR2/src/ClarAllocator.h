@@ -1,10 +1,50 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
 #include "vma/vk_mem_alloc.h"
 #include "clar_device.h"
+#include "ClarDeletionQueue.h"
+#include "ClarUploadHeap.h"
 
 namespace CLAR {
 
+	// What an allocation is for, only used for the statistics
+	enum class MemoryCategory : uint32_t {
+		Other,
+		Geometry,
+		AccelerationStructure,	// the structures and their build scratch
+		Texture,
+		RenderTarget,
+		Staging,				// host visible memory written every frame or copied from
+		Count
+	};
+
+	const char* MemoryCategoryName(MemoryCategory category);
+
+	struct MemoryCategoryStats {
+		VkDeviceSize bytes = 0;
+		uint32_t allocations = 0;
+	};
+
+	// One memory heap as VMA sees it; usage and budget cover the whole process, not only this allocator
+	struct MemoryHeapBudget {
+		VkDeviceSize usage;
+		VkDeviceSize budget;
+		VkDeviceSize blockBytes;		// VkDeviceMemory VMA holds in the heap
+		VkDeviceSize allocationBytes;	// the part of it handed out
+		bool deviceLocal;
+	};
+
 	struct Buffer {
 		VkBuffer buffer;
 		VmaAllocation allocation;
@@ -37,25 +77,112 @@ namespace CLAR {
 		Allocator(Device& device);
 		~Allocator();
 
-		Buffer CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags = 0) const;
+		Buffer CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags = 0, MemoryCategory category = MemoryCategory::Other) const;
 
 		template<typename T>
-		Buffer CreateBuffer(const std::vector<T>& elements, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags = 0) const;
+		Buffer CreateBuffer(std::span<const T> elements, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags = 0, MemoryCategory category = MemoryCategory::Other) const;
+		template<typename T>
+		Buffer CreateBuffer(const std::vector<T>& elements, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags = 0, MemoryCategory category = MemoryCategory::Other) const;
 		template<typename T>
-		Buffer CreateBuffer(const T& element, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags = 0) const;
+		Buffer CreateBuffer(const T& element, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags = 0, MemoryCategory category = MemoryCategory::Other) const;
 
-		Image CreateImage(VkExtent2D size, VkFormat format, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags = 0, VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT, uint32_t mipLevels = 1) const;
+		Image CreateImage(VkExtent2D size, VkFormat format, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags = 0, VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT, uint32_t mipLevels = 1, MemoryCategory category = MemoryCategory::Other) const;
 		Texture CreateTexture(const Image& image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels) const;
 
-		AccelerationStructure CreateAccelerationStructure(VkAccelerationStructureCreateInfoKHR& createInfo) const;
+		// A movable structure lives in the defragmented pool, see SetRelocation
+		AccelerationStructure CreateAccelerationStructure(VkAccelerationStructureCreateInfoKHR& createInfo, bool movable = false) const;
+
+		// Device local buffer in the pool Defragment compacts. Its owner has to register a relocation, a buffer
+		// without one is never moved. The buffer also gets transfer usage, the moves copy it.
+		Buffer CreateMovableBuffer(VkDeviceSize size, VkBufferUsageFlags usage, MemoryCategory category = MemoryCategory::Other) const;
+		// relocate runs when Defragment moved the allocation, with what replaces buffer or as from now on. The old
+		// one stays valid until the frames in flight are done with it, anything recorded afterwards uses the new one.
+		void SetRelocation(const Buffer& buffer, std::function<void(const Buffer&)> relocate) const;
+		void SetRelocation(const AccelerationStructure& as, std::function<void(const AccelerationStructure&)> relocate) const;
+
+		// Device memory for images created and bound by hand, so several of them can share it. With lazy set the
+		// memory is lazily allocated when the device has such a type and requirements allows it.
+		VmaAllocation AllocateMemory(const VkMemoryRequirements& requirements, bool lazy, MemoryCategory category = MemoryCategory::Other) const;
+		void BindImageMemory(VmaAllocation allocation, VkImage image) const;
+		void FreeMemory(VmaAllocation allocation) const;
+		bool HasLazilyAllocatedMemory() const;
 
 		void DestroyBuffer(const Buffer& buffer) const;
 		void DestroyImage(const Image& image) const;
 		void DestroyTexture(const Texture& texture) const;
 		void DestroyAccelerationStructure(const AccelerationStructure& as) const;
+
+		// Makes host writes to a mapped buffer visible to the device, a no-op on coherent memory
+		void Flush(const Buffer& buffer, VkDeviceSize offset, VkDeviceSize size) const;
+		// Makes device writes to a mapped buffer visible to the host, a no-op on coherent memory
+		void Invalidate(const Buffer& buffer, VkDeviceSize offset, VkDeviceSize size) const;
+
+		// Hands the copies recorded by CreateBuffer to the graphics queue. Anything submitted to that queue
+		// afterwards sees the data, so call it before the first submission that reads the new buffers.
+		void FlushUploads() const { m_UploadHeap->Submit(); }
+		// Per frame variant of FlushUploads: the copies go out, but only those already finished are handed to
+		// the graphics queue, the rest follow on a later call. Nothing waits on a copy still in flight.
+		void StreamUploads() const { m_UploadHeap->Stream(); }
+		UploadHeap& GetUploadHeap() const { return *m_UploadHeap; }
+
+		// Live bytes and allocations per category, the upload heap's ring counts as staging
+		std::array<MemoryCategoryStats, static_cast<size_t>(MemoryCategory::Count)> GetCategoryStats() const;
+		// One entry per memory heap, driver reported with VK_EXT_memory_budget and estimated by VMA otherwise
+		std::vector<MemoryHeapBudget> GetHeapBudgets() const;
+		// Whether size more bytes fit the budget of the biggest device local heap, checked before big allocations
+		// that have a cheaper fallback
+		bool FitsBudget(VkDeviceSize size) const;
+		// VMA's detailed JSON statistics, every block and allocation, with the categories as allocation names
+		void DumpStatistics(const std::filesystem::path& path) const;
+
+		// One incremental step of compacting the movable pool, opt in and meant to be called once per frame.
+		// Moves are recorded until budget is used up, copied on the graphics queue without waiting, and the pass
+		// ends through deletionQueue once the frames still reading the old places retired; until then the calls
+		// return right away, and the moved allocations must not be destroyed. Returns the number of allocations moved.
+		uint32_t Defragment(DeletionQueue& deletionQueue, std::chrono::microseconds budget);
+		uint64_t DefragmentedBytes() const { return m_DefragmentedBytes; }
+		uint64_t DefragmentedAllocations() const { return m_DefragmentedAllocations; }
 	private:
 		VmaAllocator m_Allocator;
 		Device& m_Device;
+		std::unique_ptr<UploadHeap> m_UploadHeap;
+
+		struct CategoryCounters {
+			std::atomic<VkDeviceSize> bytes = 0;
+			std::atomic<uint32_t> allocations = 0;
+		};
+		// CreateBuffer and CreateImage are called from the loader threads too
+		mutable std::array<CategoryCounters, static_cast<size_t>(MemoryCategory::Count)> m_Categories;
+
+		void Track(VmaAllocation allocation, MemoryCategory category) const;
+		void Untrack(VmaAllocation allocation) const;
+
+		// what a move needs to recreate a movable allocation's buffer, and whom to tell
+		struct Movable {
+			VkBuffer buffer;
+			VkBufferUsageFlags usage;
+			VkDeviceSize size;
+			VkAccelerationStructureKHR as = VK_NULL_HANDLE;
+			VkAccelerationStructureTypeKHR asType = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+			std::function<void(const Buffer&)> relocateBuffer;
+			std::function<void(const AccelerationStructure&)> relocateAs;
+		};
+		VmaPool m_MovablePool = VK_NULL_HANDLE;
+		mutable std::unordered_map<VmaAllocation, Movable> m_Movables;
+		mutable std::mutex m_MovableMutex;
+		mutable std::atomic<uint32_t> m_MovableFrees = 0;	// since the last defragmentation started
+
+		VmaDefragmentationContext m_Defragmentation = VK_NULL_HANDLE;
+		VmaDefragmentationPassMoveInfo m_DefragmentationPass{};
+		bool m_DefragmentationPassPending = false;
+		uint64_t m_DefragmentedBytes = 0;
+		uint64_t m_DefragmentedAllocations = 0;
+
+		void CreateMovablePool();
+		void EndDefragmentationPass();
+
+		// Host visible buffers are written in place, device local ones are copied through the upload heap
+		void Upload(const Buffer& buffer, const void* data, VkDeviceSize size) const;
 
 	private:
 		void Init(const Device& device);
@@ -65,30 +192,28 @@ namespace CLAR {
 	};
 	
 	template<typename T>
-	inline Buffer Allocator::CreateBuffer(const std::vector<T>& elements, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags) const
+	inline Buffer Allocator::CreateBuffer(std::span<const T> elements, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags, MemoryCategory category) const
 	{
-		VkDeviceSize size = elements.size() * sizeof(T);
+		VkDeviceSize size = elements.size_bytes();
 
-		Buffer buffer = CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, flags);
-		Buffer stagingBuffer = CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
-		stagingBuffer.Write(elements.data(), size);
-
-		m_Device.CopyBuffer(stagingBuffer.buffer, buffer.buffer, size);
-		DestroyBuffer(stagingBuffer);
+		Buffer buffer = CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, flags, category);
+		Upload(buffer, elements.data(), size);
 		return buffer;
 	}
 
 	template<typename T>
-	inline Buffer Allocator::CreateBuffer(const T& element, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags) const
+	inline Buffer Allocator::CreateBuffer(const std::vector<T>& elements, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags, MemoryCategory category) const
 	{
-		VkDeviceSize size = sizeof(T);
+		return CreateBuffer(std::span<const T>(elements), usage, flags, category);
+	}
 
-		Buffer buffer = CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, flags);
-		Buffer stagingBuffer = CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
-		stagingBuffer.Write(&element, size);
+	template<typename T>
+	inline Buffer Allocator::CreateBuffer(const T& element, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags, MemoryCategory category) const
+	{
+		VkDeviceSize size = sizeof(T);
 
-		m_Device.CopyBuffer(stagingBuffer.buffer, buffer.buffer, size);
-		DestroyBuffer(stagingBuffer);
+		Buffer buffer = CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, flags, category);
+		Upload(buffer, &element, size);
 		return buffer;
 	}
 }
@@ -0,0 +1,146 @@
+#include "ClarAsCache.h"
+
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iostream>
+
+namespace CLAR {
+
+	// Offsets into the header of a serialized acceleration structure, see vkCmdCopyAccelerationStructureToMemoryKHR
+	static constexpr size_t SerializedSizeOffset = 2 * VK_UUID_SIZE;
+	static constexpr size_t DeserializedSizeOffset = SerializedSizeOffset + sizeof(uint64_t);
+	static constexpr size_t SerializedHeaderSize = DeserializedSizeOffset + 2 * sizeof(uint64_t);
+
+	static uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), bytes += sizeof(uint64_t))
+		{
+			uint64_t word;
+			memcpy(&word, bytes, sizeof(word));
+			hash = (hash ^ word) * 0x100000001B3ull;
+			hash ^= hash >> 29;
+		}
+		for (; size > 0; size--, bytes++)
+			hash = (hash ^ *bytes) * 0x100000001B3ull;
+		return hash;
+	}
+
+	AsCache::AsCache(const Device& device, std::filesystem::path directory)
+		: m_Device(device), m_Directory(std::move(directory))
+	{
+	}
+
+	uint64_t AsCache::GeometryKey(const Model& model, uint32_t lod, VkBuildAccelerationStructureFlagsKHR flags)
+	{
+		uint64_t hash = 0x9E3779B97F4A7C15ull;
+
+		uint64_t layout[] = { flags, static_cast<uint64_t>(model.vertexFormat), model.VertexStride(), model.VertexCount() };
+		hash = HashBytes(hash, layout, sizeof(layout));
+
+		// only the positions go into the BLAS, the other attributes may change without invalidating it
+		for (const Vertex& vertex : model.Vertices())
+			hash = HashBytes(hash, &vertex.pos, sizeof(vertex.pos));
+
+		std::span<const uint32_t> indices = model.LodIndices(lod);
+		hash = HashBytes(hash, indices.data(), indices.size_bytes());
+
+		for (const Submesh& submesh : model.LodSubmeshes(lod))
+		{
+			uint32_t range[] = { submesh.firstIndex, submesh.indexCount };
+			hash = HashBytes(hash, range, sizeof(range));
+		}
+
+		// murmur3 finalizer
+		hash ^= hash >> 33;
+		hash *= 0xFF51AFD7ED558CCDull;
+		hash ^= hash >> 33;
+		hash *= 0xC4CEB93FE5EFAD1Full;
+		hash ^= hash >> 33;
+		return hash != 0 ? hash : 1;
+	}
+
+	std::filesystem::path AsCache::CachePath(uint64_t key) const
+	{
+		return m_Directory / std::format("{:016x}.claras", key);
+	}
+
+	bool AsCache::Load(uint64_t key, AsCacheEntry& entry) const
+	{
+		auto file = std::make_unique<MappedFile>();
+		if (!file->Open(CachePath(key)) || file->Size() < sizeof(AsCacheHeader))
+			return false;
+
+		AsCacheHeader header;
+		memcpy(&header, file->Data(), sizeof(AsCacheHeader));
+
+		if (header.magic != AsCacheHeader::Magic || header.version != AsCacheHeader::Version || header.key != key ||
+			header.blobSize < SerializedHeaderSize || header.blobOffset + header.blobSize > file->Size())
+			return false;
+
+		std::span<const uint8_t> blob = file->View<uint8_t>(header.blobOffset, header.blobSize);
+
+		uint64_t serializedSize;
+		uint64_t deserializedSize;
+		memcpy(&serializedSize, blob.data() + SerializedSizeOffset, sizeof(serializedSize));
+		memcpy(&deserializedSize, blob.data() + DeserializedSizeOffset, sizeof(deserializedSize));
+		if (serializedSize != header.blobSize || deserializedSize == 0)
+			return false;
+
+		// a blob from another driver, or another version of this one, is rebuilt
+		VkAccelerationStructureVersionInfoKHR versionInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR };
+		versionInfo.pVersionData = blob.data();
+		VkAccelerationStructureCompatibilityKHR compatibility = VK_ACCELERATION_STRUCTURE_COMPATIBILITY_INCOMPATIBLE_KHR;
+		vkGetDeviceAccelerationStructureCompatibilityKHR(m_Device, &versionInfo, &compatibility);
+		if (compatibility != VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR)
+			return false;
+
+		entry.blob = blob;
+		entry.deserializedSize = deserializedSize;
+		entry.file = std::move(file);
+		return true;
+	}
+
+	void AsCache::Store(uint64_t key, std::span<const uint8_t> blob) const
+	{
+		AsCacheHeader header{
+			.magic = AsCacheHeader::Magic,
+			.version = AsCacheHeader::Version,
+			.key = key,
+			.blobOffset = sizeof(AsCacheHeader),
+			.blobSize = blob.size(),
+		};
+
+		std::error_code ec;
+		std::filesystem::create_directories(m_Directory, ec);
+
+		// Written to a temporary first so a crash never leaves half a blob behind
+		std::filesystem::path cachePath = CachePath(key);
+		std::filesystem::path tmpPath = cachePath;
+		tmpPath += ".tmp";
+
+		{
+			std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+			if (!out)
+			{
+				std::cerr << "[AsCache]: cannot write " << tmpPath << '\n';
+				return;
+			}
+
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(reinterpret_cast<const char*>(blob.data()), blob.size());
+
+			if (!out)
+			{
+				out.close();
+				std::filesystem::remove(tmpPath, ec);
+				return;
+			}
+		}
+
+		std::filesystem::rename(tmpPath, cachePath, ec);
+		if (ec)
+			std::filesystem::remove(tmpPath, ec);
+	}
+}
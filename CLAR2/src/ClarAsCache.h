@@ -0,0 +1,53 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <span>
+
+#include "clar_device.h"
+#include "ClarModel.h"
+#include "utils/MappedFile.h"
+
+namespace CLAR {
+
+	// Serialized BLAS, stored in the cache directory as <key>.claras.
+	// Layout: AsCacheHeader, then at blobOffset the output of vkCmdCopyAccelerationStructureToMemoryKHR, which begins
+	// with the driver and compatibility UUIDs followed by the serialized and deserialized sizes.
+	struct AsCacheHeader {
+		static constexpr uint32_t Magic = 0x41524C43; // "CLRA"
+		static constexpr uint32_t Version = 1;
+
+		uint32_t magic;
+		uint32_t version;
+		uint64_t key;
+		uint64_t blobOffset;
+		uint64_t blobSize;
+	};
+
+	// A cached BLAS as Load found it, the blob is a view into the mapped file
+	struct AsCacheEntry {
+		std::unique_ptr<MappedFile> file;
+		std::span<const uint8_t> blob;
+		VkDeviceSize deserializedSize = 0;
+	};
+
+	class AsCache {
+	public:
+		AsCache(const Device& device, std::filesystem::path directory);
+
+		// Hashes what the BLAS of lod is built from: vertex positions, the level's indices and submesh ranges and
+		// the build flags, see RTBuilder::BlasBuildFlags. Never 0, which BlasInput uses for no caching.
+		static uint64_t GeometryKey(const Model& model, uint32_t lod, VkBuildAccelerationStructureFlagsKHR flags);
+
+		// Maps the blob of key, fails if it is missing, malformed or the device cannot deserialize it
+		bool Load(uint64_t key, AsCacheEntry& entry) const;
+		void Store(uint64_t key, std::span<const uint8_t> blob) const;
+
+		const std::filesystem::path& Directory() const { return m_Directory; }
+	private:
+		const Device& m_Device;
+		std::filesystem::path m_Directory;
+
+		std::filesystem::path CachePath(uint64_t key) const;
+	};
+}
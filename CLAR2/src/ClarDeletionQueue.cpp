@@ -0,0 +1,35 @@
+#include "ClarDeletionQueue.h"
+
+namespace CLAR {
+
+	DeletionQueue::~DeletionQueue()
+	{
+		Flush();
+	}
+
+	void DeletionQueue::Push(std::function<void()>&& destroy)
+	{
+		m_Pending.push_back({ m_Frame, std::move(destroy) });
+	}
+
+	void DeletionQueue::Retire(uint64_t frame)
+	{
+		// pushes only ever go to the back with the current frame, so the front is the oldest
+		while (!m_Pending.empty() && m_Pending.front().frame <= frame)
+		{
+			auto destroy = std::move(m_Pending.front().destroy);
+			m_Pending.pop_front();
+			destroy();
+		}
+	}
+
+	void DeletionQueue::Flush()
+	{
+		while (!m_Pending.empty())
+		{
+			auto destroy = std::move(m_Pending.front().destroy);
+			m_Pending.pop_front();
+			destroy();
+		}
+	}
+}
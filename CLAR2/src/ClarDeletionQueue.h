@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+namespace CLAR {
+
+	// Destroys GPU objects once no frame in flight can use them anymore. A deletion pushed while a frame is being
+	// recorded belongs to that frame; work submitted earlier (SubmitAsync, uploads) sits in front of the frame on
+	// the graphics queue, so it is covered too. The Renderer retires a frame once it waited on its fence.
+	// Not thread safe, deletions are pushed from the render thread.
+	class DeletionQueue {
+	public:
+		DeletionQueue() = default;
+		~DeletionQueue();
+
+		DeletionQueue(const DeletionQueue&) = delete;
+		DeletionQueue& operator=(const DeletionQueue&) = delete;
+
+		void Push(std::function<void()>&& destroy);
+
+		// The frame being recorded was submitted, later pushes belong to the next one
+		void EndFrame() { m_Frame++; }
+		// Runs the deletions pushed up to and including frame
+		void Retire(uint64_t frame);
+		// Runs every deletion, once the device is idle
+		void Flush();
+
+		uint64_t CurrentFrame() const { return m_Frame; }
+		size_t Size() const { return m_Pending.size(); }
+
+	private:
+		struct Deletion {
+			uint64_t frame;
+			std::function<void()> destroy;
+		};
+
+		std::deque<Deletion> m_Pending;
+		uint64_t m_Frame = 0;
+	};
+}
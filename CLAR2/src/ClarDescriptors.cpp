@@ -180,6 +180,36 @@ namespace CLAR {
         return *this;
     }
 
+    DescritorWriter& DescritorWriter::WriteUniformBufferDynamic(uint32_t binding, const VkDescriptorBufferInfo* bufferInfo)
+    {
+        m_DescriptorWrites[binding] = {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = nullptr,
+                .dstBinding = binding,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                .pBufferInfo = bufferInfo
+            };
+
+        return *this;
+    }
+
+    DescritorWriter& DescritorWriter::WriteStorageBufferDynamic(uint32_t binding, const VkDescriptorBufferInfo* bufferInfo)
+    {
+        m_DescriptorWrites[binding] = {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = nullptr,
+                .dstBinding = binding,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+                .pBufferInfo = bufferInfo
+            };
+
+        return *this;
+    }
+
     DescritorWriter& DescritorWriter::WriteAccelerationStructure(uint32_t binding, const VkWriteDescriptorSetAccelerationStructureKHR* accelerationStructureInfo)
     {
         m_DescriptorWrites[binding] = {
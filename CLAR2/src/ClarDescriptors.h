@@ -57,6 +57,9 @@ namespace CLAR {
 		DescritorWriter& WriteUniformBuffer(uint32_t binding, const VkDescriptorBufferInfo* bufferInfo);
 		DescritorWriter& WriteImage(uint32_t binding, const VkDescriptorImageInfo* imageInfo);
 		DescritorWriter& WriteStorageBuffer(uint32_t binding, const VkDescriptorBufferInfo* bufferInfo);
+		// the offset into the buffer is given when the set is bound, see FrameAllocator
+		DescritorWriter& WriteUniformBufferDynamic(uint32_t binding, const VkDescriptorBufferInfo* bufferInfo);
+		DescritorWriter& WriteStorageBufferDynamic(uint32_t binding, const VkDescriptorBufferInfo* bufferInfo);
 		DescritorWriter& WriteAccelerationStructure(uint32_t binding, const VkWriteDescriptorSetAccelerationStructureKHR* accelerationStructureInfo);
 		DescritorWriter& WriteStorageImage(uint32_t binding, const VkDescriptorImageInfo* imageInfo);
 		void Update(VkDescriptorSet dstSet, Device& device);
@@ -0,0 +1,57 @@
+#include "ClarFrameAllocator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace CLAR {
+
+	FrameAllocator::FrameAllocator(Device& device, const Allocator& allocator, VkDeviceSize frameSize)
+		: m_Device(device), m_Allocator(allocator)
+	{
+		// 16 bytes is what VkAccelerationStructureInstanceKHR data needs
+		VkPhysicalDeviceLimits limits = device.GetPhysicalDeviceProperties().limits;
+		m_Alignment = std::max({ limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment, VkDeviceSize(16) });
+		m_FrameSize = (frameSize + m_Alignment - 1) / m_Alignment * m_Alignment;
+
+		m_Buffer = m_Allocator.CreateBuffer(m_FrameSize * MAX_FRAMES_IN_FLIGHT,
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+			VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, MemoryCategory::Staging);
+		m_Address = m_Device.GetBufferDeviceAddress(m_Buffer.buffer);
+	}
+
+	FrameAllocator::~FrameAllocator()
+	{
+		m_Allocator.DestroyBuffer(m_Buffer);
+	}
+
+	void FrameAllocator::BeginFrame(uint32_t frame)
+	{
+		m_Base = frame * m_FrameSize;
+		m_Head = 0;
+	}
+
+	FrameAllocation FrameAllocator::Allocate(VkDeviceSize size)
+	{
+		VkDeviceSize offset = (m_Head + m_Alignment - 1) / m_Alignment * m_Alignment;
+		if (offset + size > m_FrameSize)
+			throw std::runtime_error("frame allocator is out of space!");
+		m_Head = offset + size;
+
+		offset += m_Base;
+		return {
+			m_Buffer.buffer,
+			offset,
+			size,
+			static_cast<char*>(m_Buffer.allocationInfo.pMappedData) + offset,
+			m_Address + offset
+		};
+	}
+
+	void FrameAllocator::Write(const FrameAllocation& allocation, const void* data) const
+	{
+		memcpy(allocation.mapped, data, allocation.size);
+		m_Allocator.Flush(m_Buffer, allocation.offset, allocation.size);
+	}
+}
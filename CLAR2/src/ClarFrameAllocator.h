@@ -0,0 +1,76 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "ClarAllocator.h"
+
+namespace CLAR {
+
+	// Slice of the FrameAllocator's buffer, valid until the same frame slot is recorded again
+	struct FrameAllocation {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		void* mapped = nullptr;
+		VkDeviceAddress address = 0;
+
+		uint32_t DynamicOffset() const { return static_cast<uint32_t>(offset); }
+	};
+
+	// Bump allocator for data that only lives for one frame: uniforms, the object and light tables, staged TLAS instances.
+	// One persistently mapped buffer holds a slice per frame in flight and BeginFrame rewinds the slice of the
+	// frame being recorded, so nothing is created or destroyed per frame. Descriptors are written once against
+	// the whole buffer as dynamic uniform or storage buffers, the dynamic offsets pick this frame's copy.
+	class FrameAllocator {
+	public:
+		static constexpr VkDeviceSize DefaultFrameSize = 4ull << 20;
+
+		FrameAllocator(Device& device, const Allocator& allocator, VkDeviceSize frameSize = DefaultFrameSize);
+		~FrameAllocator();
+
+		FrameAllocator(const FrameAllocator&) = delete;
+		FrameAllocator& operator=(const FrameAllocator&) = delete;
+
+		// The fence of the frame that used this slot before has to be waited on already
+		void BeginFrame(uint32_t frame);
+
+		// Aligned for dynamic uniform and storage offsets and for TLAS instance data
+		FrameAllocation Allocate(VkDeviceSize size);
+
+		template<typename T>
+		FrameAllocation Push(std::span<const T> elements);
+		template<typename T>
+		FrameAllocation Push(const std::vector<T>& elements) { return Push(std::span<const T>(elements)); }
+		template<typename T>
+		FrameAllocation Push(const T& element) { return Push(std::span<const T>(&element, 1)); }
+
+		// For dynamic descriptors: the whole buffer, with the range every frame's copy of the binding has
+		VkDescriptorBufferInfo DescriptorInfo(VkDeviceSize range) const { return { m_Buffer.buffer, 0, range }; }
+
+		VkDeviceSize FrameSize() const { return m_FrameSize; }
+		VkDeviceSize UsedBytes() const { return m_Head; }
+
+	private:
+		Device& m_Device;
+		const Allocator& m_Allocator;
+
+		Buffer m_Buffer;
+		VkDeviceAddress m_Address;
+		VkDeviceSize m_FrameSize;
+		VkDeviceSize m_Alignment;
+
+		VkDeviceSize m_Base = 0;	// start of the current frame's slice
+		VkDeviceSize m_Head = 0;	// bytes used in it
+
+		void Write(const FrameAllocation& allocation, const void* data) const;
+	};
+
+	template<typename T>
+	inline FrameAllocation FrameAllocator::Push(std::span<const T> elements)
+	{
+		FrameAllocation allocation = Allocate(elements.size_bytes());
+		Write(allocation, elements.data());
+		return allocation;
+	}
+}
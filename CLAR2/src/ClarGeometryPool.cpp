@@ -0,0 +1,131 @@
+#include "ClarGeometryPool.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace CLAR {
+
+	static constexpr VkDeviceSize RangeAlignment = 16;
+
+	static constexpr VkBufferUsageFlags HeapUsage[] = {
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+	};
+
+	GeometryPool::GeometryPool(Device& device, const Allocator& allocator, VkDeviceSize blockSize)
+		: m_Device(device), m_Allocator(allocator), m_BlockSize(blockSize)
+	{
+	}
+
+	GeometryPool::~GeometryPool()
+	{
+		for (auto& blocks : m_Blocks)
+		{
+			for (auto& block : blocks)
+				m_Allocator.DestroyBuffer(block.buffer);
+		}
+	}
+
+	GeometryRange GeometryPool::Allocate(GeometryHeap heap, VkDeviceSize size)
+	{
+		if (size == 0)
+			return {};
+
+		// every range keeps its end aligned too, so free ranges always start aligned
+		size = (size + RangeAlignment - 1) & ~(RangeAlignment - 1);
+
+		auto& blocks = m_Blocks[static_cast<size_t>(heap)];
+		for (uint32_t b = 0; b <= blocks.size(); b++)
+		{
+			if (b == blocks.size())
+			{
+				// a model bigger than a block gets a block of its own
+				VkDeviceSize blockSize = std::max(m_BlockSize, size);
+				Block block{};
+				block.buffer = m_Allocator.CreateMovableBuffer(blockSize, HeapUsage[static_cast<size_t>(heap)], MemoryCategory::Geometry);
+				block.address = m_Device.GetBufferDeviceAddress(block.buffer.buffer);
+				block.size = blockSize;
+				block.freeRanges[0] = blockSize;
+				blocks.push_back(std::move(block));
+				m_Allocator.SetRelocation(blocks.back().buffer, [this, heap, b](const Buffer& moved) { Relocate(heap, b, moved); });
+			}
+
+			Block& block = blocks[b];
+			if (block.size - block.used < size)
+				continue;
+
+			// first fit keeps the low end of a block dense
+			auto free = std::ranges::find_if(block.freeRanges, [size](const auto& entry) { return entry.second >= size; });
+			if (free == block.freeRanges.end())
+				continue;
+
+			auto [offset, freeSize] = *free;
+			block.freeRanges.erase(free);
+			if (freeSize > size)
+				block.freeRanges[offset + size] = freeSize - size;
+			block.used += size;
+
+			return { block.buffer.buffer, offset, size, block.address + offset, heap, b };
+		}
+		return {}; // unreachable, the last iteration always has a fresh block
+	}
+
+	void GeometryPool::Free(const GeometryRange& range)
+	{
+		if (!range.IsValid())
+			return;
+
+		Block& block = m_Blocks[static_cast<size_t>(range.heap)][range.block];
+		block.used -= range.size;
+
+		auto inserted = block.freeRanges.emplace(range.offset, range.size).first;
+
+		// merge with the free neighbours on both sides
+		auto next = std::next(inserted);
+		if (next != block.freeRanges.end() && inserted->first + inserted->second == next->first)
+		{
+			inserted->second += next->second;
+			block.freeRanges.erase(next);
+		}
+		if (inserted != block.freeRanges.begin())
+		{
+			auto previous = std::prev(inserted);
+			if (previous->first + previous->second == inserted->first)
+			{
+				previous->second += inserted->second;
+				block.freeRanges.erase(inserted);
+			}
+		}
+	}
+
+	VkDeviceSize GeometryPool::UsedBytes(GeometryHeap heap) const
+	{
+		VkDeviceSize used = 0;
+		for (const auto& block : m_Blocks[static_cast<size_t>(heap)])
+			used += block.used;
+		return used;
+	}
+
+	VkDeviceSize GeometryPool::CapacityBytes(GeometryHeap heap) const
+	{
+		VkDeviceSize capacity = 0;
+		for (const auto& block : m_Blocks[static_cast<size_t>(heap)])
+			capacity += block.size;
+		return capacity;
+	}
+
+	void GeometryPool::Relocate(GeometryHeap heap, uint32_t block, const Buffer& buffer)
+	{
+		Block& moved = m_Blocks[static_cast<size_t>(heap)][block];
+		moved.buffer = buffer;
+		moved.address = m_Device.GetBufferDeviceAddress(buffer.buffer);
+
+		if (m_RelocationHandler)
+			m_RelocationHandler({ heap, block, moved.buffer.buffer, moved.address });
+	}
+
+	void GeometryPool::Write(const GeometryRange& range, const void* data, VkDeviceSize size) const
+	{
+		m_Allocator.GetUploadHeap().Upload(range.buffer, data, size, range.offset);
+	}
+}
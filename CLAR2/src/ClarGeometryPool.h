@@ -0,0 +1,99 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <span>
+#include <vector>
+
+#include "ClarAllocator.h"
+
+namespace CLAR {
+
+	enum class GeometryHeap {
+		Vertex, // vertex streams and the per geometry tables the hit shader reads
+		Index,
+		Count
+	};
+
+	// Sub range of one of the GeometryPool's megabuffers
+	struct GeometryRange {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		VkDeviceAddress address = 0; // of the first byte, what ObjDesc and the BLAS builds read
+		GeometryHeap heap = GeometryHeap::Vertex;
+		uint32_t block = 0;
+
+		bool IsValid() const { return buffer != VK_NULL_HANDLE; }
+	};
+
+	// A block that Allocator::Defragment moved. Every range of it keeps its offset, only the buffer and the
+	// addresses change, see Model::Relocate.
+	struct GeometryRelocation {
+		GeometryHeap heap;
+		uint32_t block;
+		VkBuffer buffer;			// the block's new buffer
+		VkDeviceAddress address;	// and its address
+	};
+
+	// Scene wide vertex and index megabuffers. Models take ranges out of them instead of owning a VMA allocation
+	// per stream, so a scene is a handful of allocations and every model of it sits in the same few buffers.
+	// Each heap grows by whole blocks; a range never straddles two blocks, and freed ranges go back to a
+	// per block free list that merges with its neighbours. Ranges are 16 byte aligned, the default alignment
+	// of GLSL buffer references. Not thread safe, and a range must only be freed once the GPU is done with it.
+	// The blocks are movable allocations; when one moves, the relocation handler has to update every range
+	// handed out from it.
+	class GeometryPool {
+	public:
+		static constexpr VkDeviceSize DefaultBlockSize = 128ull << 20;
+
+		GeometryPool(Device& device, const Allocator& allocator, VkDeviceSize blockSize = DefaultBlockSize);
+		~GeometryPool();
+
+		GeometryPool(const GeometryPool&) = delete;
+		GeometryPool& operator=(const GeometryPool&) = delete;
+
+		// An empty request gives an invalid range
+		GeometryRange Allocate(GeometryHeap heap, VkDeviceSize size);
+		void Free(const GeometryRange& range);
+
+		// Allocates a range and copies elements into it through the allocator's UploadHeap
+		template<typename T>
+		GeometryRange Upload(GeometryHeap heap, std::span<const T> elements);
+		template<typename T>
+		GeometryRange Upload(GeometryHeap heap, const std::vector<T>& elements) { return Upload(heap, std::span<const T>(elements)); }
+
+		VkDeviceSize UsedBytes(GeometryHeap heap) const;
+		VkDeviceSize CapacityBytes(GeometryHeap heap) const;
+		uint32_t BlockCount(GeometryHeap heap) const { return static_cast<uint32_t>(m_Blocks[static_cast<size_t>(heap)].size()); }
+
+		void SetRelocationHandler(std::function<void(const GeometryRelocation&)> handler) { m_RelocationHandler = std::move(handler); }
+
+	private:
+		struct Block {
+			Buffer buffer;
+			VkDeviceAddress address;
+			VkDeviceSize size;
+			VkDeviceSize used = 0;
+			std::map<VkDeviceSize, VkDeviceSize> freeRanges; // offset to size
+		};
+
+		Device& m_Device;
+		const Allocator& m_Allocator;
+		VkDeviceSize m_BlockSize;
+		std::vector<Block> m_Blocks[static_cast<size_t>(GeometryHeap::Count)];
+		std::function<void(const GeometryRelocation&)> m_RelocationHandler;
+
+		void Relocate(GeometryHeap heap, uint32_t block, const Buffer& buffer);
+		void Write(const GeometryRange& range, const void* data, VkDeviceSize size) const;
+	};
+
+	template<typename T>
+	inline GeometryRange GeometryPool::Upload(GeometryHeap heap, std::span<const T> elements)
+	{
+		GeometryRange range = Allocate(heap, elements.size_bytes());
+		if (range.IsValid())
+			Write(range, elements.data(), elements.size_bytes());
+		return range;
+	}
+}
@@ -0,0 +1,50 @@
+#include "ClarGeometryUploader.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace CLAR {
+
+	GeometryUploader::GeometryUploader(const Allocator& allocator, GeometryPool& pool)
+		: m_Allocator(allocator), m_Pool(pool)
+	{
+	}
+
+	Model* GeometryUploader::Add(Model* model)
+	{
+		std::promise<void> loaded;
+		loaded.set_value();
+		m_Pending.push_back({ model, loaded.get_future().share() });
+		return model;
+	}
+
+	Model* GeometryUploader::Add(const ModelHandle& handle)
+	{
+		m_Pending.push_back(handle);
+		return handle.model;
+	}
+
+	void GeometryUploader::UploadAll()
+	{
+		auto pending = std::move(m_Pending);
+		m_Pending.clear();
+
+		while (!pending.empty())
+		{
+			auto ready = std::ranges::find_if(pending, [](const ModelHandle& handle) { return handle.IsReady(); });
+			if (ready == pending.end())
+			{
+				// nothing left to record, let the GPU copy what we have while the pool finishes parsing
+				m_Allocator.FlushUploads();
+				pending.front().ready.wait_for(std::chrono::milliseconds(1));
+				continue;
+			}
+
+			Model* model = ready->Get();
+			pending.erase(ready);
+			model->CreateBuffers(m_Pool);
+		}
+
+		m_Allocator.FlushUploads();
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+#include "ClarAllocator.h"
+#include "ClarGeometryPool.h"
+#include "ClarModel.h"
+#include "ClarModelLoader.h"
+
+namespace CLAR {
+
+	// Collects the models of a scene and puts them into the GeometryPool as soon as each one is parsed. All copies go
+	// into the open batch of the allocator's UploadHeap; the batch is only submitted when the uploader would
+	// otherwise sit waiting on a parse, so the GPU copies what is ready while the pool keeps parsing, and a
+	// scene that is parsed already goes out in a single submission.
+	class GeometryUploader {
+	public:
+		GeometryUploader(const Allocator& allocator, GeometryPool& pool);
+
+		GeometryUploader(const GeometryUploader&) = delete;
+		GeometryUploader& operator=(const GeometryUploader&) = delete;
+
+		// Returns the model so it can be stored right away
+		Model* Add(Model* model);
+		Model* Add(const ModelHandle& handle);
+
+		// Uploads every model added so far, in the order their parsing finishes, and submits the last copies.
+		// Rethrows the first load failure.
+		void UploadAll();
+
+	private:
+		const Allocator& m_Allocator;
+		GeometryPool& m_Pool;
+		std::vector<ModelHandle> m_Pending;
+	};
+}
@@ -0,0 +1,510 @@
+#include "ClarGltfLoader.h"
+
+#include <cstring>
+#include <memory>
+#include <span>
+#include <stdexcept>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "utils/Json.h"
+#include "utils/MappedFile.h"
+
+namespace CLAR {
+
+	namespace {
+
+		constexpr uint32_t GlbMagic = 0x46546C67;  // "glTF"
+		constexpr uint32_t GlbVersion = 2;
+		constexpr uint32_t ChunkJson = 0x4E4F534A; // "JSON"
+		constexpr uint32_t ChunkBin = 0x004E4942;  // "BIN\0"
+
+		constexpr uint32_t ModeTriangles = 4;
+
+		enum ComponentType : uint32_t {
+			Byte = 5120,
+			UnsignedByte = 5121,
+			Short = 5122,
+			UnsignedShort = 5123,
+			UnsignedInt = 5125,
+			Float = 5126,
+		};
+
+		[[noreturn]] void Fail(const std::filesystem::path& file, const std::string& what)
+		{
+			throw std::runtime_error("glTF " + file.string() + ": " + what);
+		}
+
+		size_t ComponentSize(uint32_t componentType)
+		{
+			switch (componentType)
+			{
+			case Byte:
+			case UnsignedByte:
+				return 1;
+			case Short:
+			case UnsignedShort:
+				return 2;
+			case UnsignedInt:
+			case Float:
+				return 4;
+			default:
+				return 0;
+			}
+		}
+
+		uint32_t ComponentCount(const std::string& type)
+		{
+			if (type == "SCALAR") return 1;
+			if (type == "VEC2") return 2;
+			if (type == "VEC3") return 3;
+			if (type == "VEC4" || type == "MAT2") return 4;
+			if (type == "MAT3") return 9;
+			if (type == "MAT4") return 16;
+			return 0;
+		}
+
+		// Typed window into a buffer view. Accessors without a buffer view read as zeros, as the spec says.
+		struct Accessor {
+			const uint8_t* data = nullptr;
+			size_t stride = 0;
+			size_t count = 0;
+			uint32_t componentType = Float;
+			uint32_t components = 1;
+			bool normalized = false;
+
+			float Component(size_t element, uint32_t component) const
+			{
+				if (!data)
+					return 0.f;
+
+				const uint8_t* p = data + element * stride + component * ComponentSize(componentType);
+				switch (componentType)
+				{
+				case Float: { float v; memcpy(&v, p, sizeof(v)); return v; }
+				case UnsignedByte: return normalized ? *p / 255.f : static_cast<float>(*p);
+				case Byte: { int8_t v; memcpy(&v, p, sizeof(v)); return normalized ? std::max(v / 127.f, -1.f) : static_cast<float>(v); }
+				case UnsignedShort: { uint16_t v; memcpy(&v, p, sizeof(v)); return normalized ? v / 65535.f : static_cast<float>(v); }
+				case Short: { int16_t v; memcpy(&v, p, sizeof(v)); return normalized ? std::max(v / 32767.f, -1.f) : static_cast<float>(v); }
+				case UnsignedInt: { uint32_t v; memcpy(&v, p, sizeof(v)); return static_cast<float>(v); }
+				default: return 0.f;
+				}
+			}
+
+			// Missing components keep fallback, so a VEC3 color read as a vec4 keeps its alpha
+			template<int N>
+			glm::vec<N, float> Read(size_t element, glm::vec<N, float> fallback = glm::vec<N, float>(0.f)) const
+			{
+				const uint32_t n = std::min<uint32_t>(N, components);
+				if (data && componentType == Float)
+				{
+					memcpy(&fallback, data + element * stride, n * sizeof(float));
+					return fallback;
+				}
+				for (uint32_t c = 0; c < n; c++)
+					fallback[c] = Component(element, c);
+				return fallback;
+			}
+
+			uint32_t ReadIndex(size_t element) const
+			{
+				if (!data)
+					return 0;
+
+				const uint8_t* p = data + element * stride;
+				switch (componentType)
+				{
+				case UnsignedByte: return *p;
+				case UnsignedShort: { uint16_t v; memcpy(&v, p, sizeof(v)); return v; }
+				default: { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+				}
+			}
+		};
+
+		int HexDigit(char c)
+		{
+			if (c >= '0' && c <= '9') return c - '0';
+			if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+			if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+			return -1;
+		}
+
+		// Relative URIs are percent encoded UTF-8
+		std::filesystem::path DecodeUri(const std::filesystem::path& file, const std::string& uri)
+		{
+			std::u8string out;
+			for (size_t i = 0; i < uri.size(); i++)
+			{
+				if (uri[i] == '%' && i + 2 < uri.size())
+				{
+					int high = HexDigit(uri[i + 1]);
+					int low = HexDigit(uri[i + 2]);
+					if (high < 0 || low < 0)
+						Fail(file, "invalid percent encoding in uri " + uri);
+
+					out += static_cast<char8_t>(high * 16 + low);
+					i += 2;
+				}
+				else
+					out += static_cast<char8_t>(uri[i]);
+			}
+			return std::filesystem::path(out);
+		}
+
+		class GltfFile {
+		public:
+			explicit GltfFile(const std::filesystem::path& file)
+				: m_Path(file)
+			{
+				if (!m_File.Open(file))
+					Fail(file, "cannot open");
+
+				const uint8_t* data = m_File.Data();
+				const size_t size = m_File.Size();
+
+				uint32_t header[3];
+				if (size < sizeof(header))
+					Fail(file, "truncated header");
+				memcpy(header, data, sizeof(header));
+				if (header[0] != GlbMagic || header[1] != GlbVersion)
+					Fail(file, "not a binary glTF 2.0 file");
+
+				const size_t length = std::min<size_t>(header[2], size);
+				std::span<const uint8_t> binChunk;
+				std::string_view jsonChunk;
+
+				// JSON comes first, an optional BIN chunk second, unknown chunks are skipped
+				for (size_t offset = sizeof(header); offset + 8 <= length;)
+				{
+					uint32_t chunk[2];
+					memcpy(chunk, data + offset, sizeof(chunk));
+					offset += sizeof(chunk);
+					if (chunk[0] > length - offset)
+						Fail(file, "truncated chunk");
+
+					if (chunk[1] == ChunkJson && jsonChunk.empty())
+						jsonChunk = std::string_view(reinterpret_cast<const char*>(data + offset), chunk[0]);
+					else if (chunk[1] == ChunkBin && binChunk.empty())
+						binChunk = std::span<const uint8_t>(data + offset, chunk[0]);
+
+					offset += (static_cast<size_t>(chunk[0]) + 3) & ~size_t(3);
+				}
+
+				if (jsonChunk.empty())
+					Fail(file, "no JSON chunk");
+				json = JsonValue::Parse(jsonChunk);
+
+				for (size_t i = 0; i < json["buffers"].Size(); i++)
+				{
+					const JsonValue& buffer = json["buffers"][i];
+					size_t byteLength = static_cast<size_t>(buffer["byteLength"].AsNumber());
+
+					std::span<const uint8_t> bytes;
+					if (!buffer.Has("uri"))
+					{
+						// only the first buffer may refer to the BIN chunk
+						if (i != 0)
+							Fail(file, "buffer without uri");
+						bytes = binChunk;
+					}
+					else
+					{
+						const std::string& uri = buffer["uri"].AsString();
+						if (uri.rfind("data:", 0) == 0)
+							Fail(file, "embedded data URIs are not supported");
+
+						auto& external = m_External.emplace_back(std::make_unique<MappedFile>());
+						std::filesystem::path path = file.parent_path() / DecodeUri(file, uri);
+						if (!external->Open(path))
+							Fail(file, "cannot open buffer " + path.string());
+						bytes = std::span<const uint8_t>(external->Data(), external->Size());
+					}
+
+					if (bytes.size() < byteLength)
+						Fail(file, "buffer " + std::to_string(i) + " is shorter than its byteLength");
+					m_Buffers.push_back(bytes.first(byteLength));
+				}
+			}
+
+			Accessor GetAccessor(const JsonValue& index) const
+			{
+				if (!index.IsNumber() || static_cast<size_t>(index.AsNumber()) >= json["accessors"].Size())
+					Fail(m_Path, "invalid accessor index");
+
+				const JsonValue& accessor = json["accessors"][static_cast<size_t>(index.AsNumber())];
+				if (accessor.Has("sparse"))
+					Fail(m_Path, "sparse accessors are not supported");
+
+				Accessor result;
+				result.count = static_cast<size_t>(accessor["count"].AsNumber());
+				result.componentType = static_cast<uint32_t>(accessor["componentType"].AsNumber());
+				result.components = ComponentCount(accessor["type"].AsString());
+				result.normalized = accessor["normalized"].AsBool();
+
+				const size_t elementSize = ComponentSize(result.componentType) * result.components;
+				if (elementSize == 0)
+					Fail(m_Path, "unknown accessor type");
+
+				if (!accessor.Has("bufferView"))
+					return result;
+
+				size_t viewIndex = static_cast<size_t>(accessor["bufferView"].AsNumber());
+				const JsonValue& view = json["bufferViews"][viewIndex];
+				size_t bufferIndex = static_cast<size_t>(view["buffer"].AsNumber());
+				if (view.IsNull() || bufferIndex >= m_Buffers.size())
+					Fail(m_Path, "invalid buffer view");
+
+				size_t viewOffset = static_cast<size_t>(view["byteOffset"].AsNumber());
+				size_t viewLength = static_cast<size_t>(view["byteLength"].AsNumber());
+				size_t accessorOffset = static_cast<size_t>(accessor["byteOffset"].AsNumber());
+				result.stride = view.Has("byteStride") ? static_cast<size_t>(view["byteStride"].AsNumber()) : elementSize;
+
+				const std::span<const uint8_t>& buffer = m_Buffers[bufferIndex];
+				if (viewOffset > buffer.size() || viewLength > buffer.size() - viewOffset)
+					Fail(m_Path, "buffer view out of range");
+				if (result.count > 0 && accessorOffset + (result.count - 1) * result.stride + elementSize > viewLength)
+					Fail(m_Path, "accessor out of range");
+
+				result.data = buffer.data() + viewOffset + accessorOffset;
+				return result;
+			}
+
+			JsonValue json;
+
+		private:
+			std::filesystem::path m_Path;
+			MappedFile m_File;
+			std::vector<std::unique_ptr<MappedFile>> m_External;
+			std::vector<std::span<const uint8_t>> m_Buffers;
+		};
+
+		glm::vec3 ReadVec3(const JsonValue& value, glm::vec3 fallback)
+		{
+			if (value.Size() < 3)
+				return fallback;
+			return { value[0].AsNumber(), value[1].AsNumber(), value[2].AsNumber() };
+		}
+
+		// Factors only: the path tracer has no textures yet
+		SubmeshMaterial MaterialFromGltf(const JsonValue& material)
+		{
+			const JsonValue& pbr = material["pbrMetallicRoughness"];
+			const JsonValue& extensions = material["extensions"];
+
+			glm::vec3 baseColor = ReadVec3(pbr["baseColorFactor"], glm::vec3(1.f));
+			float metallic = static_cast<float>(pbr["metallicFactor"].AsNumber(1.0));
+			float roughness = static_cast<float>(pbr["roughnessFactor"].AsNumber(1.0));
+			float emissiveStrength = static_cast<float>(extensions["KHR_materials_emissive_strength"]["emissiveStrength"].AsNumber(1.0));
+			glm::vec3 emissive = ReadVec3(material["emissiveFactor"], glm::vec3(0.f)) * emissiveStrength;
+			float transmission = static_cast<float>(extensions["KHR_materials_transmission"]["transmissionFactor"].AsNumber(0.0));
+			float ior = static_cast<float>(extensions["KHR_materials_ior"]["ior"].AsNumber(1.5));
+
+			if (emissive != glm::vec3(0.f))
+				return { emissive, DIFFUSE_LIGHT, 1.f };
+			if (transmission > 0.5f)
+				return { glm::vec3(1.f), DIELECTRIC, ior };
+			if (metallic > 0.5f)
+				return { baseColor, METAL, roughness };
+			return { baseColor, LAMBERTIAN, 0.f };
+		}
+
+		// glTF wants flat shading when normals are missing, smooth area weighted normals are close enough here
+		void ComputeNormals(std::span<Vertex> vertices, std::span<const uint32_t> indices, uint32_t baseVertex)
+		{
+			for (size_t t = 0; t + 2 < indices.size(); t += 3)
+			{
+				Vertex& v0 = vertices[indices[t] - baseVertex];
+				Vertex& v1 = vertices[indices[t + 1] - baseVertex];
+				Vertex& v2 = vertices[indices[t + 2] - baseVertex];
+				glm::vec3 normal = glm::cross(v1.pos - v0.pos, v2.pos - v0.pos);
+				v0.normal += normal;
+				v1.normal += normal;
+				v2.normal += normal;
+			}
+
+			for (Vertex& vertex : vertices)
+			{
+				float length = glm::length(vertex.normal);
+				vertex.normal = length > 0.f ? vertex.normal / length : glm::vec3(0.f, 1.f, 0.f);
+			}
+		}
+
+		void LoadMesh(const GltfFile& gltf, const JsonValue& mesh, const std::vector<SubmeshMaterial>& materials, Model& model)
+		{
+			std::vector<Vertex> vertices;
+			std::vector<uint32_t> indices;
+			std::vector<Submesh> submeshes;
+
+			for (const JsonValue& primitive : mesh["primitives"].Elements())
+			{
+				// points and lines have nothing to trace against, strips and fans are rare enough to skip
+				const JsonValue& attributes = primitive["attributes"];
+				if (primitive["mode"].AsNumber(ModeTriangles) != ModeTriangles || !attributes.Has("POSITION"))
+					continue;
+
+				Accessor positions = gltf.GetAccessor(attributes["POSITION"]);
+				Accessor normals = attributes.Has("NORMAL") ? gltf.GetAccessor(attributes["NORMAL"]) : Accessor{};
+				Accessor texCoords = attributes.Has("TEXCOORD_0") ? gltf.GetAccessor(attributes["TEXCOORD_0"]) : Accessor{};
+				Accessor colors = attributes.Has("COLOR_0") ? gltf.GetAccessor(attributes["COLOR_0"]) : Accessor{};
+
+				const uint32_t baseVertex = static_cast<uint32_t>(vertices.size());
+				vertices.resize(baseVertex + positions.count);
+				std::span<Vertex> primitiveVertices(vertices.data() + baseVertex, positions.count);
+				for (size_t i = 0; i < positions.count; i++)
+				{
+					Vertex& vertex = primitiveVertices[i];
+					vertex.pos = positions.Read<3>(i);
+					vertex.normal = normals.count == positions.count ? normals.Read<3>(i) : glm::vec3(0.f);
+					vertex.texCoord = texCoords.count == positions.count ? texCoords.Read<2>(i) : glm::vec2(0.f);
+					vertex.color = colors.count == positions.count ? colors.Read<3>(i, glm::vec3(1.f)) : glm::vec3(1.f);
+				}
+
+				const uint32_t firstIndex = static_cast<uint32_t>(indices.size());
+				if (primitive.Has("indices"))
+				{
+					Accessor primitiveIndices = gltf.GetAccessor(primitive["indices"]);
+					size_t count = primitiveIndices.count / 3 * 3;
+					indices.resize(firstIndex + count);
+
+					// 32 bit indices are a plain copy, narrower ones widen on the way and an accessor without a buffer view reads as zeros
+					if (primitiveIndices.data && primitiveIndices.componentType == UnsignedInt && primitiveIndices.stride == sizeof(uint32_t))
+						memcpy(indices.data() + firstIndex, primitiveIndices.data, count * sizeof(uint32_t));
+					else
+					{
+						for (size_t i = 0; i < count; i++)
+							indices[firstIndex + i] = primitiveIndices.ReadIndex(i);
+					}
+
+					for (size_t i = firstIndex; i < indices.size(); i++)
+					{
+						if (indices[i] >= positions.count)
+							throw std::runtime_error("glTF: index out of range in mesh " + mesh["name"].AsString());
+						indices[i] += baseVertex;
+					}
+				}
+				else
+				{
+					size_t count = positions.count / 3 * 3;
+					indices.resize(firstIndex + count);
+					for (size_t i = 0; i < count; i++)
+						indices[firstIndex + i] = baseVertex + static_cast<uint32_t>(i);
+				}
+
+				if (normals.count != positions.count)
+					ComputeNormals(primitiveVertices, std::span<const uint32_t>(indices).subspan(firstIndex), baseVertex);
+
+				int32_t material = primitive.Has("material") ? static_cast<int32_t>(primitive["material"].AsNumber()) : -1;
+				if (material >= static_cast<int32_t>(materials.size()))
+					material = -1;
+				submeshes.push_back({ firstIndex, static_cast<uint32_t>(indices.size()) - firstIndex, material });
+			}
+
+			model.LoadModel(std::move(vertices), std::move(indices), std::move(submeshes), materials);
+		}
+
+		glm::mat4 LocalTransform(const JsonValue& node)
+		{
+			if (node["matrix"].Size() == 16)
+			{
+				float m[16];
+				for (size_t i = 0; i < 16; i++)
+					m[i] = static_cast<float>(node["matrix"][i].AsNumber());
+				return glm::make_mat4(m); // column major like glTF
+			}
+
+			glm::vec3 translation = ReadVec3(node["translation"], glm::vec3(0.f));
+			glm::vec3 scale = ReadVec3(node["scale"], glm::vec3(1.f));
+			const JsonValue& r = node["rotation"];
+			glm::quat rotation = r.Size() == 4
+				? glm::quat(static_cast<float>(r[3].AsNumber()), static_cast<float>(r[0].AsNumber()), static_cast<float>(r[1].AsNumber()), static_cast<float>(r[2].AsNumber()))
+				: glm::quat(1.f, 0.f, 0.f, 0.f);
+
+			return glm::translate(glm::mat4(1.f), translation) * glm::mat4_cast(rotation) * glm::scale(glm::mat4(1.f), scale);
+		}
+
+		void VisitNode(const JsonValue& nodes, size_t index, const glm::mat4& parent, const std::vector<Model*>& models,
+			std::vector<bool>& visited, std::vector<GltfNode>& out)
+		{
+			// a node may only have one parent, guard against files that break that
+			if (index >= nodes.Size() || visited[index])
+				return;
+			visited[index] = true;
+
+			const JsonValue& node = nodes[index];
+			glm::mat4 transform = parent * LocalTransform(node);
+
+			if (node.Has("mesh"))
+			{
+				size_t mesh = static_cast<size_t>(node["mesh"].AsNumber());
+				if (mesh < models.size())
+				{
+					std::string name = node.Has("name") ? node["name"].AsString() : "node " + std::to_string(index);
+					out.push_back({ std::move(name), models[mesh], transform });
+				}
+			}
+
+			for (const JsonValue& child : node["children"].Elements())
+				VisitNode(nodes, static_cast<size_t>(child.AsNumber()), transform, models, visited, out);
+		}
+	}
+
+	GltfScene GltfLoader::Load(const std::filesystem::path& file, ThreadPool* pool)
+	{
+		GltfFile gltf(file);
+		const JsonValue& json = gltf.json;
+
+		std::vector<SubmeshMaterial> materials;
+		for (const JsonValue& material : json["materials"].Elements())
+			materials.push_back(MaterialFromGltf(material));
+
+		GltfScene scene;
+		const JsonValue& meshes = json["meshes"];
+		for (size_t i = 0; i < meshes.Size(); i++)
+			scene.models.push_back(new Model());
+
+		auto loadMesh = [&](size_t i) { LoadMesh(gltf, meshes[i], materials, *scene.models[i]); };
+		try
+		{
+			if (pool)
+				pool->ParallelFor(meshes.Size(), loadMesh);
+			else
+				for (size_t i = 0; i < meshes.Size(); i++)
+					loadMesh(i);
+		}
+		catch (...)
+		{
+			for (Model* model : scene.models)
+				delete model;
+			throw;
+		}
+
+		// the default scene, or every root node when the file has no scenes
+		const JsonValue& nodes = json["nodes"];
+		std::vector<size_t> roots;
+		if (json["scenes"].Size() > 0)
+		{
+			const JsonValue& defaultScene = json["scenes"][static_cast<size_t>(json["scene"].AsNumber(0.0))];
+			for (const JsonValue& root : defaultScene["nodes"].Elements())
+				roots.push_back(static_cast<size_t>(root.AsNumber()));
+		}
+		else
+		{
+			std::vector<bool> isChild(nodes.Size(), false);
+			for (const JsonValue& node : nodes.Elements())
+				for (const JsonValue& child : node["children"].Elements())
+					if (static_cast<size_t>(child.AsNumber()) < isChild.size())
+						isChild[static_cast<size_t>(child.AsNumber())] = true;
+			for (size_t i = 0; i < nodes.Size(); i++)
+				if (!isChild[i])
+					roots.push_back(i);
+		}
+
+		std::vector<bool> visited(nodes.Size(), false);
+		for (size_t root : roots)
+			VisitNode(nodes, root, glm::mat4(1.f), scene.models, visited, scene.nodes);
+
+		return scene;
+	}
+}
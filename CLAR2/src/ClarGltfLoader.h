@@ -0,0 +1,33 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "ClarModel.h"
+#include "utils/ThreadPool.h"
+
+namespace CLAR {
+
+	// Mesh placement from the glTF node hierarchy
+	struct GltfNode {
+		std::string name;
+		Model* model;
+		glm::mat4 transform; // node to world, parents applied
+	};
+
+	struct GltfScene {
+		std::vector<Model*> models; // one per glTF mesh, owned by the caller like the models of ModelLoader
+		std::vector<GltfNode> nodes;
+	};
+
+	// Binary glTF 2.0 (.glb) loader. The file is memory mapped and accessors are copied straight out of their
+	// buffer views, which already hold indexed geometry, so there is no text to parse and nothing to weld.
+	// Every glTF mesh becomes one Model with a submesh per triangle primitive, and every node of the default
+	// scene that has a mesh becomes a GltfNode. Buffers may also live in external files next to the .glb.
+	class GltfLoader {
+	public:
+		// Meshes are built on pool when one is given. Throws std::runtime_error on files it cannot read.
+		static GltfScene Load(const std::filesystem::path& file, ThreadPool* pool = nullptr);
+	};
+}
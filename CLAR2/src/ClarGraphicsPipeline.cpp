@@ -28,8 +28,8 @@ namespace CLAR {
 
         VkPipelineVertexInputStateCreateInfo vertexInputInfo{
             .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-            .vertexBindingDescriptionCount = builder._vertexAttributeDescriptions.size() != 0 ? 1U : 0U,
-            .pVertexBindingDescriptions = &builder._vertexBindingDescription,
+            .vertexBindingDescriptionCount = builder._vertexAttributeDescriptions.size() != 0 ? static_cast<uint32_t>(builder._vertexBindingDescriptions.size()) : 0U,
+            .pVertexBindingDescriptions = builder._vertexBindingDescriptions.data(),
             .vertexAttributeDescriptionCount = static_cast<uint32_t>(builder._vertexAttributeDescriptions.size()),
             .pVertexAttributeDescriptions = builder._vertexAttributeDescriptions.data()
         };
@@ -0,0 +1,207 @@
+#include "ClarMeshCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace CLAR {
+
+	static bool SourceStamp(const std::filesystem::path& source, uint64_t& size, int64_t& writeTime)
+	{
+		std::error_code ec;
+		size = std::filesystem::file_size(source, ec);
+		if (ec)
+			return false;
+
+		auto time = std::filesystem::last_write_time(source, ec);
+		if (ec)
+			return false;
+
+		writeTime = time.time_since_epoch().count();
+		return true;
+	}
+
+	static uint64_t AlignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	std::filesystem::path MeshCache::CachePath(const std::filesystem::path& source)
+	{
+		return std::filesystem::path(source).replace_extension(".clarmesh");
+	}
+
+	bool MeshCache::Load(const std::filesystem::path& source, Model& model, uint32_t flags)
+	{
+		uint64_t sourceSize;
+		int64_t sourceWriteTime;
+		if (!SourceStamp(source, sourceSize, sourceWriteTime))
+			return false;
+
+		auto file = std::make_unique<MappedFile>();
+		if (!file->Open(CachePath(source)) || file->Size() < sizeof(MeshCacheHeader))
+			return false;
+
+		MeshCacheHeader header;
+		memcpy(&header, file->Data(), sizeof(MeshCacheHeader));
+
+		if (header.magic != MeshCacheHeader::Magic || header.version != MeshCacheHeader::Version ||
+			header.vertexStride != sizeof(Vertex) || header.flags != flags ||
+			header.sourceSize != sourceSize || header.sourceWriteTime != sourceWriteTime)
+			return false;
+
+		uint64_t vertexEnd = header.vertexOffset + uint64_t(header.vertexCount) * sizeof(Vertex);
+		uint64_t indexEnd = header.indexOffset + uint64_t(header.indexCount) * sizeof(uint32_t);
+		uint64_t lodEnd = header.lodOffset + uint64_t(header.lodCount) * sizeof(MeshCacheLod);
+		uint64_t submeshEnd = header.submeshOffset + uint64_t(header.submeshCount) * (1 + header.lodCount) * sizeof(Submesh);
+		uint64_t materialEnd = header.materialOffset + uint64_t(header.materialCount) * sizeof(SubmeshMaterial);
+		if (vertexEnd > file->Size() || indexEnd > file->Size() || lodEnd > file->Size() ||
+			submeshEnd > file->Size() || materialEnd > file->Size() || header.submeshCount == 0 ||
+			header.vertexOffset % alignof(Vertex) != 0 || header.indexOffset % alignof(uint32_t) != 0 ||
+			header.lodOffset % alignof(MeshCacheLod) != 0)
+			return false;
+
+		// submeshes and materials are small, they are copied out rather than viewed
+		auto readSubmeshes = [&](uint32_t level, uint32_t indexCount, std::vector<Submesh>& submeshes) {
+			submeshes.resize(header.submeshCount);
+			memcpy(submeshes.data(), file->Data() + header.submeshOffset + uint64_t(level) * header.submeshCount * sizeof(Submesh),
+				header.submeshCount * sizeof(Submesh));
+			return std::all_of(submeshes.begin(), submeshes.end(), [&](const Submesh& submesh) {
+				return uint64_t(submesh.firstIndex) + submesh.indexCount <= indexCount && submesh.material >= -1 && submesh.material < static_cast<int64_t>(header.materialCount);
+			});
+		};
+
+		std::vector<Submesh> submeshes;
+		if (!readSubmeshes(0, header.indexCount, submeshes))
+			return false;
+
+		std::vector<SubmeshMaterial> materials(header.materialCount);
+		if (!materials.empty())
+			memcpy(materials.data(), file->Data() + header.materialOffset, materials.size() * sizeof(SubmeshMaterial));
+
+		std::vector<ModelLod> lods(header.lodCount);
+		for (uint32_t i = 0; i < header.lodCount; i++)
+		{
+			MeshCacheLod lod;
+			memcpy(&lod, file->Data() + header.lodOffset + i * sizeof(MeshCacheLod), sizeof(MeshCacheLod));
+			if (lod.indexOffset + uint64_t(lod.indexCount) * sizeof(uint32_t) > file->Size() || lod.indexOffset % alignof(uint32_t) != 0)
+				return false;
+
+			lods[i].m_MappedIndices = file->View<uint32_t>(lod.indexOffset, lod.indexCount);
+			lods[i].error = lod.error;
+			if (!readSubmeshes(i + 1, lod.indexCount, lods[i].submeshes))
+				return false;
+		}
+
+		model.mesh.clear();
+		model.indices.clear();
+		model.boundsMin = header.boundsMin;
+		model.boundsMax = header.boundsMax;
+		model.m_MappedVertices = file->View<Vertex>(header.vertexOffset, header.vertexCount);
+		model.m_MappedIndices = file->View<uint32_t>(header.indexOffset, header.indexCount);
+		model.lods = std::move(lods);
+		model.submeshes = std::move(submeshes);
+		model.materials = std::move(materials);
+		model.m_MappedFile = std::move(file);
+
+		return true;
+	}
+
+	void MeshCache::Store(const std::filesystem::path& source, const Model& model, uint32_t flags)
+	{
+		MeshCacheHeader header{
+			.magic = MeshCacheHeader::Magic,
+			.version = MeshCacheHeader::Version,
+			.vertexStride = sizeof(Vertex),
+			.vertexCount = model.VertexCount(),
+			.indexCount = model.IndexCount(),
+			.flags = flags,
+			.boundsMin = model.boundsMin,
+			.boundsMax = model.boundsMax,
+			.lodCount = static_cast<uint32_t>(model.lods.size()),
+			.submeshCount = static_cast<uint32_t>(model.submeshes.size()),
+			.materialCount = static_cast<uint32_t>(model.materials.size()),
+		};
+
+		if (!SourceStamp(source, header.sourceSize, header.sourceWriteTime))
+			return;
+
+		header.vertexOffset = AlignUp(sizeof(MeshCacheHeader), 16);
+		header.indexOffset = AlignUp(header.vertexOffset + uint64_t(header.vertexCount) * sizeof(Vertex), 16);
+		header.lodOffset = AlignUp(header.indexOffset + uint64_t(header.indexCount) * sizeof(uint32_t), 16);
+
+		std::vector<MeshCacheLod> lodTable(model.lods.size());
+		uint64_t lodIndexOffset = header.lodOffset + lodTable.size() * sizeof(MeshCacheLod);
+		for (size_t i = 0; i < lodTable.size(); i++)
+		{
+			lodIndexOffset = AlignUp(lodIndexOffset, 16);
+			lodTable[i] = { lodIndexOffset, static_cast<uint32_t>(model.lods[i].Indices().size()), model.lods[i].error };
+			lodIndexOffset += model.lods[i].Indices().size_bytes();
+		}
+
+		// every level stores as many submeshes as the model, BuildLods keeps them aligned
+		std::vector<Submesh> submeshTable(model.submeshes);
+		for (const auto& lod : model.lods)
+		{
+			if (lod.submeshes.size() != model.submeshes.size())
+				return;
+			submeshTable.insert(submeshTable.end(), lod.submeshes.begin(), lod.submeshes.end());
+		}
+
+		header.submeshOffset = AlignUp(lodIndexOffset, 16);
+		header.materialOffset = AlignUp(header.submeshOffset + submeshTable.size() * sizeof(Submesh), 16);
+
+		// Written to a temporary first so a crash or a concurrent reader never sees half a cache
+		std::filesystem::path cachePath = CachePath(source);
+		std::filesystem::path tmpPath = cachePath;
+		tmpPath += ".tmp";
+
+		{
+			std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+			if (!out)
+			{
+				std::cerr << "[MeshCache]: cannot write " << tmpPath << '\n';
+				return;
+			}
+
+			const char padding[16]{};
+			auto vertices = model.Vertices();
+			auto indices = model.Indices();
+
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(padding, header.vertexOffset - sizeof(header));
+			out.write(reinterpret_cast<const char*>(vertices.data()), vertices.size_bytes());
+			out.write(padding, header.indexOffset - header.vertexOffset - vertices.size_bytes());
+			out.write(reinterpret_cast<const char*>(indices.data()), indices.size_bytes());
+			out.write(padding, header.lodOffset - header.indexOffset - indices.size_bytes());
+			out.write(reinterpret_cast<const char*>(lodTable.data()), lodTable.size() * sizeof(MeshCacheLod));
+
+			uint64_t written = header.lodOffset + lodTable.size() * sizeof(MeshCacheLod);
+			for (size_t i = 0; i < lodTable.size(); i++)
+			{
+				auto lodIndices = model.lods[i].Indices();
+				out.write(padding, lodTable[i].indexOffset - written);
+				out.write(reinterpret_cast<const char*>(lodIndices.data()), lodIndices.size_bytes());
+				written = lodTable[i].indexOffset + lodIndices.size_bytes();
+			}
+
+			out.write(padding, header.submeshOffset - written);
+			out.write(reinterpret_cast<const char*>(submeshTable.data()), submeshTable.size() * sizeof(Submesh));
+			out.write(padding, header.materialOffset - header.submeshOffset - submeshTable.size() * sizeof(Submesh));
+			out.write(reinterpret_cast<const char*>(model.materials.data()), model.materials.size() * sizeof(SubmeshMaterial));
+
+			if (!out)
+			{
+				out.close();
+				std::filesystem::remove(tmpPath);
+				return;
+			}
+		}
+
+		std::error_code ec;
+		std::filesystem::rename(tmpPath, cachePath, ec);
+		if (ec)
+			std::filesystem::remove(tmpPath, ec);
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <filesystem>
+
+#include "ClarModel.h"
+
+namespace CLAR {
+
+	// Binary cache of an already deduplicated mesh, stored next to its source as <name>.clarmesh.
+	// Layout: MeshCacheHeader, Vertex[vertexCount], uint32_t[indexCount], MeshCacheLod[lodCount], the LOD index lists,
+	// Submesh[submeshCount * (1 + lodCount)] with the model's ranges first and then those of every LOD, SubmeshMaterial[materialCount].
+	struct MeshCacheHeader {
+		static constexpr uint32_t Magic = 0x4D524C43; // "CLRM"
+		static constexpr uint32_t Version = 3;
+
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceSize;       // size and write time of the source file the cache was built from
+		int64_t sourceWriteTime;
+		uint32_t vertexStride;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t flags;            // MeshCacheFlags the mesh was processed with
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		uint64_t vertexOffset;
+		uint64_t indexOffset;
+		uint64_t lodOffset;
+		uint32_t lodCount;
+		uint32_t submeshCount;     // per level, every LOD keeps the submeshes of the model
+		uint64_t submeshOffset;
+		uint64_t materialOffset;
+		uint32_t materialCount;
+		uint32_t reserved;
+	};
+
+	struct MeshCacheLod {
+		uint64_t indexOffset;
+		uint32_t indexCount;
+		float error;
+	};
+
+	enum MeshCacheFlags : uint32_t {
+		MeshCacheOptimized = 1 << 0,  // indices and vertices went through MeshOptimizer
+		MeshCacheLods = 1 << 1,       // the LOD chain of Model::BuildLods is stored after the indices
+	};
+
+	class MeshCache {
+	public:
+		static std::filesystem::path CachePath(const std::filesystem::path& source);
+
+		// Maps the cache of source into the model, fails if it is missing, stale, malformed or built with other flags
+		static bool Load(const std::filesystem::path& source, Model& model, uint32_t flags);
+		static void Store(const std::filesystem::path& source, const Model& model, uint32_t flags);
+	};
+}
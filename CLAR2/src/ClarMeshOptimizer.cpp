@@ -0,0 +1,149 @@
+#include "ClarMeshOptimizer.h"
+
+namespace CLAR::MeshOptimizer {
+
+	float ComputeACMR(std::span<const uint32_t> indices, size_t vertexCount, uint32_t cacheSize)
+	{
+		if (indices.size() < 3)
+			return 0.f;
+
+		// a vertex is in the FIFO as long as fewer than cacheSize misses happened since it entered
+		std::vector<size_t> enteredAt(vertexCount, SIZE_MAX);
+		size_t misses = 0;
+
+		for (uint32_t index : indices)
+		{
+			if (enteredAt[index] == SIZE_MAX || misses - enteredAt[index] >= cacheSize)
+			{
+				enteredAt[index] = misses;
+				misses++;
+			}
+		}
+
+		return static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+	}
+
+	void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize)
+	{
+		const size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0 || vertexCount == 0)
+			return;
+
+		// vertex -> triangles adjacency, flattened
+		std::vector<uint32_t> liveTriangles(vertexCount, 0);
+		for (uint32_t index : indices)
+			liveTriangles[index]++;
+
+		std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; v++)
+			adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+
+		std::vector<uint32_t> adjacency(indices.size());
+		{
+			std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (size_t i = 0; i < indices.size(); i++)
+				adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+
+		std::vector<uint32_t> cacheTime(vertexCount, 0);
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<uint32_t> deadEnd;
+		std::vector<uint32_t> candidates;
+		std::vector<uint32_t> output;
+		output.reserve(indices.size());
+
+		uint32_t time = cacheSize + 1;
+		size_t cursor = 1;
+		int64_t fanning = 0;
+
+		while (fanning >= 0)
+		{
+			const uint32_t vertex = static_cast<uint32_t>(fanning);
+			candidates.clear();
+
+			// emit every remaining triangle around the fanning vertex
+			for (uint32_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++)
+			{
+				uint32_t triangle = adjacency[a];
+				if (emitted[triangle])
+					continue;
+
+				for (uint32_t k = 0; k < 3; k++)
+				{
+					uint32_t v = indices[triangle * 3 + k];
+					output.push_back(v);
+					deadEnd.push_back(v);
+					candidates.push_back(v);
+					liveTriangles[v]--;
+
+					if (time - cacheTime[v] > cacheSize)
+						cacheTime[v] = time++;
+				}
+				emitted[triangle] = true;
+			}
+
+			// next fanning vertex: the candidate that stays in cache the longest while still having work left
+			fanning = -1;
+			int64_t bestPriority = -1;
+			for (uint32_t v : candidates)
+			{
+				if (liveTriangles[v] == 0)
+					continue;
+
+				int64_t priority = 0;
+				if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+					priority = time - cacheTime[v];
+
+				if (priority > bestPriority)
+				{
+					bestPriority = priority;
+					fanning = v;
+				}
+			}
+
+			if (fanning >= 0)
+				continue;
+
+			// dead end: back up through recently used vertices, then scan for anything left
+			while (!deadEnd.empty())
+			{
+				uint32_t v = deadEnd.back();
+				deadEnd.pop_back();
+				if (liveTriangles[v] > 0)
+				{
+					fanning = v;
+					break;
+				}
+			}
+
+			while (fanning < 0 && cursor < vertexCount)
+			{
+				if (liveTriangles[cursor] > 0)
+					fanning = static_cast<int64_t>(cursor);
+				cursor++;
+			}
+		}
+
+		indices.swap(output);
+	}
+
+	void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+	{
+		constexpr uint32_t Unused = UINT32_MAX;
+		std::vector<uint32_t> remap(vertices.size(), Unused);
+		std::vector<Vertex> reordered;
+		reordered.reserve(vertices.size());
+
+		for (uint32_t& index : indices)
+		{
+			if (remap[index] == Unused)
+			{
+				remap[index] = static_cast<uint32_t>(reordered.size());
+				reordered.push_back(vertices[index]);
+			}
+			index = remap[index];
+		}
+
+		vertices.swap(reordered);
+	}
+}
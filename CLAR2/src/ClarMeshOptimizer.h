@@ -0,0 +1,28 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "clar_vertex.h"
+
+namespace CLAR {
+
+	// Post-load reordering of indexed triangle lists for better GPU locality.
+	// Both passes keep the mesh identical, only the order of triangles and vertices changes.
+	namespace MeshOptimizer {
+
+		// Post-transform cache size the reordering targets; 16 is a safe guess across current GPUs
+		inline constexpr uint32_t DefaultCacheSize = 16;
+
+		// Average cache miss ratio: vertices transformed per triangle with a FIFO cache of cacheSize entries.
+		// 3 is the worst case, around 0.5 the best a closed mesh can get.
+		float ComputeACMR(std::span<const uint32_t> indices, size_t vertexCount, uint32_t cacheSize = DefaultCacheSize);
+
+		// Reorders triangles with Tipsify (Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw")
+		void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = DefaultCacheSize);
+
+		// Sorts vertices by first use in the index buffer and drops unreferenced ones, so consecutive
+		// triangles read neighbouring memory in the vertex shader and in the hit shader fetches
+		void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+	}
+}
@@ -0,0 +1,354 @@
+#include "ClarMeshSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace CLAR::MeshSimplifier {
+
+	namespace {
+		// Sum of squared distances to a set of planes, p^T A p + 2 b^T p + c
+		struct Quadric {
+			double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+			double b0 = 0, b1 = 0, b2 = 0;
+			double c = 0;
+			double weight = 0; // total triangle area, turns the sum into a mean
+
+			void AddPlane(const glm::dvec3& n, double d, double w)
+			{
+				a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z;
+				a11 += w * n.y * n.y; a12 += w * n.y * n.z; a22 += w * n.z * n.z;
+				b0 += w * n.x * d; b1 += w * n.y * d; b2 += w * n.z * d;
+				c += w * d * d;
+			}
+
+			Quadric& operator+=(const Quadric& other)
+			{
+				a00 += other.a00; a01 += other.a01; a02 += other.a02;
+				a11 += other.a11; a12 += other.a12; a22 += other.a22;
+				b0 += other.b0; b1 += other.b1; b2 += other.b2;
+				c += other.c;
+				weight += other.weight;
+				return *this;
+			}
+
+			// mean squared distance of p to the planes
+			double Error(const glm::dvec3& p) const
+			{
+				double e = a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z
+					+ 2.0 * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z)
+					+ 2.0 * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+				return weight > 0.0 ? std::abs(e) / weight : std::abs(e);
+			}
+		};
+
+		struct Collapse {
+			uint32_t from;
+			uint32_t to;
+			double error;
+		};
+
+		// planes through open edges are weighted up so borders keep their outline
+		constexpr double BorderWeight = 10.0;
+
+		uint64_t EdgeKey(uint32_t a, uint32_t b)
+		{
+			return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+		}
+
+		float AttributeDistance(const Vertex& a, const Vertex& b)
+		{
+			glm::vec3 dn = a.normal - b.normal;
+			glm::vec3 dc = a.color - b.color;
+			glm::vec2 dt = a.texCoord - b.texCoord;
+			return glm::dot(dn, dn) + glm::dot(dc, dc) + glm::dot(dt, dt);
+		}
+	}
+
+	std::vector<uint32_t> Simplify(std::span<const Vertex> vertices, std::span<const uint32_t> indices,
+		size_t targetIndexCount, float targetError, float* resultError)
+	{
+		if (resultError)
+			*resultError = 0.f;
+
+		std::vector<uint32_t> corners(indices.begin(), indices.end());
+		if (corners.size() <= targetIndexCount || vertices.empty())
+			return corners;
+
+		// Collapses work on positions: vertices split by a normal or uv seam move together
+		const uint32_t vertexCount = static_cast<uint32_t>(vertices.size());
+		std::vector<uint32_t> order(vertexCount);
+		std::iota(order.begin(), order.end(), 0u);
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			const glm::vec3& pa = vertices[a].pos;
+			const glm::vec3& pb = vertices[b].pos;
+			return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+		});
+
+		std::vector<uint32_t> positionOf(vertexCount);
+		std::vector<uint32_t> wedgeOffsets; // vertices of position p are order[wedgeOffsets[p], wedgeOffsets[p + 1])
+		std::vector<glm::dvec3> positions;
+		for (uint32_t i = 0; i < vertexCount; i++)
+		{
+			if (i == 0 || vertices[order[i]].pos != vertices[order[i - 1]].pos)
+			{
+				wedgeOffsets.push_back(i);
+				positions.emplace_back(vertices[order[i]].pos);
+			}
+			positionOf[order[i]] = static_cast<uint32_t>(positions.size() - 1);
+		}
+		wedgeOffsets.push_back(vertexCount);
+
+		const uint32_t positionCount = static_cast<uint32_t>(positions.size());
+
+		glm::dvec3 boundsMin = positions[0], boundsMax = positions[0];
+		for (const auto& p : positions)
+		{
+			boundsMin = glm::min(boundsMin, p);
+			boundsMax = glm::max(boundsMax, p);
+		}
+		const double extent = std::max({ boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y, boundsMax.z - boundsMin.z });
+		if (extent <= 0.0)
+			return corners;
+
+		const double errorLimit = (targetError * extent) * (targetError * extent);
+
+		// Plane quadrics of the source triangles, plus perpendicular planes along open edges
+		std::vector<Quadric> quadrics(positionCount);
+		std::vector<std::pair<uint64_t, uint32_t>> triangleEdges;
+		triangleEdges.reserve(corners.size());
+
+		for (size_t t = 0; t < corners.size(); t += 3)
+		{
+			uint32_t p[3] = { positionOf[corners[t]], positionOf[corners[t + 1]], positionOf[corners[t + 2]] };
+			glm::dvec3 normal = glm::cross(positions[p[1]] - positions[p[0]], positions[p[2]] - positions[p[0]]);
+			double length = glm::length(normal);
+			if (length == 0.0)
+				continue;
+
+			normal /= length;
+			double d = -glm::dot(normal, positions[p[0]]);
+			double area = 0.5 * length;
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				quadrics[p[k]].AddPlane(normal, d, area);
+				quadrics[p[k]].weight += area;
+				triangleEdges.emplace_back(EdgeKey(p[k], p[(k + 1) % 3]), static_cast<uint32_t>(t));
+			}
+		}
+
+		std::sort(triangleEdges.begin(), triangleEdges.end());
+		for (size_t i = 0; i < triangleEdges.size(); i++)
+		{
+			bool single = (i == 0 || triangleEdges[i - 1].first != triangleEdges[i].first) &&
+				(i + 1 == triangleEdges.size() || triangleEdges[i + 1].first != triangleEdges[i].first);
+			if (!single)
+				continue;
+
+			uint32_t a = static_cast<uint32_t>(triangleEdges[i].first >> 32);
+			uint32_t b = static_cast<uint32_t>(triangleEdges[i].first & 0xFFFFFFFFu);
+			uint32_t t = triangleEdges[i].second;
+			glm::dvec3 faceNormal = glm::cross(positions[positionOf[corners[t + 1]]] - positions[positionOf[corners[t]]],
+				positions[positionOf[corners[t + 2]]] - positions[positionOf[corners[t]]]);
+			glm::dvec3 edge = positions[b] - positions[a];
+			glm::dvec3 normal = glm::cross(edge, faceNormal);
+			double length = glm::length(normal);
+			if (length == 0.0)
+				continue;
+
+			normal /= length;
+			double d = -glm::dot(normal, positions[a]);
+			double weight = BorderWeight * glm::dot(edge, edge);
+			quadrics[a].AddPlane(normal, d, weight);
+			quadrics[b].AddPlane(normal, d, weight);
+		}
+		triangleEdges = {};
+
+		// collapsed positions point at the position they were merged into
+		std::vector<uint32_t> parent(positionCount);
+		std::iota(parent.begin(), parent.end(), 0u);
+		auto find = [&](uint32_t p) {
+			while (parent[p] != p)
+			{
+				parent[p] = parent[parent[p]];
+				p = parent[p];
+			}
+			return p;
+		};
+
+		std::vector<uint32_t> triangles;
+		std::vector<uint64_t> edges;
+		std::vector<uint8_t> border(positionCount), locked(positionCount), touched(positionCount);
+		std::vector<uint32_t> adjacencyOffsets(positionCount + 1), adjacency;
+		std::vector<Collapse> collapses;
+		double maxError = 0.0;
+
+		// Each pass collapses the cheapest edges whose endpoints were not touched yet in that pass
+		while (true)
+		{
+			// resolve collapsed corners and drop the triangles that became degenerate
+			size_t live = 0;
+			triangles.clear();
+			for (size_t t = 0; t < corners.size(); t += 3)
+			{
+				uint32_t r0 = find(positionOf[corners[t]]);
+				uint32_t r1 = find(positionOf[corners[t + 1]]);
+				uint32_t r2 = find(positionOf[corners[t + 2]]);
+				if (r0 == r1 || r1 == r2 || r0 == r2)
+					continue;
+
+				corners[live++] = corners[t];
+				corners[live++] = corners[t + 1];
+				corners[live++] = corners[t + 2];
+				triangles.insert(triangles.end(), { r0, r1, r2 });
+			}
+			corners.resize(live);
+
+			if (corners.size() <= targetIndexCount)
+				break;
+
+			// an edge used once is an open border, more than twice is non-manifold and stays put
+			edges.clear();
+			for (size_t t = 0; t < triangles.size(); t += 3)
+				for (uint32_t k = 0; k < 3; k++)
+					edges.push_back(EdgeKey(triangles[t + k], triangles[t + (k + 1) % 3]));
+			std::sort(edges.begin(), edges.end());
+
+			std::fill(border.begin(), border.end(), 0);
+			std::fill(locked.begin(), locked.end(), 0);
+			for (size_t i = 0, next; i < edges.size(); i = next)
+			{
+				for (next = i + 1; next < edges.size() && edges[next] == edges[i]; next++) {}
+				uint32_t a = static_cast<uint32_t>(edges[i] >> 32), b = static_cast<uint32_t>(edges[i] & 0xFFFFFFFFu);
+				if (next - i == 1)
+					border[a] = border[b] = 1;
+				else if (next - i > 2)
+					locked[a] = locked[b] = 1;
+			}
+
+			collapses.clear();
+			for (size_t i = 0, next; i < edges.size(); i = next)
+			{
+				for (next = i + 1; next < edges.size() && edges[next] == edges[i]; next++) {}
+				uint32_t a = static_cast<uint32_t>(edges[i] >> 32), b = static_cast<uint32_t>(edges[i] & 0xFFFFFFFFu);
+				bool borderEdge = next - i == 1;
+
+				Collapse best{ 0, 0, std::numeric_limits<double>::max() };
+				auto consider = [&](uint32_t from, uint32_t to) {
+					if (locked[from] || (border[from] && !borderEdge))
+						return;
+					double error = quadrics[from].Error(positions[to]);
+					if (error < best.error)
+						best = { from, to, error };
+				};
+				consider(a, b);
+				consider(b, a);
+
+				if (best.error <= errorLimit)
+					collapses.push_back(best);
+			}
+
+			if (collapses.empty())
+				break;
+
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+			// position -> triangles, flattened
+			std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+			for (uint32_t p : triangles)
+				adjacencyOffsets[p + 1]++;
+			for (uint32_t p = 0; p < positionCount; p++)
+				adjacencyOffsets[p + 1] += adjacencyOffsets[p];
+			adjacency.resize(triangles.size());
+			{
+				std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+				for (size_t i = 0; i < triangles.size(); i++)
+					adjacency[fill[triangles[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+
+			// moving from onto to must not turn any remaining triangle around from upside down
+			auto tryCollapse = [&](uint32_t from, uint32_t to, size_t& removed) {
+				removed = 0;
+				for (uint32_t a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1]; a++)
+				{
+					size_t t = size_t(adjacency[a]) * 3;
+					uint32_t r[3] = { find(triangles[t]), find(triangles[t + 1]), find(triangles[t + 2]) };
+					if (r[0] == r[1] || r[1] == r[2] || r[0] == r[2])
+						continue;
+					if (r[0] == to || r[1] == to || r[2] == to)
+					{
+						removed++;
+						continue;
+					}
+
+					glm::dvec3 before = glm::cross(positions[r[1]] - positions[r[0]], positions[r[2]] - positions[r[0]]);
+					for (uint32_t& v : r)
+						if (v == from)
+							v = to;
+					glm::dvec3 after = glm::cross(positions[r[1]] - positions[r[0]], positions[r[2]] - positions[r[0]]);
+					if (glm::dot(before, after) <= 0.0)
+						return false;
+				}
+				return true;
+			};
+
+			std::fill(touched.begin(), touched.end(), 0);
+			size_t triangleCount = corners.size() / 3;
+			size_t applied = 0;
+			for (const Collapse& collapse : collapses)
+			{
+				if (triangleCount * 3 <= targetIndexCount)
+					break;
+				if (touched[collapse.from] || touched[collapse.to])
+					continue;
+
+				size_t removed;
+				if (!tryCollapse(collapse.from, collapse.to, removed))
+					continue;
+
+				parent[collapse.from] = collapse.to;
+				quadrics[collapse.to] += quadrics[collapse.from];
+				touched[collapse.from] = touched[collapse.to] = 1;
+				triangleCount -= std::min(removed, triangleCount);
+				maxError = std::max(maxError, collapse.error);
+				applied++;
+			}
+
+			if (applied == 0)
+				break;
+		}
+
+		// A corner whose position moved takes the vertex of the new position closest to it in attributes
+		std::vector<uint32_t> resolved(vertexCount, UINT32_MAX);
+		for (uint32_t& corner : corners)
+		{
+			if (resolved[corner] == UINT32_MAX)
+			{
+				uint32_t p = positionOf[corner];
+				uint32_t root = find(p);
+				uint32_t best = corner;
+				if (root != p)
+				{
+					float bestDistance = std::numeric_limits<float>::max();
+					for (uint32_t i = wedgeOffsets[root]; i < wedgeOffsets[root + 1]; i++)
+					{
+						float distance = AttributeDistance(vertices[corner], vertices[order[i]]);
+						if (distance < bestDistance)
+						{
+							bestDistance = distance;
+							best = order[i];
+						}
+					}
+				}
+				resolved[corner] = best;
+			}
+			corner = resolved[corner];
+		}
+
+		if (resultError)
+			*resultError = static_cast<float>(std::sqrt(maxError) / extent);
+
+		return corners;
+	}
+}
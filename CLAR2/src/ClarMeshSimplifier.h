@@ -0,0 +1,20 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "clar_vertex.h"
+
+namespace CLAR {
+
+	// Quadric error metric simplification (Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics").
+	// Edges are collapsed onto existing vertices, so every level indexes the same vertex buffer as the source.
+	namespace MeshSimplifier {
+
+		// Collapses edges until the index list is at most targetIndexCount long, or until the next collapse would move
+		// the surface further than targetError. Errors are relative to the largest extent of the mesh bounds.
+		// Vertices sharing a position are collapsed together, open borders only collapse along themselves.
+		std::vector<uint32_t> Simplify(std::span<const Vertex> vertices, std::span<const uint32_t> indices,
+			size_t targetIndexCount, float targetError, float* resultError = nullptr);
+	}
+}
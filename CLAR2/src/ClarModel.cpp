@@ -1,10 +1,193 @@
 #include "ClarModel.h"
+#include "ClarMeshCache.h"
+#include "ClarMeshOptimizer.h"
+#include "ClarMeshSimplifier.h"
+#include "ClarObjParser.h"
+#include "ClarVertexWelder.h"
+
+#include <algorithm>
+#include <iostream>
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
+
+// reorders loaded meshes for the post-transform cache and vertex fetch, see MeshOptimizer
+#define OPTIMIZE_MESHES
+
 namespace CLAR {
     static inline uint32_t nextId = 0;
 
+#ifdef OPTIMIZE_MESHES
+    static constexpr uint32_t CacheFlags = MeshCacheOptimized | MeshCacheLods;
+#else
+    static constexpr uint32_t CacheFlags = MeshCacheLods;
+#endif
+
+    // LOD chain: each level aims for half the triangles of the previous one and stops early once
+    // simplification stalls or the error gets too large to be worth tracing anywhere
+    static constexpr uint32_t MaxLodCount = 4;
+    static constexpr size_t MinLodTriangles = 1024;
+    static constexpr float LodReduction = 0.5f;
+    static constexpr float LodMaxError = 0.05f;
+
+    static constexpr uint32_t UnusedVertex = UINT32_MAX;
+
+    // A range of the index list renumbered onto the vertices it uses, so per submesh passes cost what the submesh costs
+    struct LocalMesh {
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        std::vector<uint32_t> modelVertex; // local vertex -> model vertex
+
+        // remap is scratch sized like modelVertices and filled with UnusedVertex, it is handed back that way
+        LocalMesh(std::span<const Vertex> modelVertices, std::span<const uint32_t> modelIndices, std::vector<uint32_t>& remap)
+        {
+            indices.reserve(modelIndices.size());
+            for (uint32_t index : modelIndices)
+            {
+                if (remap[index] == UnusedVertex)
+                {
+                    remap[index] = static_cast<uint32_t>(vertices.size());
+                    vertices.push_back(modelVertices[index]);
+                    modelVertex.push_back(index);
+                }
+                indices.push_back(remap[index]);
+            }
+
+            for (uint32_t index : modelVertex)
+                remap[index] = UnusedVertex;
+        }
+
+        float Extent() const
+        {
+            if (vertices.empty())
+                return 0.f;
+
+            glm::vec3 boundsMin = vertices[0].pos, boundsMax = vertices[0].pos;
+            for (const auto& vertex : vertices)
+            {
+                boundsMin = glm::min(boundsMin, vertex.pos);
+                boundsMax = glm::max(boundsMax, vertex.pos);
+            }
+            glm::vec3 size = boundsMax - boundsMin;
+            return std::max({ size.x, size.y, size.z });
+        }
+    };
+
+#ifdef OPTIMIZE_MESHES
+    // Tipsify inside every submesh, the ranges themselves stay put
+    static void OptimizeSubmeshes(std::span<const Vertex> vertices, std::span<uint32_t> indices, std::span<const Submesh> submeshes, std::vector<uint32_t>& remap)
+    {
+        for (const Submesh& submesh : submeshes)
+        {
+            std::span<uint32_t> range = indices.subspan(submesh.firstIndex, submesh.indexCount);
+            LocalMesh local(vertices, range, remap);
+            MeshOptimizer::OptimizeVertexCache(local.indices, local.vertices.size());
+            std::transform(local.indices.begin(), local.indices.end(), range.begin(), [&](uint32_t index) { return local.modelVertex[index]; });
+        }
+    }
+#endif
+
+    // The path tracer has no textures yet, so a diffuse color that only comes from a map falls back to grey
+    static SubmeshMaterial MaterialFromMtl(const tinyobj::material_t& mtl)
+    {
+        glm::vec3 diffuse(mtl.diffuse[0], mtl.diffuse[1], mtl.diffuse[2]);
+        glm::vec3 specular(mtl.specular[0], mtl.specular[1], mtl.specular[2]);
+        glm::vec3 emission(mtl.emission[0], mtl.emission[1], mtl.emission[2]);
+
+        if (diffuse == glm::vec3(0.f) && !mtl.diffuse_texname.empty())
+            diffuse = glm::vec3(0.5f);
+
+        if (emission != glm::vec3(0.f))
+            return { emission, DIFFUSE_LIGHT, 1.f };
+
+        // illum 6 and 7 refract; exporters write Ni 1 on opaque materials too, and that would just vanish
+        if ((mtl.dissolve < 1.f || mtl.illum == 6 || mtl.illum == 7) && mtl.ior > 1.f)
+            return { glm::vec3(1.f), DIELECTRIC, mtl.ior };
+
+        // illum 3 and 5 are ray traced reflections, the Phong exponent maps to roughness
+        if (mtl.illum == 3 || mtl.illum == 5)
+        {
+            float fuzz = std::clamp(std::sqrt(2.f / (std::max(mtl.shininess, 0.f) + 2.f)), 0.f, 1.f);
+            return { specular != glm::vec3(0.f) ? specular : diffuse, METAL, fuzz };
+        }
+
+        return { diffuse, LAMBERTIAN, 0.f };
+    }
+
+    static std::vector<GeometryDesc> MakeGeometryDescs(std::span<const Submesh> submeshes, std::span<const SubmeshMaterial> materials)
+    {
+        std::vector<GeometryDesc> descs;
+        descs.reserve(submeshes.size());
+        for (const Submesh& submesh : submeshes)
+        {
+            GeometryDesc desc{ .albedo = glm::vec3(1.f), .materialType = GeometryDesc::NoMaterial, .fuzz = 0.f, .firstTriangle = submesh.firstIndex / 3 };
+            if (submesh.material >= 0 && static_cast<size_t>(submesh.material) < materials.size())
+            {
+                const SubmeshMaterial& material = materials[submesh.material];
+                desc.albedo = material.albedo;
+                desc.materialType = static_cast<uint32_t>(material.type);
+                desc.fuzz = material.fuzz;
+            }
+            descs.push_back(desc);
+        }
+        return descs;
+    }
+
+    static Vertex MakeVertex(const tinyobj::attrib_t& attrib, const tinyobj::index_t& index)
+    {
+        Vertex vertex{};
+
+        vertex.pos = {
+            attrib.vertices[3 * index.vertex_index + 0],
+            attrib.vertices[3 * index.vertex_index + 1],
+            attrib.vertices[3 * index.vertex_index + 2]
+        };
+
+        vertex.normal = {
+            attrib.normals[3 * index.normal_index + 0],
+            attrib.normals[3 * index.normal_index + 1],
+            attrib.normals[3 * index.normal_index + 2]
+        };
+
+        vertex.texCoord = {
+            attrib.texcoords[2 * index.texcoord_index + 0],
+            1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+        };
+
+        vertex.color = {
+            attrib.colors[3 * index.vertex_index + 0],
+            attrib.colors[3 * index.vertex_index + 1],
+            attrib.colors[3 * index.vertex_index + 2]
+        };
+
+        return vertex;
+    }
+
+    // a closed mesh has about one unique vertex per position, hard edges and uv seams add some on top
+    static size_t ExpectedVertexCount(const tinyobj::attrib_t& attrib, size_t indexCount)
+    {
+        return std::min(indexCount, std::max(attrib.vertices.size() / 3, indexCount / 6));
+    }
+
+    // Reference loader, every shape flattened into one index list like ObjParser does
+    static void LoadTinyObj(const std::filesystem::path& file, tinyobj::attrib_t& attrib, std::vector<tinyobj::index_t>& objIndices, ObjMaterials& objMaterials)
+    {
+        std::vector<tinyobj::shape_t> shapes;
+        std::string warn, err;
+
+        objMaterials = ObjMaterials();
+        if (!tinyobj::LoadObj(&attrib, &shapes, &objMaterials.materials, &warn, &err, file.string().c_str(), file.parent_path().string().c_str())) {
+            throw std::runtime_error(warn + err);
+        }
+
+        objIndices.clear();
+        for (const auto& shape : shapes)
+        {
+            objIndices.insert(objIndices.end(), shape.mesh.indices.begin(), shape.mesh.indices.end());
+            objMaterials.triangleMaterials.insert(objMaterials.triangleMaterials.end(), shape.mesh.material_ids.begin(), shape.mesh.material_ids.end());
+        }
+    }
+
     Model::Model()
     {
         this->id = nextId++;
@@ -12,68 +195,321 @@ namespace CLAR {
 
     void Model::Draw(VkCommandBuffer commandBuffer) const
     {
-        VkBuffer vertexBuffers[] = { m_VertexBuffer.buffer };
-        VkDeviceSize offsets[] = { 0 };
-        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-        vkCmdBindIndexBuffer(commandBuffer, m_IndexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-        vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+        // the optional streams sit on consecutive bindings after the vertex stream, all in the pool's vertex
+        // megabuffer, so only the offsets differ between models
+        VkBuffer vertexBuffers[3];
+        VkDeviceSize offsets[3];
+        uint32_t bindingCount = 0;
+        for (const GeometryRange* range : { &m_VertexRange, &m_AttributeRange, &m_ColorRange })
+        {
+            if (!range->IsValid())
+                continue;
+            vertexBuffers[bindingCount] = range->buffer;
+            offsets[bindingCount++] = range->offset;
+        }
+
+        // the index megabuffer stays bound at 0, the model starts at its own first index
+        vkCmdBindVertexBuffers(commandBuffer, 0, bindingCount, vertexBuffers, offsets);
+        vkCmdBindIndexBuffer(commandBuffer, m_IndexRange.buffer, 0, VK_INDEX_TYPE_UINT32);
+        vkCmdDrawIndexed(commandBuffer, IndexCount(), 1, static_cast<uint32_t>(m_IndexRange.offset / sizeof(uint32_t)), 0, 0);
     }
 
-    void Model::LoadModel(const std::filesystem::path& file)
+    void Model::LoadModel(const std::filesystem::path& file, ThreadPool* pool)
     {
+        // a valid .clarmesh next to the source skips parsing and deduplication entirely
+        if (MeshCache::Load(file, *this, CacheFlags))
+            return;
+
         tinyobj::attrib_t attrib;
-        std::vector<tinyobj::shape_t> shapes;
-        std::vector<tinyobj::material_t> materials;
-        std::string warn, err;
+        std::vector<tinyobj::index_t> objIndices;
+        ObjMaterials objMaterials;
 
-        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, file.string().c_str(), "../models")) {
-            throw std::runtime_error(warn + err);
+        // the built-in parser handles plain triangle and quad meshes, anything else still goes through tinyobj
+        if (!ObjParser(pool).Parse(file, attrib, objIndices, objMaterials))
+            LoadTinyObj(file, attrib, objIndices, objMaterials);
+
+        this->indices.reserve(this->indices.size() + objIndices.size());
+        VertexWelder welder(this->mesh, ExpectedVertexCount(attrib, objIndices.size()));
+        for (const auto& index : objIndices) {
+            this->indices.push_back(welder.Insert(MakeVertex(attrib, index)));
         }
 
-        std::unordered_map<Vertex, uint32_t> uniqueVertices{};
-        int i = 0;
-        for (const auto& shape : shapes) {
-            for (const auto& index : shape.mesh.indices) {
-                Vertex vertex{};
-
-                vertex.pos = {
-                    attrib.vertices[3 * index.vertex_index + 0],
-                    attrib.vertices[3 * index.vertex_index + 1],    
-                    attrib.vertices[3 * index.vertex_index + 2]
-                };
-
-                vertex.normal = {
-					attrib.normals[3 * index.normal_index + 0],
-					attrib.normals[3 * index.normal_index + 1],
-					attrib.normals[3 * index.normal_index + 2]
-				};
-
-                vertex.texCoord = {
-                    attrib.texcoords[2 * index.texcoord_index + 0],
-                    1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-                };
-
-                vertex.color = {
-                    attrib.colors[3 * index.vertex_index + 0],
-                    attrib.colors[3 * index.vertex_index + 1],
-                    attrib.colors[3 * index.vertex_index + 2]
-                };
-
-                if (uniqueVertices.count(vertex) == 0) {
-                    uniqueVertices[vertex] = static_cast<uint32_t>(this->mesh.size());
-                    this->mesh.push_back(vertex);
-                }
+        this->materials.clear();
+        for (const auto& material : objMaterials.materials)
+            this->materials.push_back(MaterialFromMtl(material));
+        BuildSubmeshes(objMaterials.triangleMaterials);
 
-                this->indices.push_back(uniqueVertices[vertex]);
-                i++;
-            }
-        }
+#ifdef OPTIMIZE_MESHES
+        // the ACMR report is for debug builds only, it simulates the vertex cache over the whole mesh twice
+#ifndef NDEBUG
+        float acmr = MeshOptimizer::ComputeACMR(this->indices, this->mesh.size());
+#endif
+        std::vector<uint32_t> remap(this->mesh.size(), UnusedVertex);
+        OptimizeSubmeshes(this->mesh, this->indices, this->submeshes, remap);
+        MeshOptimizer::OptimizeVertexFetch(this->mesh, this->indices);
+#ifndef NDEBUG
+        std::cout << "[MeshOptimizer] " << file << ": ACMR " << acmr << " -> " << MeshOptimizer::ComputeACMR(this->indices, this->mesh.size()) << '\n';
+#endif
+#endif
+
+        ComputeBounds();
+        BuildLods();
+        MeshCache::Store(file, *this, CacheFlags);
     }
 
     void Model::LoadModel(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
     {
         this->mesh = vertices;
 		this->indices = indices;
+        this->submeshes = { { 0, IndexCount(), -1 } };
+        ComputeBounds();
+    }
+
+    void Model::LoadModel(std::vector<Vertex> vertices, std::vector<uint32_t> indices, std::vector<Submesh> submeshes, std::vector<SubmeshMaterial> materials)
+    {
+        this->mesh = std::move(vertices);
+        this->indices = std::move(indices);
+        this->submeshes = std::move(submeshes);
+        this->materials = std::move(materials);
+        if (this->submeshes.empty())
+            this->submeshes = { { 0, IndexCount(), -1 } };
+
+#ifdef OPTIMIZE_MESHES
+        std::vector<uint32_t> remap(this->mesh.size(), UnusedVertex);
+        OptimizeSubmeshes(this->mesh, this->indices, this->submeshes, remap);
+        MeshOptimizer::OptimizeVertexFetch(this->mesh, this->indices);
+#endif
+
+        ComputeBounds();
+        BuildLods();
+    }
+
+    void Model::CreateBuffers(GeometryPool& pool, VertexFormat format)
+    {
+        auto vertices = Vertices();
+        vertexFormat = format;
+
+        if (format == VertexFormat::Split)
+        {
+            std::vector<glm::vec3> positions(vertices.size());
+            std::transform(vertices.begin(), vertices.end(), positions.begin(), [](const Vertex& vertex) { return vertex.pos; });
+            m_VertexRange = pool.Upload(GeometryHeap::Vertex, positions);
+
+            std::vector<VertexAttributes> attributes(vertices.begin(), vertices.end());
+            m_AttributeRange = pool.Upload(GeometryHeap::Vertex, attributes);
+        }
+        else if (format == VertexFormat::Packed)
+        {
+            std::vector<PackedVertex> packed(vertices.begin(), vertices.end());
+            m_VertexRange = pool.Upload(GeometryHeap::Vertex, packed);
+        }
+        else
+        {
+            m_VertexRange = pool.Upload(GeometryHeap::Vertex, vertices);
+        }
+
+        if (format != VertexFormat::Float && HasVertexColors())
+        {
+            std::vector<uint32_t> colors(vertices.size());
+            std::transform(vertices.begin(), vertices.end(), colors.begin(), [](const Vertex& vertex) { return PackColor(vertex.color); });
+            m_ColorRange = pool.Upload(GeometryHeap::Vertex, colors);
+        }
+
+        m_IndexRange = pool.Upload(GeometryHeap::Index, Indices());
+        m_GeometryRange = pool.Upload(GeometryHeap::Vertex, MakeGeometryDescs(submeshes, materials));
+        for (auto& lod : lods)
+        {
+            lod.m_IndexRange = pool.Upload(GeometryHeap::Index, lod.Indices());
+            lod.m_GeometryRange = pool.Upload(GeometryHeap::Vertex, MakeGeometryDescs(lod.submeshes, materials));
+        }
+    }
+
+    void Model::DestroyBuffers(GeometryPool& pool) const
+    {
+        pool.Free(m_VertexRange);
+        pool.Free(m_AttributeRange);
+        pool.Free(m_ColorRange);
+        pool.Free(m_IndexRange);
+        pool.Free(m_GeometryRange);
+        for (const auto& lod : lods)
+        {
+            pool.Free(lod.m_IndexRange);
+            pool.Free(lod.m_GeometryRange);
+        }
+    }
+
+    void Model::Relocate(const GeometryRelocation& relocation)
+    {
+        auto relocate = [&relocation](GeometryRange& range) {
+            if (range.IsValid() && range.heap == relocation.heap && range.block == relocation.block)
+            {
+                range.buffer = relocation.buffer;
+                range.address = relocation.address + range.offset;
+            }
+        };
+
+        relocate(m_VertexRange);
+        relocate(m_AttributeRange);
+        relocate(m_ColorRange);
+        relocate(m_IndexRange);
+        relocate(m_GeometryRange);
+        for (auto& lod : lods)
+        {
+            relocate(lod.m_IndexRange);
+            relocate(lod.m_GeometryRange);
+        }
+    }
+
+    // stride of m_VertexRange, which is also what the BLAS build walks
+    VkDeviceSize Model::VertexStride() const
+    {
+        switch (vertexFormat)
+        {
+        case VertexFormat::Split:
+            return sizeof(glm::vec3);
+        case VertexFormat::Packed:
+            return sizeof(PackedVertex);
+        default:
+            return sizeof(Vertex);
+        }
+    }
+
+    // tinyobj fills missing vertex colors with white, so anything else means the file has them
+    bool Model::HasVertexColors() const
+    {
+        auto vertices = Vertices();
+        return std::any_of(vertices.begin(), vertices.end(), [](const Vertex& vertex) { return vertex.color != glm::vec3(1.0f); });
+    }
+
+    uint32_t Model::SelectLod(const glm::mat4& transform, const glm::vec3& cameraPosition, float pixelScale, float maxPixelError) const
+    {
+        if (lods.empty())
+            return 0;
+
+        float scale = std::max({ glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])) });
+        glm::vec3 center = glm::vec3(transform * glm::vec4(0.5f * (boundsMin + boundsMax), 1.f));
+        float radius = 0.5f * glm::length(boundsMax - boundsMin) * scale;
+
+        // inside the bounding sphere nothing but the full mesh is safe
+        float distance = glm::length(center - cameraPosition) - radius;
+        if (distance <= 0.f)
+            return 0;
+
+        glm::vec3 size = boundsMax - boundsMin;
+        float extent = std::max({ size.x, size.y, size.z }) * scale;
+        for (uint32_t lod = LodCount() - 1; lod > 0; lod--)
+        {
+            if (lods[lod - 1].error * extent / distance * pixelScale <= maxPixelError)
+                return lod;
+        }
+        return 0;
+    }
+
+    // Stable sorts the triangles by material so that every material is one contiguous submesh
+    void Model::BuildSubmeshes(std::span<const int> triangleMaterials)
+    {
+        const size_t triangleCount = this->indices.size() / 3;
+        submeshes.clear();
+        if (triangleMaterials.size() != triangleCount || materials.empty())
+        {
+            submeshes.push_back({ 0, IndexCount(), -1 });
+            return;
+        }
+
+        // bucket 0 takes the faces without a material, bucket m + 1 material m
+        const size_t bucketCount = materials.size() + 1;
+        auto bucketOf = [&](int material) { return material >= 0 && static_cast<size_t>(material) < materials.size() ? material + 1 : 0; };
+
+        std::vector<uint32_t> bucketStart(bucketCount + 1, 0);
+        for (int material : triangleMaterials)
+            bucketStart[bucketOf(material) + 1]++;
+        for (size_t b = 0; b < bucketCount; b++)
+            bucketStart[b + 1] += bucketStart[b];
+
+        std::vector<uint32_t> sorted(this->indices.size());
+        std::vector<uint32_t> fill(bucketStart.begin(), bucketStart.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            uint32_t target = fill[bucketOf(triangleMaterials[t])]++;
+            std::copy_n(this->indices.begin() + t * 3, 3, sorted.begin() + target * 3);
+        }
+        this->indices.swap(sorted);
+
+        for (size_t b = 0; b < bucketCount; b++)
+        {
+            if (bucketStart[b + 1] > bucketStart[b])
+                submeshes.push_back({ bucketStart[b] * 3, (bucketStart[b + 1] - bucketStart[b]) * 3, static_cast<int32_t>(b) - 1 });
+        }
+        if (submeshes.empty())
+            submeshes.push_back({ 0, 0, -1 });
+    }
+
+    // Each level is simplified from the previous one, so its error is bounded by the sum of the steps.
+    // Submeshes are simplified one by one: material borders stay in place and every level keeps the same geometries.
+    void Model::BuildLods()
+    {
+        lods.clear();
+        if (IndexCount() < MinLodTriangles * 3)
+            return;
+
+        auto vertices = Vertices();
+        glm::vec3 size = boundsMax - boundsMin;
+        const float extent = std::max({ size.x, size.y, size.z });
+        std::vector<uint32_t> remap(vertices.size(), UnusedVertex);
+
+        float error = 0.f;
+        for (uint32_t level = 1; level < MaxLodCount; level++)
+        {
+            std::span<const uint32_t> source = LodIndices(level - 1);
+            ModelLod lod;
+            float stepError = 0.f;
+
+            for (const Submesh& submesh : LodSubmeshes(level - 1))
+            {
+                LocalMesh local(vertices, source.subspan(submesh.firstIndex, submesh.indexCount), remap);
+                size_t target = static_cast<size_t>(submesh.indexCount / 3 * LodReduction) * 3;
+
+                // the simplifier measures against the submesh bounds, the chain against the model bounds
+                float localExtent = local.Extent();
+                float scale = localExtent > 0.f ? extent / localExtent : 1.f;
+
+                float submeshError;
+                std::vector<uint32_t> simplified = MeshSimplifier::Simplify(local.vertices, local.indices, target, (LodMaxError - error) * scale, &submeshError);
+                stepError = std::max(stepError, submeshError / scale);
+
+                lod.submeshes.push_back({ static_cast<uint32_t>(lod.indices.size()), static_cast<uint32_t>(simplified.size()), submesh.material });
+                for (uint32_t index : simplified)
+                    lod.indices.push_back(local.modelVertex[index]);
+            }
+
+            // a level that is barely smaller than the previous one only costs memory and a BLAS
+            if (lod.indices.size() > source.size() * 3 / 4)
+                break;
+
+#ifdef OPTIMIZE_MESHES
+            OptimizeSubmeshes(vertices, lod.indices, lod.submeshes, remap);
+#endif
+            error += stepError;
+            lod.error = error;
+            lods.push_back(std::move(lod));
+        }
+    }
+
+    void Model::ComputeBounds()
+    {
+        auto vertices = Vertices();
+        if (vertices.empty())
+        {
+            boundsMin = boundsMax = glm::vec3(0.f);
+            return;
+        }
+
+        boundsMin = boundsMax = vertices[0].pos;
+        for (const auto& vertex : vertices)
+        {
+            boundsMin = glm::min(boundsMin, vertex.pos);
+            boundsMax = glm::max(boundsMax, vertex.pos);
+        }
     }
 
     inline static uint32_t id = 0;
@@ -1,12 +1,18 @@
 #pragma once
 
 #include <filesystem>
+#include <memory>
+#include <span>
 #include <vector>
 
 #include "clar_vertex.h"
 #include "ClarVertexBuffer.h"
 #include "ClarIndexBuffer.h"
 #include "ClarAllocator.h"
+#include "ClarGeometryPool.h"
+#include "ClarMaterial.h"
+#include "utils/MappedFile.h"
+#include "utils/ThreadPool.h"
 
 namespace CLAR {
 	/*enum Material {
@@ -34,16 +40,102 @@ namespace CLAR {
 		}
 	};*/
 
+	// Contiguous range of triangles sharing one .mtl material, each one becomes a geometry of the BLAS
+	struct Submesh {
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		int32_t material; // into Model::materials, -1 when the faces have none
+	};
+
+	// .mtl material mapped onto the path tracer's material types
+	struct SubmeshMaterial {
+		glm::vec3 albedo;
+		MaterialType type;
+		float fuzz; // fuzz, refraction index or light area, as in ObjDesc
+	};
+
+	// Per geometry record the hit shader reads with gl_GeometryIndexEXT, mirrored in raytrace.rchit
+	struct GeometryDesc {
+		glm::vec3 albedo;
+		uint32_t materialType; // NoMaterial when the submesh has none
+		float fuzz;
+		uint32_t firstTriangle; // gl_PrimitiveID restarts at every geometry
+
+		static constexpr uint32_t NoMaterial = UINT32_MAX;
+	};
+
+	// Coarser index list over the vertices of its Model, see MeshSimplifier
+	struct ModelLod {
+		std::vector<uint32_t> indices;
+		std::span<const uint32_t> m_MappedIndices;
+		float error = 0.f; // relative to the largest extent of the model bounds
+		std::vector<Submesh> submeshes; // same materials in the same order as the model's
+		GeometryRange m_IndexRange{};
+		GeometryRange m_GeometryRange{};
+
+		std::span<const uint32_t> Indices() const { return indices.empty() ? m_MappedIndices : std::span<const uint32_t>(indices); }
+	};
+
 	struct Model {
 		uint32_t id;
 		std::vector<Vertex> mesh;
 		std::vector<uint32_t> indices;
-		Buffer m_VertexBuffer;
-		Buffer m_IndexBuffer;
+		glm::vec3 boundsMin{ 0.f };
+		glm::vec3 boundsMax{ 0.f };
+		// Ranges of the scene's GeometryPool, see CreateBuffers
+		GeometryRange m_VertexRange{};
+		GeometryRange m_IndexRange{};
+		// VertexAttributes per vertex for the split layout, m_VertexRange then only holds positions
+		GeometryRange m_AttributeRange{};
+		// RGBA8 per vertex, only created for packed and split models whose source has vertex colors
+		GeometryRange m_ColorRange{};
+		VertexFormat vertexFormat = VertexFormat::Float;
+		// Triangles are sorted by material, a model without .mtl materials is a single submesh
+		std::vector<Submesh> submeshes;
+		std::vector<SubmeshMaterial> materials;
+		// GeometryDesc per submesh
+		GeometryRange m_GeometryRange{};
+		// Levels 1 and up, level 0 is the model itself. All of them share the vertex range.
+		std::vector<ModelLod> lods;
 		Model();
 
 		void Draw(VkCommandBuffer commandBuffer) const;
-		void LoadModel(const std::filesystem::path& file);
+		// Chunks of large OBJ files are parsed on pool when one is given
+		void LoadModel(const std::filesystem::path& file, ThreadPool* pool = nullptr);
 		void LoadModel(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+		// Geometry that is already indexed and grouped by material, like a glTF mesh; gets optimized and LODs like an OBJ
+		void LoadModel(std::vector<Vertex> vertices, std::vector<uint32_t> indices, std::vector<Submesh> submeshes, std::vector<SubmeshMaterial> materials);
+
+		// Uploads the geometry in the given layout into ranges of pool, the vertex range doubles as BLAS input
+		void CreateBuffers(GeometryPool& pool, VertexFormat format = GpuVertexFormat);
+		void DestroyBuffers(GeometryPool& pool) const;
+		// Points the ranges of a block the pool moved at its new place
+		void Relocate(const GeometryRelocation& relocation);
+		VkDeviceSize VertexStride() const;
+		bool HasVertexColors() const;
+
+		uint32_t LodCount() const { return 1 + static_cast<uint32_t>(lods.size()); }
+		std::span<const uint32_t> LodIndices(uint32_t lod) const { return lod == 0 ? Indices() : lods[lod - 1].Indices(); }
+		const GeometryRange& LodIndexRange(uint32_t lod) const { return lod == 0 ? m_IndexRange : lods[lod - 1].m_IndexRange; }
+		std::span<const Submesh> LodSubmeshes(uint32_t lod) const { return lod == 0 ? submeshes : lods[lod - 1].submeshes; }
+		const GeometryRange& LodGeometryRange(uint32_t lod) const { return lod == 0 ? m_GeometryRange : lods[lod - 1].m_GeometryRange; }
+		// Coarsest level whose simplification error stays under maxPixelError on screen.
+		// pixelScale is the viewport height divided by 2 * tan(fovY / 2).
+		uint32_t SelectLod(const glm::mat4& transform, const glm::vec3& cameraPosition, float pixelScale, float maxPixelError = 1.f) const;
+
+		// Geometry as uploaded to the GPU: either the vectors above or a view into a mapped .clarmesh
+		std::span<const Vertex> Vertices() const { return m_MappedFile ? m_MappedVertices : std::span<const Vertex>(mesh); }
+		std::span<const uint32_t> Indices() const { return m_MappedFile ? m_MappedIndices : std::span<const uint32_t>(indices); }
+		uint32_t VertexCount() const { return static_cast<uint32_t>(Vertices().size()); }
+		uint32_t IndexCount() const { return static_cast<uint32_t>(Indices().size()); }
+
+		std::unique_ptr<MappedFile> m_MappedFile;
+		std::span<const Vertex> m_MappedVertices;
+		std::span<const uint32_t> m_MappedIndices;
+
+	private:
+		void ComputeBounds();
+		void BuildSubmeshes(std::span<const int> triangleMaterials);
+		void BuildLods();
 	};
 }
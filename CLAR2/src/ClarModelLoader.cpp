@@ -0,0 +1,38 @@
+#include "ClarModelLoader.h"
+
+namespace CLAR {
+
+	ModelLoader::ModelLoader(ThreadPool& pool)
+		: m_Pool(pool)
+	{
+	}
+
+	ModelLoader::~ModelLoader()
+	{
+		// never leave a job writing into a model the caller may already have freed
+		for (auto& handle : m_Pending)
+			handle.ready.wait();
+	}
+
+	ModelHandle ModelLoader::LoadAsync(const std::filesystem::path& path)
+	{
+		Model* model = new Model();
+
+		ModelHandle handle{ model, m_Pool.Submit([this, model, path]() { model->LoadModel(path, &m_Pool); }).share() };
+		m_Pending.push_back(handle);
+
+		return handle;
+	}
+
+	void ModelLoader::WaitAll()
+	{
+		for (auto& handle : m_Pending)
+			handle.ready.wait();
+
+		auto pending = std::move(m_Pending);
+		m_Pending.clear();
+
+		for (auto& handle : pending)
+			handle.ready.get();
+	}
+}
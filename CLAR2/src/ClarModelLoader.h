@@ -0,0 +1,40 @@
+#pragma once
+
+#include <filesystem>
+#include <future>
+#include <vector>
+
+#include "ClarModel.h"
+#include "utils/ThreadPool.h"
+
+namespace CLAR {
+
+	struct ModelHandle {
+		Model* model = nullptr;
+		std::shared_future<void> ready;
+
+		bool IsReady() const { return ready.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+		// Blocks until the model is parsed, rethrows if loading failed
+		Model* Get() const { ready.get(); return model; }
+	};
+
+	// Parses models on the thread pool. The returned Model is allocated right away so it can be
+	// stored before the load finishes; its contents are only valid once the handle is ready.
+	class ModelLoader {
+	public:
+		ModelLoader(ThreadPool& pool);
+		~ModelLoader();
+
+		ModelLoader(const ModelLoader&) = delete;
+		ModelLoader& operator=(const ModelLoader&) = delete;
+
+		ModelHandle LoadAsync(const std::filesystem::path& path);
+
+		// Joins every load started so far, rethrows the first failure
+		void WaitAll();
+
+	private:
+		ThreadPool& m_Pool;
+		std::vector<ModelHandle> m_Pending;
+	};
+}
@@ -0,0 +1,672 @@
+#include "ClarObjParser.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+
+#include "utils/MappedFile.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CLAR_OBJ_SSE2
+#endif
+
+namespace CLAR {
+
+	namespace {
+
+		// Index of a face corner. Negative OBJ indices count back from the records seen so far, which inside a
+		// chunk is only known relative to the chunk start; those get the chunk base added once all chunks are parsed.
+		struct Corner {
+			int v, vt, vn;
+			uint8_t relative;
+		};
+
+		enum : uint8_t { RelativeV = 1, RelativeVt = 2, RelativeVn = 4 };
+
+		// A usemtl or mtllib line, kept in file order and resolved once every chunk is parsed
+		struct MaterialEvent {
+			size_t face;       // faces of the chunk that precede the line
+			bool library;
+			std::string name;  // material name, or the rest of the mtllib line
+		};
+
+		struct Chunk {
+			const char* begin;
+			const char* end;
+
+			std::vector<float> positions;
+			std::vector<float> colors;
+			std::vector<float> normals;
+			std::vector<float> texcoords;
+			std::vector<Corner> corners;
+			std::vector<uint8_t> faceSizes;  // 3 or 4, corners of consecutive faces are packed back to back
+			std::vector<MaterialEvent> materialEvents;
+
+			bool supported = true;
+
+			// Used to reject files tinyobj would handle differently, see Validate
+			int minRelativeV = 0, minRelativeVt = 0, minRelativeVn = 0;
+			int maxQuadAhead = INT32_MIN;
+
+			size_t baseV = 0, baseVt = 0, baseVn = 0;  // records in all chunks before this one
+			size_t baseIndex = 0;                      // output indices written by chunks before this one
+
+			size_t PositionCount() const { return positions.size() / 3; }
+			size_t TexcoordCount() const { return texcoords.size() / 2; }
+			size_t NormalCount() const { return normals.size() / 3; }
+			size_t IndexCount() const
+			{
+				size_t count = 0;
+				for (uint8_t size : faceSizes)
+					count += size == 3 ? 3 : 6;
+				return count;
+			}
+		};
+
+		// Returns the first '\n', '\r' or '\0' in [p, end), or end
+		const char* FindLineEnd(const char* p, const char* end)
+		{
+#ifdef CLAR_OBJ_SSE2
+			const __m128i newline = _mm_set1_epi8('\n');
+			const __m128i carriageReturn = _mm_set1_epi8('\r');
+			const __m128i zero = _mm_setzero_si128();
+
+			while (end - p >= 16)
+			{
+				__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+				__m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, newline), _mm_cmpeq_epi8(block, carriageReturn)), _mm_cmpeq_epi8(block, zero));
+
+				unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+				if (mask != 0)
+					return p + std::countr_zero(mask);
+				p += 16;
+			}
+#endif
+			while (p < end && *p != '\n' && *p != '\r' && *p != '\0')
+				p++;
+			return p;
+		}
+
+		bool IsSpace(char c) { return c == ' ' || c == '\t'; }
+		bool IsDigit(char c) { return static_cast<unsigned>(c - '0') < 10u; }
+
+		const char* SkipSpaces(const char* p, const char* end)
+		{
+			while (p < end && IsSpace(*p))
+				p++;
+			return p;
+		}
+
+		// The same algorithm as tinyobj's tryParseDouble, step for step, so both round identically
+		bool TryParseDouble(const char* s, const char* end, double* result)
+		{
+			if (s >= end)
+				return false;
+
+			double mantissa = 0.0;
+			int exponent = 0;
+			char sign = '+';
+			char expSign = '+';
+			const char* curr = s;
+			int read = 0;
+			bool endNotReached = false;
+			bool leadingDecimalDots = false;
+
+			if (*curr == '+' || *curr == '-')
+			{
+				sign = *curr;
+				curr++;
+				if (curr != end && *curr == '.')
+					leadingDecimalDots = true;
+			}
+			else if (*curr == '.')
+				leadingDecimalDots = true;
+			else if (!IsDigit(*curr))
+				return false;
+
+			endNotReached = curr != end;
+			if (!leadingDecimalDots)
+			{
+				while (endNotReached && IsDigit(*curr))
+				{
+					mantissa *= 10;
+					mantissa += static_cast<int>(*curr - 0x30);
+					curr++;
+					read++;
+					endNotReached = curr != end;
+				}
+
+				if (read == 0)
+					return false;
+			}
+
+			if (endNotReached)
+			{
+				bool hasExponent = true;
+				if (*curr == '.')
+				{
+					// tinyobj only has the first 8 in a table and calls std::pow past that, which is slow for
+					// exporters writing 9+ decimals; the extra entries come from the very same std::pow call
+					static const std::array<double, 32> powLut = []() {
+						std::array<double, 32> lut{ 1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001 };
+						for (int read = 8; read < 32; read++)
+							lut[read] = std::pow(10.0, -read);
+						return lut;
+					}();
+					constexpr int lutEntries = static_cast<int>(powLut.size());
+
+					curr++;
+					read = 1;
+					endNotReached = curr != end;
+					while (endNotReached && IsDigit(*curr))
+					{
+						mantissa += static_cast<int>(*curr - 0x30) * (read < lutEntries ? powLut[read] : std::pow(10.0, -read));
+						read++;
+						curr++;
+						endNotReached = curr != end;
+					}
+				}
+				else if (*curr != 'e' && *curr != 'E')
+					hasExponent = false;
+
+				if (hasExponent && endNotReached && (*curr == 'e' || *curr == 'E'))
+				{
+					curr++;
+					endNotReached = curr != end;
+					if (endNotReached && (*curr == '+' || *curr == '-'))
+					{
+						expSign = *curr;
+						curr++;
+					}
+					else if (!endNotReached || !IsDigit(*curr))
+						return false;
+
+					read = 0;
+					endNotReached = curr != end;
+					while (endNotReached && IsDigit(*curr))
+					{
+						if (exponent > 2147483647 / 10)
+							return false;
+						exponent *= 10;
+						exponent += static_cast<int>(*curr - 0x30);
+						curr++;
+						read++;
+						endNotReached = curr != end;
+					}
+					exponent *= expSign == '+' ? 1 : -1;
+					if (read == 0)
+						return false;
+				}
+			}
+
+			*result = (sign == '+' ? 1 : -1) * (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent) : mantissa);
+			return true;
+		}
+
+		// tinyobj's parseReal: one whitespace separated token, the default when it does not parse
+		bool ParseReal(const char*& p, const char* end, float* out)
+		{
+			p = SkipSpaces(p, end);
+			const char* tokenEnd = p;
+			while (tokenEnd < end && !IsSpace(*tokenEnd) && *tokenEnd != '\r')
+				tokenEnd++;
+
+			double value;
+			bool parsed = TryParseDouble(p, tokenEnd, &value);
+			if (parsed)
+				*out = static_cast<float>(value);
+			p = tokenEnd;
+			return parsed;
+		}
+
+		float ParseReal(const char*& p, const char* end, double defaultValue = 0.0)
+		{
+			float value = static_cast<float>(defaultValue);
+			ParseReal(p, end, &value);
+			return value;
+		}
+
+		// atoi, bounded by the end of the line
+		int ParseInt(const char* p, const char* end)
+		{
+			while (p < end && (IsSpace(*p) || *p == '\v' || *p == '\f'))
+				p++;
+
+			bool negative = false;
+			if (p < end && (*p == '+' || *p == '-'))
+				negative = *p++ == '-';
+
+			int64_t value = 0;
+			while (p < end && IsDigit(*p) && value <= INT32_MAX)
+				value = value * 10 + (*p++ - '0');
+
+			return static_cast<int>(negative ? -value : value);
+		}
+
+		const char* SkipIndexField(const char* p, const char* end)
+		{
+			while (p < end && *p != '/' && !IsSpace(*p) && *p != '\r')
+				p++;
+			return p;
+		}
+
+		// tinyobj's fixIndex for the indices we accept: zero is never valid for us
+		bool ResolveIndex(int index, size_t localCount, int& out, uint8_t& relative, uint8_t flag, int& minRelative)
+		{
+			if (index > 0)
+			{
+				out = index - 1;
+				return true;
+			}
+			if (index == 0)
+				return false;
+
+			out = static_cast<int>(localCount) + index;
+			relative |= flag;
+			minRelative = std::min(minRelative, out);
+			return true;
+		}
+
+		// Parses one "v/vt/vn" corner the way tinyobj's parseTriple does, requiring all three parts
+		bool ParseCorner(const char*& p, const char* end, Chunk& chunk, Corner& corner)
+		{
+			corner.relative = 0;
+
+			if (!ResolveIndex(ParseInt(p, end), chunk.PositionCount(), corner.v, corner.relative, RelativeV, chunk.minRelativeV))
+				return false;
+			p = SkipIndexField(p, end);
+			if (p == end || *p != '/')
+				return false;
+			p++;
+
+			if (p == end || *p == '/')
+				return false;
+			if (!ResolveIndex(ParseInt(p, end), chunk.TexcoordCount(), corner.vt, corner.relative, RelativeVt, chunk.minRelativeVt))
+				return false;
+			p = SkipIndexField(p, end);
+			if (p == end || *p != '/')
+				return false;
+			p++;
+
+			if (!ResolveIndex(ParseInt(p, end), chunk.NormalCount(), corner.vn, corner.relative, RelativeVn, chunk.minRelativeVn))
+				return false;
+			p = SkipIndexField(p, end);
+			return true;
+		}
+
+		bool ParseFace(const char* p, const char* end, Chunk& chunk)
+		{
+			p = SkipSpaces(p, end);
+
+			Corner corners[4];
+			uint32_t count = 0;
+			while (p < end)
+			{
+				if (count == 4 || !ParseCorner(p, end, chunk, corners[count]))
+					return false;
+				count++;
+
+				while (p < end && (IsSpace(*p) || *p == '\r'))
+					p++;
+			}
+
+			if (count < 3)
+				return false;
+
+			// tinyobj bounds checks quads against the positions read when the face group is flushed,
+			// so a quad may only reference positions that precede it
+			if (count == 4)
+			{
+				for (const Corner& corner : corners)
+				{
+					if (!(corner.relative & RelativeV))
+						chunk.maxQuadAhead = std::max(chunk.maxQuadAhead, corner.v - static_cast<int>(chunk.PositionCount()));
+				}
+			}
+
+			chunk.corners.insert(chunk.corners.end(), corners, corners + count);
+			chunk.faceSizes.push_back(static_cast<uint8_t>(count));
+			return true;
+		}
+
+		void ParseVertex(const char* p, const char* end, Chunk& chunk)
+		{
+			float x = ParseReal(p, end);
+			float y = ParseReal(p, end);
+			float z = ParseReal(p, end);
+
+			// tinyobj's parseVertexWithColor: a 4th value is w and ends up as red, 6 values are a color
+			float r = 1.f, g = 1.f, b = 1.f;
+			if (ParseReal(p, end, &r))
+			{
+				if (!ParseReal(p, end, &g))
+					g = b = 1.f;
+				else if (!ParseReal(p, end, &b))
+					r = g = b = 1.f;
+			}
+			else
+				r = g = b = 1.f;
+
+			chunk.positions.insert(chunk.positions.end(), { x, y, z });
+			chunk.colors.insert(chunk.colors.end(), { r, g, b });
+		}
+
+		void ParseChunk(Chunk& chunk)
+		{
+			const char* p = chunk.begin;
+			while (p < chunk.end)
+			{
+				const char* lineEnd = FindLineEnd(p, chunk.end);
+				if (lineEnd < chunk.end && *lineEnd == '\0')
+				{
+					chunk.supported = false;
+					return;
+				}
+
+				const char* token = SkipSpaces(p, lineEnd);
+				size_t length = lineEnd - token;
+
+				if (length >= 2 && token[0] == 'v' && IsSpace(token[1]))
+					ParseVertex(token + 2, lineEnd, chunk);
+				else if (length >= 3 && token[0] == 'v' && token[1] == 'n' && IsSpace(token[2]))
+				{
+					const char* q = token + 3;
+					float x = ParseReal(q, lineEnd);
+					float y = ParseReal(q, lineEnd);
+					float z = ParseReal(q, lineEnd);
+					chunk.normals.insert(chunk.normals.end(), { x, y, z });
+				}
+				else if (length >= 3 && token[0] == 'v' && token[1] == 't' && IsSpace(token[2]))
+				{
+					const char* q = token + 3;
+					float u = ParseReal(q, lineEnd);
+					float v = ParseReal(q, lineEnd);
+					chunk.texcoords.insert(chunk.texcoords.end(), { u, v });
+				}
+				else if (length >= 2 && token[0] == 'f' && IsSpace(token[1]))
+				{
+					if (!ParseFace(token + 2, lineEnd, chunk))
+					{
+						chunk.supported = false;
+						return;
+					}
+				}
+				else if (length >= 6 && strncmp(token, "usemtl", 6) == 0)
+				{
+					// tinyobj's parseString: the first whitespace separated token
+					const char* name = SkipSpaces(token + 6, lineEnd);
+					const char* nameEnd = name;
+					while (nameEnd < lineEnd && !IsSpace(*nameEnd))
+						nameEnd++;
+					chunk.materialEvents.push_back({ chunk.faceSizes.size(), false, std::string(name, nameEnd) });
+				}
+				else if (length >= 7 && strncmp(token, "mtllib", 6) == 0 && IsSpace(token[6]))
+					chunk.materialEvents.push_back({ chunk.faceSizes.size(), true, std::string(token + 7, lineEnd) });
+				else if ((length >= 3 && token[0] == 'v' && token[1] == 'w' && IsSpace(token[2])) ||
+					(length >= 2 && (token[0] == 'l' || token[0] == 'p') && IsSpace(token[1])))
+				{
+					// skin weights, lines and points can make tinyobj fail, leave those files to it
+					chunk.supported = false;
+					return;
+				}
+				// comments, groups, objects and smoothing groups do not change the triangle list
+
+				// "\n", "\r\n" and a lone "\r" all end a line, as in tinyobj's safeGetline
+				p = lineEnd;
+				if (p < chunk.end && *p == '\r')
+					p++;
+				if (p < chunk.end && *p == '\n')
+					p++;
+			}
+		}
+
+		// Checks everything that needs the chunk bases: relative indices must not reach before the file start
+		// and quads must not reference positions defined after them
+		bool Validate(const Chunk& chunk)
+		{
+			return chunk.supported &&
+				static_cast<int64_t>(chunk.minRelativeV) + static_cast<int64_t>(chunk.baseV) >= 0 &&
+				static_cast<int64_t>(chunk.minRelativeVt) + static_cast<int64_t>(chunk.baseVt) >= 0 &&
+				static_cast<int64_t>(chunk.minRelativeVn) + static_cast<int64_t>(chunk.baseVn) >= 0 &&
+				static_cast<int64_t>(chunk.maxQuadAhead) < static_cast<int64_t>(chunk.baseV);
+		}
+
+		// tinyobj's SplitString: space separated file names, a backslash escapes the next character
+		std::vector<std::string> SplitLibraryNames(const std::string& line)
+		{
+			std::vector<std::string> names;
+			std::string name;
+			bool escaping = false;
+			for (char c : line)
+			{
+				if (escaping)
+					escaping = false;
+				else if (c == '\\')
+				{
+					escaping = true;
+					continue;
+				}
+				else if (c == ' ')
+				{
+					if (!name.empty())
+						names.push_back(name);
+					name.clear();
+					continue;
+				}
+				name += c;
+			}
+			names.push_back(name);
+			return names;
+		}
+
+		// Replays the usemtl and mtllib lines in file order the way tinyobj::LoadObj does: a library is read
+		// when its line is reached, so a usemtl only sees the materials of the libraries above it
+		void ResolveMaterials(const std::filesystem::path& file, const std::vector<Chunk>& chunks, ObjMaterials& out)
+		{
+			tinyobj::MaterialFileReader reader(file.parent_path().string());
+			std::map<std::string, int> materialMap;
+			std::set<std::string> libraries;
+			std::string warn, err;
+
+			int current = -1;
+			int* triangle = out.triangleMaterials.data();
+			for (const Chunk& chunk : chunks)
+			{
+				size_t face = 0;
+				auto assignUntil = [&](size_t end) {
+					for (; face < end; face++)
+					{
+						*triangle++ = current;
+						if (chunk.faceSizes[face] == 4)
+							*triangle++ = current;
+					}
+				};
+
+				for (const MaterialEvent& event : chunk.materialEvents)
+				{
+					assignUntil(event.face);
+					if (!event.library)
+					{
+						auto it = materialMap.find(event.name);
+						current = it != materialMap.end() ? it->second : -1;
+						continue;
+					}
+
+					for (const std::string& name : SplitLibraryNames(event.name))
+					{
+						if (libraries.count(name) > 0)
+							continue;
+						if (reader(name, &out.materials, &materialMap, &warn, &err))
+						{
+							libraries.insert(name);
+							break;
+						}
+					}
+				}
+				assignUntil(chunk.faceSizes.size());
+			}
+		}
+
+		// Writes the chunk's triangles into the final index list, splitting quads along tinyobj's diagonal
+		bool EmitIndices(const Chunk& chunk, const tinyobj::attrib_t& attrib, tinyobj::index_t* out)
+		{
+			const int positionCount = static_cast<int>(attrib.vertices.size() / 3);
+			const int texcoordCount = static_cast<int>(attrib.texcoords.size() / 2);
+			const int normalCount = static_cast<int>(attrib.normals.size() / 3);
+
+			const Corner* corner = chunk.corners.data();
+			for (uint8_t faceSize : chunk.faceSizes)
+			{
+				tinyobj::index_t face[4];
+				for (uint32_t i = 0; i < faceSize; i++)
+				{
+					const Corner& c = corner[i];
+					face[i].vertex_index = c.v + (c.relative & RelativeV ? static_cast<int>(chunk.baseV) : 0);
+					face[i].texcoord_index = c.vt + (c.relative & RelativeVt ? static_cast<int>(chunk.baseVt) : 0);
+					face[i].normal_index = c.vn + (c.relative & RelativeVn ? static_cast<int>(chunk.baseVn) : 0);
+
+					if (face[i].vertex_index >= positionCount || face[i].texcoord_index >= texcoordCount || face[i].normal_index >= normalCount)
+						return false;
+				}
+				corner += faceSize;
+
+				if (faceSize == 3)
+				{
+					*out++ = face[0];
+					*out++ = face[1];
+					*out++ = face[2];
+					continue;
+				}
+
+				const float* v = attrib.vertices.data();
+				const float* v0 = v + 3 * face[0].vertex_index;
+				const float* v1 = v + 3 * face[1].vertex_index;
+				const float* v2 = v + 3 * face[2].vertex_index;
+				const float* v3 = v + 3 * face[3].vertex_index;
+
+				float e02x = v2[0] - v0[0];
+				float e02y = v2[1] - v0[1];
+				float e02z = v2[2] - v0[2];
+				float e13x = v3[0] - v1[0];
+				float e13y = v3[1] - v1[1];
+				float e13z = v3[2] - v1[2];
+
+				float sqr02 = e02x * e02x + e02y * e02y + e02z * e02z;
+				float sqr13 = e13x * e13x + e13y * e13y + e13z * e13z;
+
+				if (sqr02 < sqr13)
+				{
+					*out++ = face[0]; *out++ = face[1]; *out++ = face[2];
+					*out++ = face[0]; *out++ = face[2]; *out++ = face[3];
+				}
+				else
+				{
+					*out++ = face[0]; *out++ = face[1]; *out++ = face[3];
+					*out++ = face[1]; *out++ = face[2]; *out++ = face[3];
+				}
+			}
+			return true;
+		}
+	}
+
+	ObjParser::ObjParser(ThreadPool* pool)
+		: m_Pool(pool)
+	{
+	}
+
+	bool ObjParser::Parse(const std::filesystem::path& file, tinyobj::attrib_t& attrib, std::vector<tinyobj::index_t>& indices, ObjMaterials& materials)
+	{
+		MappedFile mapped;
+		if (!mapped.Open(file))
+			return false;
+
+		const char* data = reinterpret_cast<const char*>(mapped.Data());
+		const char* dataEnd = data + mapped.Size();
+
+		auto parallelFor = [this](size_t count, auto&& func) {
+			if (m_Pool)
+				m_Pool->ParallelFor(count, func);
+			else
+				for (size_t i = 0; i < count; i++)
+					func(i);
+		};
+
+		// Chunks end right after a '\n', which always terminates a line whether or not a '\r' precedes it
+		constexpr size_t MinChunkSize = 1 << 20;
+		size_t chunkCount = m_Pool ? std::clamp<size_t>(mapped.Size() / MinChunkSize, 1, m_Pool->ThreadCount() * 4) : 1;
+
+		std::vector<Chunk> chunks;
+		chunks.reserve(chunkCount);
+		const char* begin = data;
+		for (size_t i = 1; i <= chunkCount && begin < dataEnd; i++)
+		{
+			const char* end = i == chunkCount ? dataEnd : std::max(begin, data + mapped.Size() * i / chunkCount);
+			if (end < dataEnd)
+			{
+				const void* newline = memchr(end, '\n', dataEnd - end);
+				end = newline ? static_cast<const char*>(newline) + 1 : dataEnd;
+			}
+
+			Chunk& chunk = chunks.emplace_back();
+			chunk.begin = begin;
+			chunk.end = end;
+			begin = end;
+		}
+
+		parallelFor(chunks.size(), [&chunks](size_t i) { ParseChunk(chunks[i]); });
+
+		size_t positionCount = 0, texcoordCount = 0, normalCount = 0, indexCount = 0;
+		for (Chunk& chunk : chunks)
+		{
+			chunk.baseV = positionCount;
+			chunk.baseVt = texcoordCount;
+			chunk.baseVn = normalCount;
+			chunk.baseIndex = indexCount;
+
+			if (!Validate(chunk))
+				return false;
+
+			positionCount += chunk.PositionCount();
+			texcoordCount += chunk.TexcoordCount();
+			normalCount += chunk.NormalCount();
+			indexCount += chunk.IndexCount();
+		}
+
+		attrib = tinyobj::attrib_t();
+		attrib.vertices.resize(positionCount * 3);
+		attrib.colors.resize(positionCount * 3);
+		attrib.texcoords.resize(texcoordCount * 2);
+		attrib.normals.resize(normalCount * 3);
+
+		parallelFor(chunks.size(), [&](size_t i) {
+			const Chunk& chunk = chunks[i];
+			std::copy(chunk.positions.begin(), chunk.positions.end(), attrib.vertices.begin() + chunk.baseV * 3);
+			std::copy(chunk.colors.begin(), chunk.colors.end(), attrib.colors.begin() + chunk.baseV * 3);
+			std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), attrib.texcoords.begin() + chunk.baseVt * 2);
+			std::copy(chunk.normals.begin(), chunk.normals.end(), attrib.normals.begin() + chunk.baseVn * 3);
+		});
+
+		// quads need the final positions to pick their diagonal, so indices go after the attribute copy
+		indices.resize(indexCount);
+		std::atomic<bool> valid = true;
+		parallelFor(chunks.size(), [&](size_t i) {
+			if (!EmitIndices(chunks[i], attrib, indices.data() + chunks[i].baseIndex))
+				valid = false;
+		});
+
+		if (!valid)
+			return false;
+
+		materials = ObjMaterials();
+		materials.triangleMaterials.resize(indexCount / 3);
+		ResolveMaterials(file, chunks, materials);
+		return true;
+	}
+}
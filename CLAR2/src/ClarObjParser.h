@@ -0,0 +1,34 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+#include <tiny_obj_loader.h>
+
+#include "utils/ThreadPool.h"
+
+namespace CLAR {
+
+	// .mtl materials of an OBJ file and the material of every triangle, numbered like tinyobj numbers them:
+	// ids index materials, -1 for faces before any usemtl or naming a material no library defines
+	struct ObjMaterials {
+		std::vector<tinyobj::material_t> materials;
+		std::vector<int> triangleMaterials;
+	};
+
+	// Parallel OBJ parser for the part of the format our assets use: v/vn/vt records and triangle or quad
+	// faces whose corners all reference a position, a texcoord and a normal. For those files it is written to
+	// match tinyobj::LoadObj bit for bit, with every shape flattened into one triangle list.
+	// Anything outside that subset makes Parse return false and the caller falls back to tinyobj.
+	class ObjParser {
+	public:
+		// Without a pool the chunks are parsed on the calling thread
+		explicit ObjParser(ThreadPool* pool = nullptr);
+
+		// mtllib files are looked up next to the OBJ file
+		bool Parse(const std::filesystem::path& file, tinyobj::attrib_t& attrib, std::vector<tinyobj::index_t>& indices, ObjMaterials& materials);
+
+	private:
+		ThreadPool* m_Pool;
+	};
+}
@@ -12,8 +12,8 @@ namespace CLAR {
 		void CreatePipeline(
 			VkRenderPass renderPass,
 			VkExtent2D extent,
-			const std::filesystem::path& vertShaderPath = "../shaders/vert.spv",
-			const std::filesystem::path& fragShaderPath = "../shaders/frag.spv") override
+			const std::filesystem::path& vertShaderPath = "../shaders/shader.vert.spv",
+			const std::filesystem::path& fragShaderPath = "../shaders/shader.frag.spv") override
 		{
 			m_Pipeline = std::make_unique<GraphicsPipeline>(m_Device);
 
@@ -136,7 +136,12 @@ namespace CLAR {
 
 	void PipelineBuilder::SetVertexInputDescription(VkVertexInputBindingDescription vertexBindingDescription, const std::vector<VkVertexInputAttributeDescription>& vertexAttributeDescriptions)
 	{
-		_vertexBindingDescription = vertexBindingDescription;
+		SetVertexInputDescription(std::vector<VkVertexInputBindingDescription>{ vertexBindingDescription }, vertexAttributeDescriptions);
+	}
+
+	void PipelineBuilder::SetVertexInputDescription(const std::vector<VkVertexInputBindingDescription>& vertexBindingDescriptions, const std::vector<VkVertexInputAttributeDescription>& vertexAttributeDescriptions)
+	{
+		_vertexBindingDescriptions = vertexBindingDescriptions;
 		_vertexAttributeDescriptions = vertexAttributeDescriptions;
 	}
 
@@ -211,7 +216,7 @@ namespace CLAR {
 
 		_shaderStages.clear();
 
-		_vertexBindingDescription = {};
+		_vertexBindingDescriptions.clear();
 
 		_vertexAttributeDescriptions.clear();
 
@@ -22,7 +22,7 @@ namespace CLAR {
     public:
         std::vector<VkPipelineShaderStageCreateInfo> _shaderStages;
         // Instead of pointers, use actual arrays or structs
-        VkVertexInputBindingDescription _vertexBindingDescription;
+        std::vector<VkVertexInputBindingDescription> _vertexBindingDescriptions;
         std::vector<VkVertexInputAttributeDescription> _vertexAttributeDescriptions;
         VkPipelineInputAssemblyStateCreateInfo _inputAssembly;
         VkPipelineRasterizationStateCreateInfo _rasterizer;
@@ -47,6 +47,7 @@ namespace CLAR {
         void SetIntersectionShader(const std::filesystem::path& intersectionShaderPath);
 
         void SetVertexInputDescription(VkVertexInputBindingDescription vertexBindingDescription, const std::vector<VkVertexInputAttributeDescription>& vertexAttributeDescriptions);
+        void SetVertexInputDescription(const std::vector<VkVertexInputBindingDescription>& vertexBindingDescriptions, const std::vector<VkVertexInputAttributeDescription>& vertexAttributeDescriptions);
         void SetInputTopology(VkPrimitiveTopology topology);
         void SetPolygonMode(VkPolygonMode mode);
         void SetCullMode(VkCullModeFlags mode, VkFrontFace frontFace);
@@ -1,67 +1,168 @@
 #include "ClarRTBuilder.h"
 
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <iostream>
+
 namespace CLAR {
-	RTBuilder::RTBuilder(Device& device, Allocator& allocator)
-		: m_Device(device), m_Allocator(allocator)
+
+    static VkDeviceSize AlignUp(VkDeviceSize size, VkDeviceSize alignment)
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    static float SurfaceArea(const InstanceBounds& box)
+    {
+        glm::vec3 extent = glm::max(box.max - box.min, glm::vec3(0.0f));
+        return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+
+    static InstanceBounds Join(const InstanceBounds& a, const InstanceBounds& b)
+    {
+        return { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+    }
+
+    // World box of an instance, from its row major 3x4 transform
+    static InstanceBounds TransformBounds(const InstanceBounds& local, const VkTransformMatrixKHR& transform)
+    {
+        glm::vec3 center = (local.min + local.max) * 0.5f;
+        glm::vec3 halfExtent = (local.max - local.min) * 0.5f;
+
+        InstanceBounds world;
+        for (int row = 0; row < 3; row++)
+        {
+            const float* m = transform.matrix[row];
+            float c = m[0] * center.x + m[1] * center.y + m[2] * center.z + m[3];
+            float e = std::abs(m[0]) * halfExtent.x + std::abs(m[1]) * halfExtent.y + std::abs(m[2]) * halfExtent.z;
+            world.min[row] = c - e;
+            world.max[row] = c + e;
+        }
+        return world;
+    }
+
+	RTBuilder::RTBuilder(Device& device, Allocator& allocator, DeletionQueue& deletionQueue, VkDeviceSize scratchBudget)
+		: m_Device(device), m_Allocator(allocator), m_DeletionQueue(deletionQueue), m_ScratchBudget(scratchBudget)
 	{
+		VkPhysicalDeviceProperties2 properties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+		properties.pNext = &m_AsProperties;
+		vkGetPhysicalDeviceProperties2(m_Device.GPU(), &properties);
 	}
 
 	RTBuilder::~RTBuilder()
 	{
 	}
 
+    VkBuildAccelerationStructureFlagsKHR RTBuilder::BlasBuildFlags(bool compact)
+    {
+        return VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
+            (compact ? VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR : 0u);
+    }
+
+    void RTBuilder::SetCacheDirectory(const std::filesystem::path& directory)
+    {
+        if (directory.empty())
+            m_Cache.reset();
+        else
+            m_Cache.emplace(m_Device, directory);
+    }
+
     std::vector<ASBuildInfo> RTBuilder::BuildBlas(const std::vector<BlasInput>& allBlas)
     {
-        uint32_t     nbBlas = static_cast<uint32_t>(allBlas.size()); // Number of BLASes
+        uint32_t nbBlas = static_cast<uint32_t>(allBlas.size());
+        std::vector<ASBuildInfo> buildAs(nbBlas);
+        m_CompactionStats = { .blasCount = nbBlas };
+
+        // the geometry staged by Model::CreateBuffers has to be on the queue before the builds read it
+        m_Allocator.FlushUploads();
+
+        // the BLASes found in the cache are deserialized, only the others are built
+        std::vector<uint32_t> toBuild = LoadCached(allBlas, buildAs);
+        if (!toBuild.empty())
+        {
+            BuildBatches(allBlas, toBuild, buildAs);
+            StoreCached(allBlas, toBuild, buildAs);
+        }
+
+        for (const auto& blas : buildAs)
+        {
+            m_CompactionStats.builtBytes += blas.builtSize;
+            m_CompactionStats.compactedBytes += blas.sizeInfo.accelerationStructureSize;
+        }
+        if (m_CompactionStats.compactedCount > 0)
+        {
+            std::cout << std::format("[RTBuilder]: compacted {} of {} BLAS, {:.1f} MiB -> {:.1f} MiB\n",
+                m_CompactionStats.compactedCount, m_CompactionStats.blasCount,
+                m_CompactionStats.builtBytes / double(1 << 20), m_CompactionStats.compactedBytes / double(1 << 20));
+        }
+        if (m_CompactionStats.cachedCount > 0)
+            std::cout << std::format("[RTBuilder]: {} of {} BLAS loaded from {}\n", m_CompactionStats.cachedCount, nbBlas, m_Cache->Directory().string());
+
+        return buildAs;
+    }
+
+    void RTBuilder::BuildBatches(const std::vector<BlasInput>& allBlas, const std::vector<uint32_t>& toBuild, std::vector<ASBuildInfo>& buildAs)
+    {
         VkDeviceSize asTotalSize{ 0 };     // Memory size of all allocated BLAS
         uint32_t     nbCompactions{ 0 };   // Nb of BLAS requesting compaction
         VkDeviceSize maxScratchSize{ 0 };  // Largest scratch size
+        VkDeviceSize totalScratchSize{ 0 }; // Scratch of all builds at once
+        VkDeviceSize scratchAlignment = m_AsProperties.minAccelerationStructureScratchOffsetAlignment;
 
-        std::vector<ASBuildInfo> buildAs(nbBlas);
-
-        for (size_t i = 0; i < nbBlas; ++i)
+        for (uint32_t i : toBuild)
         {
             VkAccelerationStructureBuildGeometryInfoKHR buildInfo{
                 .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
                 .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-                .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+                .flags = BlasBuildFlags(allBlas[i].compact),
                 .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
                 .srcAccelerationStructure = VK_NULL_HANDLE,
                 .dstAccelerationStructure = VK_NULL_HANDLE,
-                .geometryCount = 1, // there is one geometry on the blas 
-                .pGeometries = &allBlas[i].asGeometry,
+                .geometryCount = static_cast<uint32_t>(allBlas[i].asGeometry.size()), // one geometry per submesh
+                .pGeometries = allBlas[i].asGeometry.data(),
                 .scratchData = 0
             };
 
             buildAs[i].buildInfo = buildInfo;
             buildAs[i].rangeInfo = allBlas[i].asBuildOffset;
             buildAs[i].blasId = allBlas[i].modelId;
+            buildAs[i].lod = allBlas[i].lod;
 
             // rangeInfo = blasInput.asBuildOffset
 
+            std::vector<uint32_t> maxPrimitiveCounts(buildAs[i].rangeInfo.size());
+            for (size_t g = 0; g < maxPrimitiveCounts.size(); ++g)
+                maxPrimitiveCounts[g] = buildAs[i].rangeInfo[g].primitiveCount;
+
             VkAccelerationStructureBuildSizesInfoKHR buildSizeInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
             vkGetAccelerationStructureBuildSizesKHR(m_Device,
                 VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
                 &buildAs[i].buildInfo,
-                &buildAs[i].rangeInfo.primitiveCount,
+                maxPrimitiveCounts.data(),
                 &buildSizeInfo);
 
             buildAs[i].sizeInfo = buildSizeInfo;
+            buildAs[i].builtSize = buildSizeInfo.accelerationStructureSize;
 
             asTotalSize += buildSizeInfo.accelerationStructureSize;
-            maxScratchSize = std::max(maxScratchSize, buildSizeInfo.buildScratchSize);
+            maxScratchSize = std::max(maxScratchSize, AlignUp(buildSizeInfo.buildScratchSize, scratchAlignment));
+            totalScratchSize += AlignUp(buildSizeInfo.buildScratchSize, scratchAlignment);
             nbCompactions += (buildAs[i].buildInfo.flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR) != 0;
         }
-        Buffer scratchBuffer = m_Allocator.CreateBuffer(maxScratchSize + 128, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-        VkDeviceAddress scratchAddress = m_Device.GetBufferDeviceAddress(scratchBuffer.buffer);
+        // every build in flight gets its own aligned range, as many of them as the budget allows but at least the biggest
+        VkDeviceSize scratchSize = std::max(maxScratchSize, std::min(totalScratchSize, m_ScratchBudget));
+        Buffer scratchBuffer = m_Allocator.CreateBuffer(scratchSize + scratchAlignment, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            0, MemoryCategory::AccelerationStructure);
+        VkDeviceAddress scratchAddress = AlignUp(m_Device.GetBufferDeviceAddress(scratchBuffer.buffer), scratchAlignment);
 
         // Allocate a query pool for storing the needed size for every BLAS compaction.
         VkQueryPool queryPool{ VK_NULL_HANDLE };
         if (nbCompactions > 0)  // Is compaction requested?
         {
-            assert(nbCompactions == nbBlas);  // Don't allow mix of on/off compaction
             VkQueryPoolCreateInfo qpci{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
-            qpci.queryCount = nbBlas;
+            qpci.queryCount = nbCompactions;
             qpci.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
             vkCreateQueryPool(m_Device, &qpci, nullptr, &queryPool);
         }
@@ -70,59 +171,98 @@ namespace CLAR {
         std::vector<uint32_t> indices;  // Indices of the BLAS to create
         VkDeviceSize          batchSize{ 0 };
         VkDeviceSize          batchLimit{ 256'000'000 };  // 256 MB
+        // the last batch's builds, the ones before it were waited on by their compaction
+        GpuTicket built;
 
-        for (uint32_t idx = 0; idx < nbBlas; idx++)
+        for (size_t n = 0; n < toBuild.size(); n++)
         {
+            uint32_t idx = toBuild[n];
             indices.push_back(idx);
             batchSize += buildAs[idx].sizeInfo.accelerationStructureSize;
             // Over the limit or last BLAS element
-            if (batchSize >= batchLimit || idx == nbBlas - 1)
+            if (batchSize >= batchLimit || n == toBuild.size() - 1)
             {
-                if (queryPool)  // For querying the compaction size
-                    vkResetQueryPool(m_Device, queryPool, 0, static_cast<uint32_t>(indices.size()));
-                uint32_t queryCnt{ 0 };
-                for (const auto& idx : indices)
+                // the ones of the batch built with ALLOW_COMPACTION, in query order
+                std::vector<uint32_t> compacted;
+                for (const auto& i : indices)
                 {
-                    m_Device.SingleTimeCommand([&](VkCommandBuffer commandBuffer) {
-                        VkAccelerationStructureCreateInfoKHR createInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
-                        createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-                        createInfo.size = buildAs[idx].sizeInfo.accelerationStructureSize;  // Will be used to allocate memory.
+                    if (buildAs[i].buildInfo.flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR)
+                        compacted.push_back(i);
+                }
 
-                        buildAs[idx].as = m_Allocator.CreateAccelerationStructure(createInfo);
+                if (!compacted.empty())  // For querying the compaction size
+                    vkResetQueryPool(m_Device, queryPool, 0, static_cast<uint32_t>(compacted.size()));
 
-                        buildAs[idx].buildInfo.dstAccelerationStructure = buildAs[idx].as.handle;
-                        buildAs[idx].buildInfo.scratchData.deviceAddress = scratchAddress + (128 - scratchAddress % 128);
+                // the whole batch goes in one command buffer. Builds whose scratch fits the buffer together are
+                // issued in one call and may overlap, a barrier separates them from the next group reusing it.
+                built = m_Device.SubmitAsync([&](VkCommandBuffer commandBuffer) {
+                    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> group;
+                    std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> groupRanges;
+                    VkDeviceSize scratchOffset = 0;
 
-                        VkAccelerationStructureBuildRangeInfoKHR* pBuildOffsetInfo = &buildAs[idx].rangeInfo;
-
-                        vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildAs[idx].buildInfo, &pBuildOffsetInfo);
+                    auto buildGroup = [&]() {
+                        if (group.empty())
+                            return;
+                        vkCmdBuildAccelerationStructuresKHR(commandBuffer, static_cast<uint32_t>(group.size()), group.data(), groupRanges.data());
 
+                        // the scratch is written again by the next group, the compaction queries read the results
                         VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
                         barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
-                        barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+                        barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
                         vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
                             VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-                        if (queryPool)
-                        {
-                            // Add a query to find the 'real' amount of memory needed, use for compaction
-                            vkCmdWriteAccelerationStructuresPropertiesKHR(commandBuffer, 1, &buildAs[idx].buildInfo.dstAccelerationStructure,
-                                VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool, queryCnt++);
-                        }
-                        });
-                }
-                if (queryPool)
+                        group.clear();
+                        groupRanges.clear();
+                        scratchOffset = 0;
+                    };
+
+                    for (const auto& idx : indices)
+                    {
+                        VkAccelerationStructureCreateInfoKHR createInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
+                        createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+                        createInfo.size = buildAs[idx].sizeInfo.accelerationStructureSize;  // Will be used to allocate memory.
+
+                        buildAs[idx].as = m_Allocator.CreateAccelerationStructure(createInfo, true);
+
+                        VkDeviceSize scratch = AlignUp(buildAs[idx].sizeInfo.buildScratchSize, scratchAlignment);
+                        if (scratchOffset + scratch > scratchSize)
+                            buildGroup();
+
+                        buildAs[idx].buildInfo.dstAccelerationStructure = buildAs[idx].as.handle;
+                        buildAs[idx].buildInfo.scratchData.deviceAddress = scratchAddress + scratchOffset;
+                        scratchOffset += scratch;
+
+                        group.push_back(buildAs[idx].buildInfo);
+                        groupRanges.push_back(buildAs[idx].rangeInfo.data());
+                    }
+                    buildGroup();
+
+                    if (!compacted.empty())
+                    {
+                        // Add a query to find the 'real' amount of memory needed, use for compaction
+                        std::vector<VkAccelerationStructureKHR> structures;
+                        structures.reserve(compacted.size());
+                        for (const auto& idx : compacted)
+                            structures.push_back(buildAs[idx].as.handle);
+
+                        vkCmdWriteAccelerationStructuresPropertiesKHR(commandBuffer, static_cast<uint32_t>(structures.size()), structures.data(),
+                            VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool, 0);
+                    }
+                    });
+
+                std::vector<AccelerationStructure> cleanupAS;  // previous AS to destroy
+                if (!compacted.empty())
                 {
-                    m_Device.SingleTimeCommand([&](VkCommandBuffer& commandBuffer) {
-                        uint32_t                    queryCtn{ 0 };
-                        std::vector<AccelerationStructure> cleanupAS;  // previous AS to destroy
+                    // the results are only there once the builds ran, this is where the batch waits on them
+                    std::vector<VkDeviceSize> compactSizes(compacted.size());
+                    vkGetQueryPoolResults(m_Device, queryPool, 0, (uint32_t)compactSizes.size(), compactSizes.size() * sizeof(VkDeviceSize),
+                        compactSizes.data(), sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
 
-                        // Get the compacted size result back
-                        std::vector<VkDeviceSize> compactSizes(static_cast<uint32_t>(indices.size()));
-                        vkGetQueryPoolResults(m_Device, queryPool, 0, (uint32_t)compactSizes.size(), compactSizes.size() * sizeof(VkDeviceSize),
-                            compactSizes.data(), sizeof(VkDeviceSize), VK_QUERY_RESULT_WAIT_BIT);
+                    m_Device.SubmitAsync([&](VkCommandBuffer& commandBuffer) {
+                        uint32_t                    queryCtn{ 0 };
 
-                        for (auto idx : indices)
+                        for (auto idx : compacted)
                         {
                             cleanupAS.emplace_back(buildAs[idx].as);
                             buildAs[idx].sizeInfo.accelerationStructureSize = compactSizes[queryCtn++];  // new reduced size
@@ -131,7 +271,7 @@ namespace CLAR {
                             VkAccelerationStructureCreateInfoKHR asCreateInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
                             asCreateInfo.size = buildAs[idx].sizeInfo.accelerationStructureSize;
                             asCreateInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-                            buildAs[idx].as = m_Allocator.CreateAccelerationStructure(asCreateInfo);
+                            buildAs[idx].as = m_Allocator.CreateAccelerationStructure(asCreateInfo, true);
 
                             // Copy the original BLAS to a compact version
                             VkCopyAccelerationStructureInfoKHR copyInfo{ VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR };
@@ -139,14 +279,26 @@ namespace CLAR {
                             copyInfo.dst = buildAs[idx].as.handle;
                             copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
                             vkCmdCopyAccelerationStructureKHR(commandBuffer, &copyInfo);
+
+                            m_CompactionStats.compactedCount++;
                         }
 
-                        for (const auto& as : cleanupAS)
-                            m_Allocator.DestroyAccelerationStructure(as);
+                        // the TLAS build and the traces read the copies
+                        VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+                        barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+                        barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+                        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                            0, 1, &barrier, 0, nullptr, 0, nullptr);
                         });
 
-                    //// Destroy the non-compacted version
-                    //destroyNonCompacted(indices, buildAs);
+                    // the copies read the non-compacted versions, nothing on the CPU waits for them
+                    for (const auto& as : cleanupAS)
+                    {
+                        m_DeletionQueue.Push([&allocator = m_Allocator, as]() {
+                            allocator.DestroyAccelerationStructure(as);
+                            });
+                    }
                 }
                 // Reset
 
@@ -155,18 +307,172 @@ namespace CLAR {
             }
         }
 
+        // the scratch is only used by the builds, a batch with compactions already waited on them for the queries
+        built.Wait();
         m_Allocator.DestroyBuffer(scratchBuffer);
+        if (queryPool)
+            vkDestroyQueryPool(m_Device, queryPool, nullptr);
+    }
 
-        return buildAs;
+    std::vector<uint32_t> RTBuilder::LoadCached(const std::vector<BlasInput>& allBlas, std::vector<ASBuildInfo>& buildAs)
+    {
+        std::vector<uint32_t> toBuild;
+        std::vector<std::pair<uint32_t, AsCacheEntry>> cached;
+        for (uint32_t i = 0; i < allBlas.size(); i++)
+        {
+            AsCacheEntry entry;
+            if (m_Cache && allBlas[i].cacheKey != 0 && m_Cache->Load(allBlas[i].cacheKey, entry))
+                cached.emplace_back(i, std::move(entry));
+            else
+                toBuild.push_back(i);
+        }
+        if (cached.empty())
+            return toBuild;
+
+        // every blob gets its own range of one host visible buffer, the copies read it from there
+        constexpr VkDeviceSize serializedAlignment = 256;
+        std::vector<VkDeviceSize> offsets;
+        VkDeviceSize stagingSize = 0;
+        for (const auto& [_, entry] : cached)
+        {
+            offsets.push_back(stagingSize);
+            stagingSize = AlignUp(stagingSize + entry.blob.size(), serializedAlignment);
+        }
+
+        Buffer staging = m_Allocator.CreateBuffer(stagingSize + serializedAlignment, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, MemoryCategory::Staging);
+        VkDeviceAddress stagingAddress = m_Device.GetBufferDeviceAddress(staging.buffer);
+        VkDeviceSize stagingBase = AlignUp(stagingAddress, serializedAlignment) - stagingAddress;
+        for (size_t c = 0; c < cached.size(); c++)
+            staging.Write(cached[c].second.blob.data(), cached[c].second.blob.size(), stagingBase + offsets[c]);
+        m_Allocator.Flush(staging, 0, VK_WHOLE_SIZE);
+
+        m_Device.SubmitAsync([&](VkCommandBuffer commandBuffer) {
+            for (size_t c = 0; c < cached.size(); c++)
+            {
+                auto& [idx, entry] = cached[c];
+
+                VkAccelerationStructureCreateInfoKHR createInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR };
+                createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+                createInfo.size = entry.deserializedSize;
+
+                buildAs[idx].blasId = allBlas[idx].modelId;
+                buildAs[idx].lod = allBlas[idx].lod;
+                buildAs[idx].rangeInfo = allBlas[idx].asBuildOffset;
+                buildAs[idx].sizeInfo.accelerationStructureSize = entry.deserializedSize;
+                buildAs[idx].builtSize = entry.deserializedSize;
+                buildAs[idx].as = m_Allocator.CreateAccelerationStructure(createInfo, true);
+
+                VkCopyMemoryToAccelerationStructureInfoKHR copyInfo{ VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR };
+                copyInfo.src.deviceAddress = stagingAddress + stagingBase + offsets[c];
+                copyInfo.dst = buildAs[idx].as.handle;
+                copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR;
+                vkCmdCopyMemoryToAccelerationStructureKHR(commandBuffer, &copyInfo);
+            }
+
+            // the TLAS build and the traces read them
+            VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+            barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+            barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                0, 1, &barrier, 0, nullptr, 0, nullptr);
+            });
+
+        m_DeletionQueue.Push([&allocator = m_Allocator, staging]() {
+            allocator.DestroyBuffer(staging);
+            });
+
+        m_CompactionStats.cachedCount = static_cast<uint32_t>(cached.size());
+        return toBuild;
     }
 
-    AccelerationStructure RTBuilder::BuildTlas(const std::vector<VkAccelerationStructureInstanceKHR>& instances) const
+    void RTBuilder::StoreCached(const std::vector<BlasInput>& allBlas, const std::vector<uint32_t>& built, std::vector<ASBuildInfo>& buildAs)
     {
-        uint32_t countInstance = static_cast<uint32_t>(instances.size());
-        Buffer instanceBuffer = m_Allocator.CreateBuffer(instances, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
-        Buffer scratchBuffer;
+        std::vector<uint32_t> indices;
+        for (uint32_t idx : built)
+        {
+            if (m_Cache && allBlas[idx].cacheKey != 0)
+                indices.push_back(idx);
+        }
+        if (indices.empty())
+            return;
+
+        // only happens on the first run over new geometry, so everything here waits
+        VkQueryPool queryPool{ VK_NULL_HANDLE };
+        VkQueryPoolCreateInfo qpci{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        qpci.queryCount = static_cast<uint32_t>(indices.size());
+        qpci.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR;
+        vkCreateQueryPool(m_Device, &qpci, nullptr, &queryPool);
+        vkResetQueryPool(m_Device, queryPool, 0, qpci.queryCount);
+
+        std::vector<VkAccelerationStructureKHR> structures;
+        for (uint32_t idx : indices)
+            structures.push_back(buildAs[idx].as.handle);
+
+        m_Device.SubmitAsync([&](VkCommandBuffer commandBuffer) {
+            vkCmdWriteAccelerationStructuresPropertiesKHR(commandBuffer, static_cast<uint32_t>(structures.size()), structures.data(),
+                VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR, queryPool, 0);
+            });
+
+        std::vector<VkDeviceSize> serializedSizes(indices.size());
+        vkGetQueryPoolResults(m_Device, queryPool, 0, qpci.queryCount, serializedSizes.size() * sizeof(VkDeviceSize),
+            serializedSizes.data(), sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        vkDestroyQueryPool(m_Device, queryPool, nullptr);
+
+        constexpr VkDeviceSize serializedAlignment = 256;
+        std::vector<VkDeviceSize> offsets;
+        VkDeviceSize readbackSize = 0;
+        for (VkDeviceSize size : serializedSizes)
+        {
+            offsets.push_back(readbackSize);
+            readbackSize = AlignUp(readbackSize + size, serializedAlignment);
+        }
+
+        Buffer readback = m_Allocator.CreateBuffer(readbackSize + serializedAlignment, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, MemoryCategory::Staging);
+        VkDeviceAddress readbackAddress = m_Device.GetBufferDeviceAddress(readback.buffer);
+        VkDeviceSize readbackBase = AlignUp(readbackAddress, serializedAlignment) - readbackAddress;
+
+        m_Device.SubmitAsync([&](VkCommandBuffer commandBuffer) {
+            for (size_t i = 0; i < indices.size(); i++)
+            {
+                VkCopyAccelerationStructureToMemoryInfoKHR copyInfo{ VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR };
+                copyInfo.src = structures[i];
+                copyInfo.dst.deviceAddress = readbackAddress + readbackBase + offsets[i];
+                copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR;
+                vkCmdCopyAccelerationStructureToMemoryKHR(commandBuffer, &copyInfo);
+            }
 
-        AccelerationStructure tlas;
+            VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_HOST_BIT,
+                0, 1, &barrier, 0, nullptr, 0, nullptr);
+            }).Wait();
+
+        m_Allocator.Invalidate(readback, 0, VK_WHOLE_SIZE);
+        const uint8_t* data = static_cast<const uint8_t*>(readback.allocationInfo.pMappedData) + readbackBase;
+        for (size_t i = 0; i < indices.size(); i++)
+            m_Cache->Store(allBlas[indices[i]].cacheKey, { data + offsets[i], serializedSizes[i] });
+
+        m_Allocator.DestroyBuffer(readback);
+    }
+
+    TopLevelAS RTBuilder::BuildTlas(const std::vector<VkAccelerationStructureInstanceKHR>& instances, std::span<const InstanceBounds> bounds) const
+    {
+        uint32_t countInstance = static_cast<uint32_t>(instances.size());
+        VkDeviceSize scratchAlignment = m_AsProperties.minAccelerationStructureScratchOffsetAlignment;
+
+        TopLevelAS tlas;
+        tlas.instances = instances;
+        tlas.localBounds.assign(bounds.begin(), bounds.end());
+        TrackBuild(tlas);
+        // kept for the updates, which copy the changed instances into it
+        tlas.instanceBuffer = m_Allocator.CreateBuffer(instances, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+            0, MemoryCategory::AccelerationStructure);
+        tlas.instanceAddress = m_Device.GetBufferDeviceAddress(tlas.instanceBuffer.buffer);
+        m_Allocator.FlushUploads();
 
         m_Device.SingleTimeCommand([&](VkCommandBuffer commandBuffer)
             {
@@ -178,7 +484,7 @@ namespace CLAR {
 
                 // Wraps a device pointer to the above uploaded instances.
                 VkAccelerationStructureGeometryInstancesDataKHR instancesVk{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR };
-                instancesVk.data.deviceAddress = m_Device.GetBufferDeviceAddress(instanceBuffer.buffer);
+                instancesVk.data.deviceAddress = tlas.instanceAddress;
 
                 // Put the above into a VkAccelerationStructureGeometryKHR. We need to put the instances struct in a union and label it as instance data.
                 VkAccelerationStructureGeometryKHR topASGeometry{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
@@ -203,15 +509,18 @@ namespace CLAR {
                 createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
                 createInfo.size = sizeInfo.accelerationStructureSize;
 
-                tlas = m_Allocator.CreateAccelerationStructure(createInfo);
+                tlas.as = m_Allocator.CreateAccelerationStructure(createInfo);
 
-                // Build the TLAS
-                scratchBuffer = m_Allocator.CreateBuffer(sizeInfo.buildScratchSize, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+                // Build the TLAS, the refits and rebuilds of UpdateTlas reuse the scratch
+                VkDeviceSize scratchSize = std::max(sizeInfo.buildScratchSize, sizeInfo.updateScratchSize);
+                tlas.scratch = m_Allocator.CreateBuffer(scratchSize + scratchAlignment, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                    0, MemoryCategory::AccelerationStructure);
+                tlas.scratchAddress = AlignUp(m_Device.GetBufferDeviceAddress(tlas.scratch.buffer), scratchAlignment);
 
                 // Update build information
                 buildInfo.srcAccelerationStructure = VK_NULL_HANDLE;
-                buildInfo.dstAccelerationStructure = tlas.handle;
-                buildInfo.scratchData.deviceAddress = m_Device.GetBufferDeviceAddress(scratchBuffer.buffer);
+                buildInfo.dstAccelerationStructure = tlas.as.handle;
+                buildInfo.scratchData.deviceAddress = tlas.scratchAddress;
 
                 // Build Offsets info: n instances
                 VkAccelerationStructureBuildRangeInfoKHR buildOffsetInfo{ countInstance, 0, 0, 0 };
@@ -222,93 +531,146 @@ namespace CLAR {
 
             });
 
-        m_Allocator.DestroyBuffer(scratchBuffer);
-        m_Allocator.DestroyBuffer(instanceBuffer);
-
         return tlas;
     }
 
-    AccelerationStructure RTBuilder::UpdateTlas(AccelerationStructure& tlas, const std::vector<VkAccelerationStructureInstanceKHR>& instances) const
+    void RTBuilder::TrackBuild(TopLevelAS& tlas) const
     {
-        uint32_t countInstance = static_cast<uint32_t>(instances.size());
-        Buffer instanceBuffer = m_Allocator.CreateBuffer(instances, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
-        Buffer scratchBuffer;
+        size_t count = tlas.instances.size();
+        tlas.currentBounds.resize(count);
+        tlas.joinedAreas.resize(count);
+        tlas.builtArea = 0.0f;
 
-        m_Device.SingleTimeCommand([&](VkCommandBuffer commandBuffer)
-            {
-                VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
-                barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-                barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
-                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
-                    0, 1, &barrier, 0, nullptr, 0, nullptr);
-
-                // Wraps a device pointer to the updated instances.
-                VkAccelerationStructureGeometryInstancesDataKHR instancesVk{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR };
-                instancesVk.data.deviceAddress = m_Device.GetBufferDeviceAddress(instanceBuffer.buffer);
-
-                // Put the above into a VkAccelerationStructureGeometryKHR.
-                VkAccelerationStructureGeometryKHR topASGeometry{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
-                topASGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
-                topASGeometry.geometry.instances = instancesVk;
-
-                // Update build info
-                VkAccelerationStructureBuildGeometryInfoKHR buildInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
-                buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
-                    VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
-                buildInfo.geometryCount = 1;
-                buildInfo.pGeometries = &topASGeometry;
-                buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
-                buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-                buildInfo.srcAccelerationStructure = tlas.handle;
-                buildInfo.dstAccelerationStructure = tlas.handle;
-
-                VkAccelerationStructureBuildSizesInfoKHR sizeInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
-                vkGetAccelerationStructureBuildSizesKHR(m_Device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo,
-                    &countInstance, &sizeInfo);
+        InstanceBounds scene{ glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+        for (size_t i = 0; i < count; i++)
+        {
+            tlas.currentBounds[i] = TransformBounds(tlas.localBounds[i], tlas.instances[i].transform);
+            tlas.joinedAreas[i] = SurfaceArea(tlas.currentBounds[i]);
+            tlas.builtArea += tlas.joinedAreas[i];
+            scene = Join(scene, tlas.currentBounds[i]);
+        }
+        tlas.builtBounds = tlas.currentBounds;
+        tlas.joinedArea = tlas.builtArea;
+        tlas.sceneDiagonal = count > 0 ? glm::length(scene.max - scene.min) : 0.0f;
 
-                // Allocate scratch buffer for update
-                scratchBuffer = m_Allocator.CreateBuffer(sizeInfo.buildScratchSize, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-                buildInfo.scratchData.deviceAddress = m_Device.GetBufferDeviceAddress(scratchBuffer.buffer);
+        tlas.stats.refitsSinceBuild = 0;
+        tlas.stats.boundsGrowth = 1.0f;
+        tlas.stats.motion = 0.0f;
+    }
 
-                // Build Offsets info: n instances
-                VkAccelerationStructureBuildRangeInfoKHR buildOffsetInfo{ countInstance, 0, 0, 0 };
-                const VkAccelerationStructureBuildRangeInfoKHR* pBuildOffsetInfo = &buildOffsetInfo;
+    bool RTBuilder::UpdateTlas(VkCommandBuffer commandBuffer, TopLevelAS& tlas, std::span<const VkAccelerationStructureInstanceKHR> instances,
+        FrameAllocator& frameAllocator) const
+    {
+        assert(instances.size() == tlas.instances.size());  // an update cannot add or remove instances
+        constexpr VkDeviceSize instanceSize = sizeof(VkAccelerationStructureInstanceKHR);
 
-                // Perform the TLAS update
-                vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildInfo, &pBuildOffsetInfo);
-            });
+        // the changed instances, packed, and one copy per run of neighbours among them
+        std::vector<VkAccelerationStructureInstanceKHR> dirty;
+        std::vector<VkBufferCopy> regions;
+        for (size_t i = 0; i < instances.size(); i++)
+        {
+            if (memcmp(&instances[i], &tlas.instances[i], instanceSize) == 0)
+                continue;
+
+            VkDeviceSize dstOffset = i * instanceSize;
+            if (!regions.empty() && regions.back().dstOffset + regions.back().size == dstOffset)
+                regions.back().size += instanceSize;
+            else
+                regions.push_back({ dirty.size() * instanceSize, dstOffset, instanceSize });
+
+            dirty.push_back(instances[i]);
+            tlas.instances[i] = instances[i];
+
+            // the refitted node holding the instance has to cover both where it was built and where it is now
+            InstanceBounds bounds = TransformBounds(tlas.localBounds[i], instances[i].transform);
+            glm::vec3 previousCenter = (tlas.currentBounds[i].min + tlas.currentBounds[i].max) * 0.5f;
+            tlas.stats.motion += glm::length((bounds.min + bounds.max) * 0.5f - previousCenter) / std::max(tlas.sceneDiagonal, FLT_MIN);
+
+            float joinedArea = SurfaceArea(Join(tlas.builtBounds[i], bounds));
+            tlas.joinedArea += joinedArea - tlas.joinedAreas[i];
+            tlas.joinedAreas[i] = joinedArea;
+            tlas.currentBounds[i] = bounds;
+        }
+        if (dirty.empty())
+            return false;
+
+        tlas.stats.boundsGrowth = tlas.builtArea > 0.0f ? tlas.joinedArea / tlas.builtArea : 1.0f;
+        bool rebuild = tlas.stats.boundsGrowth > m_TlasPolicy.maxBoundsGrowth || tlas.stats.motion > m_TlasPolicy.maxMotion ||
+            (m_TlasPolicy.maxRefits > 0 && tlas.stats.refitsSinceBuild >= m_TlasPolicy.maxRefits);
+
+        FrameAllocation staged = frameAllocator.Push(dirty);
+        for (auto& region : regions)
+            region.srcOffset += staged.offset;
+
+        // the previous frame's update may still read the instances and use the scratch, its traces read the TLAS
+        VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+        barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+            VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        vkCmdCopyBuffer(commandBuffer, staged.buffer, tlas.instanceBuffer.buffer, static_cast<uint32_t>(regions.size()), regions.data());
+
+        VkMemoryBarrier copied{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+        copied.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        copied.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            0, 1, &copied, 0, nullptr, 0, nullptr);
+
+        // Wraps a device pointer to the updated instances.
+        VkAccelerationStructureGeometryInstancesDataKHR instancesVk{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR };
+        instancesVk.data.deviceAddress = tlas.instanceAddress;
+
+        // Put the above into a VkAccelerationStructureGeometryKHR.
+        VkAccelerationStructureGeometryKHR topASGeometry{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
+        topASGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+        topASGeometry.geometry.instances = instancesVk;
+
+        // Update build info, a rebuild writes a new tree over the old one, sizes stay the same with the instance count
+        VkAccelerationStructureBuildGeometryInfoKHR buildInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
+        buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
+            VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+        buildInfo.geometryCount = 1;
+        buildInfo.pGeometries = &topASGeometry;
+        buildInfo.mode = rebuild ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+        buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+        buildInfo.srcAccelerationStructure = rebuild ? VK_NULL_HANDLE : tlas.as.handle;
+        buildInfo.dstAccelerationStructure = tlas.as.handle;
+        buildInfo.scratchData.deviceAddress = tlas.scratchAddress;
+
+        // Build Offsets info: n instances
+        VkAccelerationStructureBuildRangeInfoKHR buildOffsetInfo{ static_cast<uint32_t>(instances.size()), 0, 0, 0 };
+        const VkAccelerationStructureBuildRangeInfoKHR* pBuildOffsetInfo = &buildOffsetInfo;
+
+        // Perform the TLAS update
+        vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildInfo, &pBuildOffsetInfo);
+
+        if (rebuild)
+        {
+            tlas.stats.rebuilds++;
+            TrackBuild(tlas);
+        }
+        else
+        {
+            tlas.stats.refits++;
+            tlas.stats.refitsSinceBuild++;
+        }
 
-        m_Allocator.DestroyBuffer(scratchBuffer);
-        m_Allocator.DestroyBuffer(instanceBuffer);
+        // and make it visible to the traces recorded after it
+        VkMemoryBarrier built{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+        built.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        built.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+            0, 1, &built, 0, nullptr, 0, nullptr);
 
-        return tlas;
+        return true;
     }
 
-	BlasInput RTBuilder::ModelToVkgeometry(const Model* model)
+    void RTBuilder::DestroyTlas(const TopLevelAS& tlas) const
     {
-        VkAccelerationStructureGeometryTrianglesDataKHR triangles{};
-        triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
-        triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-        triangles.vertexData.deviceAddress = m_Device.GetBufferDeviceAddress(model->m_VertexBuffer.buffer);
-        triangles.vertexStride = sizeof(Vertex);
-        triangles.maxVertex = static_cast<uint32_t>(model->mesh.size()) - 1;
-        triangles.indexType = VK_INDEX_TYPE_UINT32;
-        triangles.indexData.deviceAddress = m_Device.GetBufferDeviceAddress(model->m_IndexBuffer.buffer);
-        triangles.transformData = {};
-
-        VkAccelerationStructureGeometryKHR asGeom{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
-        asGeom.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
-        asGeom.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
-        asGeom.geometry.triangles = triangles;
-
-        VkAccelerationStructureBuildRangeInfoKHR offset;
-        offset.firstVertex = 0;
-        offset.primitiveCount = static_cast<uint32_t>(model->indices.size()) / 3;
-        offset.primitiveOffset = 0;
-        offset.transformOffset = 0;
-
-        return { model->id, asGeom, offset };
+        m_Allocator.DestroyAccelerationStructure(tlas.as);
+        m_Allocator.DestroyBuffer(tlas.instanceBuffer);
+        m_Allocator.DestroyBuffer(tlas.scratch);
     }
 
-
 }
\ No newline at end of file
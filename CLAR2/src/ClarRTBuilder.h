@@ -1,29 +1,42 @@
 #pragma once
 
+#include <optional>
+
 #include "clar_device.h"
 #include "ClarAllocator.h"
+#include "ClarAsCache.h"
+#include "ClarDeletionQueue.h"
+#include "ClarFrameAllocator.h"
 #include "ClarModel.h"
 #include <glm/gtx/quaternion.hpp>
+#include <glm/gtx/matrix_decompose.hpp>
 #include "ClarMaterial.h"
 
 namespace CLAR {
 
+	// One geometry per submesh, the hit shader tells them apart with gl_GeometryIndexEXT
 	struct BlasInput {
 		uint32_t modelId;
-		VkAccelerationStructureGeometryKHR asGeometry;
-		VkAccelerationStructureBuildRangeInfoKHR asBuildOffset;
+		uint32_t lod;
+		std::vector<VkAccelerationStructureGeometryKHR> asGeometry;
+		std::vector<VkAccelerationStructureBuildRangeInfoKHR> asBuildOffset;
+		// Static geometry is copied into a structure of its compacted size after the build. Turn it off for
+		// a BLAS that will be updated or rebuilt often, the copy is not worth it there.
+		bool compact = true;
+		uint64_t cacheKey = 0;	// AsCache::GeometryKey of the input, 0 always builds
 	};
 
 	struct ASBuildInfo {
 		uint32_t blasId;
+		uint32_t lod;
 		VkAccelerationStructureBuildGeometryInfoKHR buildInfo;
-		VkAccelerationStructureBuildRangeInfoKHR rangeInfo;
-		VkAccelerationStructureBuildSizesInfoKHR sizeInfo;
+		std::vector<VkAccelerationStructureBuildRangeInfoKHR> rangeInfo;
+		VkAccelerationStructureBuildSizesInfoKHR sizeInfo;	// accelerationStructureSize is the compacted size once compacted
+		VkDeviceSize builtSize = 0;	// size the build asked for
 		AccelerationStructure as;
 
 		ASBuildInfo() {
 			buildInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR };
-			rangeInfo = {};
 			sizeInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
 			as = {};
 		}
@@ -36,6 +49,8 @@ namespace CLAR {
 		glm::vec3 scale;
 		glm::vec3 rotation; // in radians
 		uint32_t instanceCustomIndex;
+		uint32_t lod = 0; // level of model currently referenced by the TLAS, see Model::SelectLod
+		bool modelMaterials = false; // shade with the model's .mtl materials instead of material
 
 		glm::mat4 TransformMatrix() const {
 			glm::mat4 transform = glm::mat4(1.0f);
@@ -53,25 +68,124 @@ namespace CLAR {
 			return transform;
 		}
 
+		// Inverse of TransformMatrix, shear and projection are dropped
+		void SetTransform(const glm::mat4& transform) {
+			glm::quat orientation;
+			glm::vec3 skew;
+			glm::vec4 perspective;
+			glm::decompose(transform, scale, orientation, displacement, skew, perspective);
+			rotation = glm::degrees(glm::eulerAngles(orientation));
+		}
+
+	};
+
+	// Axis aligned box, in the object space of a BLAS or in world space
+	struct InstanceBounds {
+		glm::vec3 min;
+		glm::vec3 max;
+	};
+
+	// When UpdateTlas rebuilds the TLAS instead of refitting it. A refit keeps the tree of the last build and only
+	// grows its boxes, so instances that moved away from where they were built leave large, overlapping nodes behind.
+	struct TlasRebuildPolicy {
+		// summed surface area of every instance's box joined with its box at the last build, over that of the latter
+		float maxBoundsGrowth = 1.5f;
+		// distance the instances travelled since the last build, summed over all of them, in scene diagonals
+		float maxMotion = 1.0f;
+		uint32_t maxRefits = 0;	// refits in a row, 0 for no limit
+	};
+
+	struct TlasStats {
+		uint64_t refits = 0;
+		uint64_t rebuilds = 0;		// by UpdateTlas, the first build is not counted
+		uint32_t refitsSinceBuild = 0;
+		float boundsGrowth = 1.0f;	// of the current tree, see TlasRebuildPolicy
+		float motion = 0.0f;
+	};
+
+	// TLAS updated in place. Its instances live in a persistent device local buffer and instances mirrors what that
+	// buffer holds, so an update copies only the entries that changed. The scratch, big enough for a build and an
+	// update, is kept along with it.
+	struct TopLevelAS {
+		AccelerationStructure as;
+		Buffer instanceBuffer;
+		Buffer scratch;
+		VkDeviceAddress instanceAddress = 0;
+		VkDeviceAddress scratchAddress = 0;	// aligned for the build
+		std::vector<VkAccelerationStructureInstanceKHR> instances;
+
+		// degradation tracking, per instance
+		std::vector<InstanceBounds> localBounds;
+		std::vector<InstanceBounds> builtBounds;	// world space, at the last build
+		std::vector<InstanceBounds> currentBounds;
+		std::vector<float> joinedAreas;			// of builtBounds joined with currentBounds
+		float builtArea = 0.0f;
+		float joinedArea = 0.0f;
+		float sceneDiagonal = 0.0f;
+		TlasStats stats;
+	};
+
+	// BLAS memory of the last BuildBlas, before and after compaction
+	struct BlasCompactionStats {
+		uint32_t blasCount = 0;
+		uint32_t compactedCount = 0;
+		uint32_t cachedCount = 0;	// deserialized from the AsCache, neither built nor compacted
+		VkDeviceSize builtBytes = 0;
+		VkDeviceSize compactedBytes = 0;
 	};
 
 	class RTBuilder {
 	public:
-		RTBuilder(Device& device, Allocator& allocator);
+		// Scratch memory the builds of BuildBlas may use at once
+		static constexpr VkDeviceSize DefaultScratchBudget = 64ull << 20;
+
+		RTBuilder(Device& device, Allocator& allocator, DeletionQueue& deletionQueue, VkDeviceSize scratchBudget = DefaultScratchBudget);
 		~RTBuilder();
 
+		// Records every batch of BLAS builds into a single command buffer. Each build gets its own range of the
+		// scratch buffer, so as many of them as fit the scratch budget run in one call and overlap on the GPU.
+		// The inputs asking for it are compacted, the structures they were built in go through the deletion queue.
+		// With a cache directory set, inputs with a cacheKey are deserialized from it when the driver accepts the
+		// blob, the others are built and then serialized into it.
 		std::vector<ASBuildInfo> BuildBlas(const std::vector<BlasInput>& allblas);
-		AccelerationStructure BuildTlas(const std::vector<VkAccelerationStructureInstanceKHR>& instances) const;
-		AccelerationStructure UpdateTlas(AccelerationStructure& tlas, const std::vector<VkAccelerationStructureInstanceKHR>& instances) const;
+		// Flags a BLAS is built with, part of its cache key
+		static VkBuildAccelerationStructureFlagsKHR BlasBuildFlags(bool compact);
+		// An empty directory turns the cache off
+		void SetCacheDirectory(const std::filesystem::path& directory);
+		bool HasCache() const { return m_Cache.has_value(); }
+		const BlasCompactionStats& GetCompactionStats() const { return m_CompactionStats; }
+		void SetScratchBudget(VkDeviceSize budget) { m_ScratchBudget = budget; }
+		// bounds holds the object space box of every instance's BLAS, for the rebuild policy
+		TopLevelAS BuildTlas(const std::vector<VkAccelerationStructureInstanceKHR>& instances, std::span<const InstanceBounds> bounds) const;
+		// Records the update into the frame's commandBuffer, ahead of the traces reading the TLAS. The instances that
+		// differ from tlas.instances are staged in frameAllocator and copied into the instance buffer, nothing is
+		// recorded when none did. The TLAS is refitted, or rebuilt in place once the policy says the refits degraded
+		// it too much. Either way the instance count stays the same.
+		bool UpdateTlas(VkCommandBuffer commandBuffer, TopLevelAS& tlas, std::span<const VkAccelerationStructureInstanceKHR> instances,
+			FrameAllocator& frameAllocator) const;
+		void DestroyTlas(const TopLevelAS& tlas) const;
+		void SetTlasRebuildPolicy(const TlasRebuildPolicy& policy) { m_TlasPolicy = policy; }
+		const TlasRebuildPolicy& GetTlasRebuildPolicy() const { return m_TlasPolicy; }
 
 	private:
 		Device& m_Device;
 		Allocator& m_Allocator;
+		DeletionQueue& m_DeletionQueue;
 		VkPhysicalDeviceRayTracingPipelinePropertiesKHR m_rtProperties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR };
+		VkPhysicalDeviceAccelerationStructurePropertiesKHR m_AsProperties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR };
+		VkDeviceSize m_ScratchBudget;
+		BlasCompactionStats m_CompactionStats;
+		std::optional<AsCache> m_Cache;
+		TlasRebuildPolicy m_TlasPolicy;
 		/*std::vector<ASBuildInfo> buildAs;
 		AccelerationStructure m_Tlas;*/
 
-		BlasInput ModelToVkgeometry(const Model* model);
+		void BuildBatches(const std::vector<BlasInput>& allBlas, const std::vector<uint32_t>& toBuild, std::vector<ASBuildInfo>& buildAs);
+		// Deserializes the cached inputs into buildAs, returns the indices of those left to build
+		std::vector<uint32_t> LoadCached(const std::vector<BlasInput>& allBlas, std::vector<ASBuildInfo>& buildAs);
+		// Resets the degradation tracking of tlas to its current instances, after a build
+		void TrackBuild(TopLevelAS& tlas) const;
+		void StoreCached(const std::vector<BlasInput>& allBlas, const std::vector<uint32_t>& built, std::vector<ASBuildInfo>& buildAs);
         
 	};
 }
@@ -36,10 +36,10 @@ namespace CLAR {
 		m_RaytracingPipeline->Init(builder);
 	}
 
-	void RayTracingSystem::Prepare(const VkCommandBuffer commandBuffer, const std::vector<VkDescriptorSet>& descriptorSet) const
+	void RayTracingSystem::Prepare(const VkCommandBuffer commandBuffer, const std::vector<VkDescriptorSet>& descriptorSet, std::span<const uint32_t> dynamicOffsets) const
 	{
 		m_RaytracingPipeline->Bind(commandBuffer);
-		BindDescSet(commandBuffer, descriptorSet);
+		BindDescSet(commandBuffer, descriptorSet, dynamicOffsets);
 	}
 
 	void RayTracingSystem::BindPL(VkCommandBuffer commandBuffer) const
@@ -47,9 +47,10 @@ namespace CLAR {
 		m_RaytracingPipeline->Bind(commandBuffer);
 	}
 
-	void RayTracingSystem::BindDescSet(VkCommandBuffer commandBuffer, const std::vector<VkDescriptorSet>& descriptorSet) const
+	void RayTracingSystem::BindDescSet(VkCommandBuffer commandBuffer, const std::vector<VkDescriptorSet>& descriptorSet, std::span<const uint32_t> dynamicOffsets) const
 	{
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_RaytracingPipelineLayout, 0, static_cast<uint32_t>(descriptorSet.size()), descriptorSet.data(), 0, nullptr);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_RaytracingPipelineLayout, 0, static_cast<uint32_t>(descriptorSet.size()), descriptorSet.data(),
+			static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
 	}
 
 	void RayTracingSystem::CreatePipelineLayout(const std::vector<VkDescriptorSetLayout>& descriptorSetLayout)
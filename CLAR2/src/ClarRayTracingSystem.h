@@ -3,6 +3,8 @@
 #include "ClarRayTracingPipeline.h"
 #include "ClarDescriptors.h"
 
+#include <span>
+
 namespace CLAR {
 	struct PushConstantRay
 	{
@@ -22,10 +24,11 @@ namespace CLAR {
 		void CreatePipelineLayout(const std::vector<VkDescriptorSetLayout>& descriptorSetLayout);
 		void CreatePipeline();
 
-		void Prepare(const VkCommandBuffer commandBuffer, const std::vector<VkDescriptorSet>& descriptorSet) const;
+		// dynamicOffsets holds the offsets of all sets' dynamic bindings, in set and then binding order
+		void Prepare(const VkCommandBuffer commandBuffer, const std::vector<VkDescriptorSet>& descriptorSet, std::span<const uint32_t> dynamicOffsets = {}) const;
 
 		void BindPL(VkCommandBuffer commandBuffer) const;
-		void BindDescSet(VkCommandBuffer commandBuffer, const std::vector<VkDescriptorSet>& descriptorSet) const;
+		void BindDescSet(VkCommandBuffer commandBuffer, const std::vector<VkDescriptorSet>& descriptorSet, std::span<const uint32_t> dynamicOffsets = {}) const;
 		VkResult GetRayTracingShaderGroupHandles(uint32_t groupCount, size_t dataSize, void* pData) const { return vkGetRayTracingShaderGroupHandlesKHR(m_Device, *m_RaytracingPipeline, 0, groupCount, dataSize, pData); };
 		void PushConstants(VkCommandBuffer commandBuffer, const PushConstantRay& pcRay) const { vkCmdPushConstants(commandBuffer, m_RaytracingPipelineLayout, VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstantRay), &pcRay); }
 
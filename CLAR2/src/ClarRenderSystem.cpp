@@ -43,7 +43,13 @@ namespace CLAR {
         PipelineBuilder builder(m_Device, renderPass, extent);
         builder.SetVertexShaders(vertShaderPath);
         builder.SetFragmentShaders(fragShaderPath);
-        builder.SetVertexInputDescription(Vertex::getBindingDescription(), Vertex::getAttributeDescriptions());
+        // shader.vert only reads position, normal and uv, so the packed layouts go without the color stream
+        if constexpr (GpuVertexFormat == VertexFormat::Split)
+            builder.SetVertexInputDescription(VertexAttributes::getBindingDescriptions(false), VertexAttributes::getAttributeDescriptions(false));
+        else if constexpr (GpuVertexFormat == VertexFormat::Packed)
+            builder.SetVertexInputDescription(PackedVertex::getBindingDescriptions(false), PackedVertex::getAttributeDescriptions(false));
+        else
+            builder.SetVertexInputDescription(Vertex::getBindingDescription(), Vertex::getAttributeDescriptions());
         builder.SetCullMode(VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE);
         builder.SetInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
         builder._pipelineLayout = m_PipelineLayout;
@@ -56,15 +62,16 @@ namespace CLAR {
         m_Pipeline->Bind(commandBuffer);
     }
 
-    void RenderSystem::BindDescSet(VkCommandBuffer commandBuffer, const VkDescriptorSet* descriptorSet) const
+    void RenderSystem::BindDescSet(VkCommandBuffer commandBuffer, const VkDescriptorSet* descriptorSet, std::span<const uint32_t> dynamicOffsets) const
     {
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_PipelineLayout, 0, 1, descriptorSet, 0, nullptr);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_PipelineLayout, 0, 1, descriptorSet,
+            static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
     }
 
-    void RenderSystem::Prepare(const VkCommandBuffer commandBuffer, const VkDescriptorSet* descriptorSet) const
+    void RenderSystem::Prepare(const VkCommandBuffer commandBuffer, const VkDescriptorSet* descriptorSet, std::span<const uint32_t> dynamicOffsets) const
     {
         BindPL(commandBuffer);
-        BindDescSet(commandBuffer, descriptorSet);
+        BindDescSet(commandBuffer, descriptorSet, dynamicOffsets);
     }
 
 }
@@ -3,21 +3,24 @@
 #include "ClarGraphicsPipeline.h"
 #include "ClarDescriptors.h"
 
+#include <span>
+
 namespace CLAR {
 	class RenderSystem {
 	public:
 		RenderSystem(Device& device);
 		virtual ~RenderSystem();
 
-		void Init(const VkDescriptorSetLayout* descriptorSetLayout, VkRenderPass renderPass, VkExtent2D extent, const std::filesystem::path& vertShaderPath = "shaders/vert.spv", const std::filesystem::path& fragShaderPath = "shaders/frag.spv");
+		void Init(const VkDescriptorSetLayout* descriptorSetLayout, VkRenderPass renderPass, VkExtent2D extent, const std::filesystem::path& vertShaderPath = "shaders/shader.vert.spv", const std::filesystem::path& fragShaderPath = "shaders/shader.frag.spv");
 
 		virtual void CreatePipelineLayout(const VkDescriptorSetLayout* descriptorSetLayout);
-		virtual void CreatePipeline(VkRenderPass renderPass, VkExtent2D extent, const std::filesystem::path& vertShaderPath = "shaders/vert.spv", const std::filesystem::path& fragShaderPath = "shaders/frag.spv");
+		virtual void CreatePipeline(VkRenderPass renderPass, VkExtent2D extent, const std::filesystem::path& vertShaderPath = "shaders/shader.vert.spv", const std::filesystem::path& fragShaderPath = "shaders/shader.frag.spv");
 
-		virtual void Prepare(const VkCommandBuffer commandBuffer, const VkDescriptorSet* descriptorSet) const;
+		// one dynamic offset per dynamic binding of the set, in binding order
+		virtual void Prepare(const VkCommandBuffer commandBuffer, const VkDescriptorSet* descriptorSet, std::span<const uint32_t> dynamicOffsets = {}) const;
 
 		void BindPL(VkCommandBuffer commandBuffer) const;
-		void BindDescSet(VkCommandBuffer commandBuffer, const VkDescriptorSet* descriptorSet) const;
+		void BindDescSet(VkCommandBuffer commandBuffer, const VkDescriptorSet* descriptorSet, std::span<const uint32_t> dynamicOffsets = {}) const;
 
 	protected:
 		Device& m_Device;
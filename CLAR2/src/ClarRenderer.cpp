@@ -33,6 +33,11 @@ namespace CLAR {
 	VkCommandBuffer Renderer::BeginFrame()
 	{
 		auto result = m_SwapChain->AcquireNextImage(&currentImageIndex);
+
+		// the fence just waited on belongs to the frame that used this slot before
+		if (m_DeletionQueue.CurrentFrame() >= MAX_FRAMES_IN_FLIGHT)
+			m_DeletionQueue.Retire(m_DeletionQueue.CurrentFrame() - MAX_FRAMES_IN_FLIGHT);
+
 		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
 			RecreateSwapChain();
 			return VK_NULL_HANDLE;
@@ -139,6 +144,7 @@ namespace CLAR {
 		}
 
 		m_SwapChain->NextFrame();
+		m_DeletionQueue.EndFrame();
 		currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
 	}
 
@@ -223,6 +229,7 @@ namespace CLAR {
 		}
 
 		vkDeviceWaitIdle(m_Device);
+		m_DeletionQueue.Retire(m_DeletionQueue.CurrentFrame());
 		if (m_SwapChain == nullptr) {
 			m_SwapChain = std::make_unique<SwapChain>(m_Device);
 		}
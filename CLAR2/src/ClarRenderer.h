@@ -2,6 +2,7 @@
 
 #include "clar_device.h"
 #include "clar_swap_chain.h"
+#include "ClarDeletionQueue.h"
 
 namespace CLAR {
 	class Renderer {
@@ -33,6 +34,8 @@ namespace CLAR {
 		size_t GetSwapChainImageCount() const { return m_SwapChain->m_SwapChainImages.size(); }
 		size_t GetCurrentFrame() const { return currentFrame; }
 		bool IsComputeEnabled() const { return computeEnabled; }
+		// Deletions are run once the frame that pushed them has retired
+		DeletionQueue& GetDeletionQueue() { return m_DeletionQueue; }
 		/*void EnableCompute();
 		void DisableCompute();*/
 
@@ -44,6 +47,7 @@ namespace CLAR {
 		std::unique_ptr<SwapChain> m_SwapChain;
 		std::vector<VkCommandBuffer> m_CommandBuffers;
 		std::vector<VkCommandBuffer> computeCommandBuffers;
+		DeletionQueue m_DeletionQueue;
 
 		void RecreateSwapChain();
 		void CreateCommandBuffers();
@@ -3,8 +3,75 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+
 namespace CLAR {
 
+    // textures shrunk to stay in budget stop here, anything smaller is not worth the blur
+    static constexpr int MinBudgetExtent = 64;
+
+    static VkDeviceSize MipChainBytes(int width, int height, uint32_t mipLevels, VkDeviceSize texelSize)
+    {
+        VkDeviceSize bytes = 0;
+        for (uint32_t level = 0; level < mipLevels; level++)
+        {
+            bytes += VkDeviceSize(width) * height * texelSize;
+            width = std::max(width / 2, 1);
+            height = std::max(height / 2, 1);
+        }
+        return bytes;
+    }
+
+    static const std::array<float, 256>& SrgbToLinear()
+    {
+        static const std::array<float, 256> table = [] {
+            std::array<float, 256> linear;
+            for (int i = 0; i < 256; i++)
+            {
+                float c = i / 255.0f;
+                linear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            return linear;
+        }();
+        return table;
+    }
+
+    static stbi_uc LinearToSrgb(float c)
+    {
+        c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+        return static_cast<stbi_uc>(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+
+    // 2x2 box filter of tightly packed sRGB RGBA8 texels, what the first mip blit would have produced: the
+    // colors are averaged in linear space like the blit does for an sRGB format, alpha is linear already
+    static std::vector<stbi_uc> HalveRgba(const stbi_uc* texels, int width, int height)
+    {
+        const std::array<float, 256>& linear = SrgbToLinear();
+
+        int halfWidth = std::max(width / 2, 1);
+        int halfHeight = std::max(height / 2, 1);
+        std::vector<stbi_uc> half(size_t(halfWidth) * halfHeight * 4);
+
+        for (int y = 0; y < halfHeight; y++)
+        {
+            int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+            for (int x = 0; x < halfWidth; x++)
+            {
+                int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+                const stbi_uc* corners[4] = { &texels[(size_t(y0) * width + x0) * 4], &texels[(size_t(y0) * width + x1) * 4],
+                    &texels[(size_t(y1) * width + x0) * 4], &texels[(size_t(y1) * width + x1) * 4] };
+                stbi_uc* out = &half[(size_t(y) * halfWidth + x) * 4];
+
+                for (int c = 0; c < 3; c++)
+                    out[c] = LinearToSrgb((linear[corners[0][c]] + linear[corners[1][c]] + linear[corners[2][c]] + linear[corners[3][c]]) * 0.25f);
+                out[3] = static_cast<stbi_uc>((corners[0][3] + corners[1][3] + corners[2][3] + corners[3][3] + 2) / 4);
+            }
+        }
+        return half;
+    }
+
 	TextureManager::TextureManager(Device& device, Allocator& allcator)
 		: m_Device(device), m_Allocator(allcator)
 	{
@@ -37,7 +104,6 @@ namespace CLAR {
         int texWidth, texHeight, texChannels;
         uint32_t mipLevels = 1;
         stbi_uc* pixels = stbi_load(path.string().c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-        VkDeviceSize imageSize = texWidth * texHeight * 4;
 
         if (!pixels) {
             throw std::runtime_error("failed to load texture image!");
@@ -46,19 +112,38 @@ namespace CLAR {
         if (generateMipMaps)
             mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
 
-        Buffer stagingBuffer = m_Allocator.CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
-        stagingBuffer.Write(pixels, static_cast<size_t>(imageSize));
+        // over budget the top mips are dropped: a texture at half resolution beats failing the allocation
+        std::vector<stbi_uc> reduced;
+        const stbi_uc* texels = pixels;
+        const VkDeviceSize fullBytes = MipChainBytes(texWidth, texHeight, mipLevels, 4);
+        uint32_t droppedLevels = 0;
+        while (!m_Allocator.FitsBudget(MipChainBytes(texWidth, texHeight, mipLevels, 4)) && std::min(texWidth, texHeight) / 2 >= MinBudgetExtent)
+        {
+            reduced = HalveRgba(texels, texWidth, texHeight);
+            texels = reduced.data();
+            texWidth /= 2;
+            texHeight /= 2;
+            mipLevels = std::max(mipLevels - 1, 1u);
+            droppedLevels++;
+        }
+        if (droppedLevels > 0)
+        {
+            m_BudgetStats.shrunkCount++;
+            m_BudgetStats.droppedLevels += droppedLevels;
+            m_BudgetStats.savedBytes += fullBytes - MipChainBytes(texWidth, texHeight, mipLevels, 4);
+        }
 
-        stbi_image_free(pixels);
+        Image image = m_Allocator.CreateImage({ (uint32_t)texWidth, (uint32_t)texHeight }, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, 0, VK_SAMPLE_COUNT_1_BIT, mipLevels, MemoryCategory::Texture);
 
-        Image image = m_Allocator.CreateImage({ (uint32_t)texWidth, (uint32_t)texHeight }, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, 0, VK_SAMPLE_COUNT_1_BIT, mipLevels);
+        // mip generation blits from mip 0, so it stays a transfer destination until then
+        VkImageLayout uploadLayout = generateMipMaps ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        m_Allocator.GetUploadHeap().UploadImage(image.image, { (uint32_t)texWidth, (uint32_t)texHeight }, mipLevels, 4, texels, uploadLayout);
+        m_Allocator.FlushUploads();
 
-        m_Device.transitionImageLayout(image.image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-        m_Device.copyBufferToImage(stagingBuffer.buffer, image.image, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+        stbi_image_free(pixels);
 
         Texture texture = m_Allocator.CreateTexture(image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
         texture.descriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        m_Allocator.DestroyBuffer(stagingBuffer);
 
         if (generateMipMaps)
             GenerateMipmaps(texture.image.image, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, texture.mipLevels);
@@ -78,7 +163,8 @@ namespace CLAR {
             throw std::runtime_error("texture image format does not support linear blitting!");
         }
 
-        m_Device.SingleTimeCommand([&](auto& commandBuffer)
+        // the sampling draws come later on the same queue, nothing on the CPU has to wait for the blits
+        m_Device.SubmitAsync([&](auto& commandBuffer)
             {
                 VkImageMemoryBarrier barrier{
                     .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
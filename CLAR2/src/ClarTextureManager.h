@@ -14,6 +14,13 @@ namespace CLAR {
 		uint32_t mipLevels = 1;
 	};*/
 
+	// Textures loaded below their full resolution to stay in the memory budget
+	struct TextureBudgetStats {
+		uint32_t shrunkCount = 0;
+		uint32_t droppedLevels = 0;
+		VkDeviceSize savedBytes = 0;	// against the full resolution mip chains
+	};
+
 	class TextureManager {
 	public:
 		TextureManager(Device& device, Allocator& Allocator);
@@ -21,11 +28,13 @@ namespace CLAR {
 
 		void LoadFromFile(const std::filesystem::path& path, const char* name, bool generateMipMaps = false);
 		Texture* operator[](const char* name);
+		const TextureBudgetStats& GetBudgetStats() const { return m_BudgetStats; }
 	private:
 		Device& m_Device;
 		Allocator& m_Allocator;
 
 		std::unordered_map<std::string, Texture> storage;
+		TextureBudgetStats m_BudgetStats;
 		Texture CreateTextureImage(const std::filesystem::path& path, bool generateMipMaps);
 		void GenerateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
 	};
@@ -0,0 +1,171 @@
+#include "ClarTransientAttachments.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+namespace CLAR {
+
+	TransientAttachmentPool::TransientAttachmentPool(Device& device, const Allocator& allocator)
+		: m_Device(device), m_Allocator(allocator)
+	{
+	}
+
+	TransientAttachmentPool::~TransientAttachmentPool()
+	{
+		Destroy();
+	}
+
+	TransientAttachmentPool::Handle TransientAttachmentPool::Declare(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect, VkImageLayout layout, uint32_t firstPass, uint32_t lastPass)
+	{
+		m_Targets.push_back({ format, usage, aspect, layout, firstPass, lastPass });
+		return static_cast<Handle>(m_Targets.size() - 1);
+	}
+
+	void TransientAttachmentPool::Build(VkExtent2D extent)
+	{
+		Destroy();
+
+		for (auto& target : m_Targets)
+		{
+			VkImageCreateInfo imageInfo{
+				.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+				.imageType = VK_IMAGE_TYPE_2D,
+				.format = target.format,
+				.extent{ extent.width, extent.height, 1 },
+				.mipLevels = 1,
+				.arrayLayers = 1,
+				.samples = VK_SAMPLE_COUNT_1_BIT,
+				.tiling = VK_IMAGE_TILING_OPTIMAL,
+				.usage = target.usage,
+				.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+				.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			};
+
+			if (vkCreateImage(m_Device, &imageInfo, nullptr, &target.texture.image.image) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create transient attachment!");
+			}
+			vkGetImageMemoryRequirements(m_Device, target.texture.image.image, &target.requirements);
+			m_UnaliasedBytes += target.requirements.size;
+		}
+
+		AssignSlots(m_Allocator.HasLazilyAllocatedMemory());
+
+		for (auto& slot : m_Slots)
+		{
+			slot.allocation = m_Allocator.AllocateMemory(slot.requirements, slot.lazy, MemoryCategory::RenderTarget);
+			m_Bytes += slot.requirements.size;
+		}
+
+		for (auto& target : m_Targets)
+		{
+			// the memory belongs to the slot, the texture only borrows it
+			VkImage image = target.texture.image.image;
+			m_Allocator.BindImageMemory(m_Slots[target.slot].allocation, image);
+
+			target.texture = m_Allocator.CreateTexture({ image, VK_NULL_HANDLE }, target.format, target.aspect, 1);
+			target.texture.width = static_cast<int>(extent.width);
+			target.texture.height = static_cast<int>(extent.height);
+			target.texture.descriptor.imageLayout = target.layout;
+		}
+	}
+
+	void TransientAttachmentPool::Destroy()
+	{
+		for (auto& target : m_Targets)
+		{
+			if (target.texture.image.image == VK_NULL_HANDLE)
+				continue;
+
+			vkDestroyImageView(m_Device, target.texture.descriptor.imageView, nullptr);
+			vkDestroySampler(m_Device, target.texture.descriptor.sampler, nullptr);
+			vkDestroyImage(m_Device, target.texture.image.image, nullptr);
+			target.texture = {};
+		}
+
+		for (auto& slot : m_Slots)
+			m_Allocator.FreeMemory(slot.allocation);
+		m_Slots.clear();
+
+		m_Bytes = 0;
+		m_UnaliasedBytes = 0;
+	}
+
+	void TransientAttachmentPool::Acquire(VkCommandBuffer commandBuffer, Handle handle, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) const
+	{
+		const Target& target = m_Targets[handle];
+
+		// from UNDEFINED: the contents are garbage anyway, and the previous layout belongs to whichever alias ran last
+		VkImageMemoryBarrier barrier{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+			.dstAccessMask = dstAccess,
+			.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.newLayout = target.layout,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = target.texture.image.image,
+			.subresourceRange{ target.aspect, 0, 1, 0, 1 },
+		};
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	void TransientAttachmentPool::Barrier(VkCommandBuffer commandBuffer, Handle handle, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+		VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) const
+	{
+		const Target& target = m_Targets[handle];
+
+		VkImageMemoryBarrier barrier{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+			.srcAccessMask = srcAccess,
+			.dstAccessMask = dstAccess,
+			.oldLayout = target.layout,
+			.newLayout = target.layout,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = target.texture.image.image,
+			.subresourceRange{ target.aspect, 0, 1, 0, 1 },
+		};
+		vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	// Greedy interval colouring: the biggest targets pick their slots first, so the small ones end up inside them
+	void TransientAttachmentPool::AssignSlots(bool lazyMemory)
+	{
+		std::vector<Handle> order(m_Targets.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [this](Handle a, Handle b) {
+			return m_Targets[a].requirements.size > m_Targets[b].requirements.size;
+			});
+
+		auto overlaps = [this](const Target& a, Handle b) {
+			return a.firstPass <= m_Targets[b].lastPass && m_Targets[b].firstPass <= a.lastPass;
+		};
+
+		for (Handle handle : order)
+		{
+			Target& target = m_Targets[handle];
+			bool lazy = lazyMemory && (target.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);
+
+			auto slot = std::find_if(m_Slots.begin(), m_Slots.end(), [&](const Slot& slot) {
+				return slot.lazy == lazy && (slot.requirements.memoryTypeBits & target.requirements.memoryTypeBits) &&
+					std::none_of(slot.targets.begin(), slot.targets.end(), [&](Handle other) { return overlaps(target, other); });
+				});
+
+			if (slot == m_Slots.end())
+			{
+				m_Slots.push_back({ target.requirements, lazy });
+				slot = m_Slots.end() - 1;
+			}
+			else
+			{
+				slot->requirements.size = std::max(slot->requirements.size, target.requirements.size);
+				slot->requirements.alignment = std::max(slot->requirements.alignment, target.requirements.alignment);
+				slot->requirements.memoryTypeBits &= target.requirements.memoryTypeBits;
+			}
+
+			slot->targets.push_back(handle);
+			target.slot = static_cast<uint32_t>(slot - m_Slots.begin());
+		}
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+
+#include "ClarAllocator.h"
+
+namespace CLAR {
+
+	// Render targets whose contents only live between two passes of a frame. Every target is declared with the
+	// range of passes that use it, in recording order; targets whose ranges do not overlap share memory. Targets
+	// with VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT never leave their render pass and get lazily allocated memory
+	// where the device has it, which on tilers means no memory at all.
+	//
+	// Since the memory is shared, a target's contents and layout are undefined when its first pass starts: Acquire
+	// it there, which discards whatever an alias left behind and waits for the alias to be done with the memory.
+	// A target declared over every pass has no alias and keeps its contents across frames; order its accesses with
+	// Barrier instead, which leaves the contents and the layout alone.
+	class TransientAttachmentPool {
+	public:
+		using Handle = uint32_t;
+
+		TransientAttachmentPool(Device& device, const Allocator& allocator);
+		~TransientAttachmentPool();
+
+		TransientAttachmentPool(const TransientAttachmentPool&) = delete;
+		TransientAttachmentPool& operator=(const TransientAttachmentPool&) = delete;
+
+		// layout is the one the target is used in, descriptors are written with it
+		Handle Declare(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect, VkImageLayout layout, uint32_t firstPass, uint32_t lastPass);
+
+		// Creates every declared target at extent, destroying the previous ones; nothing may still use them
+		void Build(VkExtent2D extent);
+		void Destroy();
+
+		const Texture& Get(Handle handle) const { return m_Targets[handle].texture; }
+		void Acquire(VkCommandBuffer commandBuffer, Handle handle, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) const;
+		void Barrier(VkCommandBuffer commandBuffer, Handle handle, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+			VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) const;
+
+		// what the targets take, and what they would take without aliasing
+		VkDeviceSize Bytes() const { return m_Bytes; }
+		VkDeviceSize UnaliasedBytes() const { return m_UnaliasedBytes; }
+		uint32_t SlotCount() const { return static_cast<uint32_t>(m_Slots.size()); }
+
+	private:
+		struct Target {
+			VkFormat format;
+			VkImageUsageFlags usage;
+			VkImageAspectFlags aspect;
+			VkImageLayout layout;
+			uint32_t firstPass;
+			uint32_t lastPass;
+			Texture texture{};
+			VkMemoryRequirements requirements{};
+			uint32_t slot = 0;
+		};
+
+		// memory shared by targets whose pass ranges are disjoint
+		struct Slot {
+			VkMemoryRequirements requirements;
+			bool lazy;
+			std::vector<Handle> targets;
+			VmaAllocation allocation = VK_NULL_HANDLE;
+		};
+
+		Device& m_Device;
+		const Allocator& m_Allocator;
+
+		std::vector<Target> m_Targets;
+		std::vector<Slot> m_Slots;
+		VkDeviceSize m_Bytes = 0;
+		VkDeviceSize m_UnaliasedBytes = 0;
+
+		void AssignSlots(bool lazyMemory);
+	};
+}
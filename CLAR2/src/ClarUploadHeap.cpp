@@ -0,0 +1,470 @@
+#include "ClarUploadHeap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace CLAR {
+
+	// keeps every copy source 16 byte aligned, more than any buffer or texel copy needs
+	static constexpr VkDeviceSize UploadAlignment = 16;
+
+	UploadHeap::UploadHeap(Device& device, VmaAllocator allocator, VkDeviceSize capacity)
+		: m_Device(device), m_Allocator(allocator), m_Capacity(capacity)
+	{
+		VkBufferCreateInfo bufferInfo{ VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+		bufferInfo.size = capacity;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+		VmaAllocationCreateInfo allocInfo = {};
+		allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+		allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+
+		VmaAllocationInfo allocationInfo;
+		if (vmaCreateBuffer(m_Allocator, &bufferInfo, &allocInfo, &m_Buffer, &m_Allocation, &allocationInfo) != VK_SUCCESS)
+			throw std::runtime_error("failed to create upload heap!");
+		m_Mapped = static_cast<char*>(allocationInfo.pMappedData);
+
+		VkMemoryPropertyFlags memoryFlags;
+		vmaGetAllocationMemoryProperties(m_Allocator, m_Allocation, &memoryFlags);
+		m_Coherent = (memoryFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+		QueueFamilyIndices indices = device.findQueueFamilies();
+		m_GraphicsFamily = indices.graphicsFamily.value();
+		m_Dedicated = indices.transferFamily.has_value() && device.GetTransferQueue() != VK_NULL_HANDLE;
+		m_QueueFamily = m_Dedicated ? indices.transferFamily.value() : m_GraphicsFamily;
+		m_Queue = m_Dedicated ? device.GetTransferQueue() : device.GetGraphicsQueue();
+
+		uint32_t familyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(device.GPU(), &familyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> families(familyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(device.GPU(), &familyCount, families.data());
+		m_RowGranularity = families[m_QueueFamily].minImageTransferGranularity.height;
+
+		VkCommandPoolCreateInfo poolInfo{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+			.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+			.queueFamilyIndex = m_QueueFamily
+		};
+		if (vkCreateCommandPool(m_Device, &poolInfo, nullptr, &m_CommandPool) != VK_SUCCESS)
+			throw std::runtime_error("failed to create upload heap command pool!");
+
+		if (m_Dedicated)
+		{
+			poolInfo.queueFamilyIndex = m_GraphicsFamily;
+			if (vkCreateCommandPool(m_Device, &poolInfo, nullptr, &m_AcquirePool) != VK_SUCCESS)
+				throw std::runtime_error("failed to create upload heap command pool!");
+		}
+	}
+
+	UploadHeap::~UploadHeap()
+	{
+		Flush();
+
+		for (VkFence fence : m_FreeFences)
+			vkDestroyFence(m_Device, fence, nullptr);
+		for (VkSemaphore semaphore : m_FreeSemaphores)
+			vkDestroySemaphore(m_Device, semaphore, nullptr);
+		vkDestroyCommandPool(m_Device, m_CommandPool, nullptr);
+		if (m_AcquirePool != VK_NULL_HANDLE)
+			vkDestroyCommandPool(m_Device, m_AcquirePool, nullptr);
+		vmaDestroyBuffer(m_Allocator, m_Buffer, m_Allocation);
+	}
+
+	void UploadHeap::Upload(VkBuffer dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset)
+	{
+		std::lock_guard lock(m_Mutex);
+
+		// a quarter of the ring per chunk lets a big upload be copied while the next chunk is written
+		const VkDeviceSize chunkLimit = m_Capacity / 4;
+		const char* src = static_cast<const char*>(data);
+
+		while (size > 0)
+		{
+			VkDeviceSize chunk = std::min(size, chunkLimit);
+			// may submit the open batch, so the copy and its release both go into the batch opened after it
+			VkDeviceSize offset = Allocate(chunk);
+			memcpy(m_Mapped + offset, src, chunk);
+
+			VkBufferCopy region{
+				.srcOffset = offset,
+				.dstOffset = dstOffset,
+				.size = chunk
+			};
+			vkCmdCopyBuffer(OpenBatch(), m_Buffer, dst, 1, &region);
+
+			if (m_Dedicated)
+			{
+				m_BufferBarriers.push_back({
+					.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+					.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+					.dstAccessMask = 0,
+					.srcQueueFamilyIndex = m_QueueFamily,
+					.dstQueueFamilyIndex = m_GraphicsFamily,
+					.buffer = dst,
+					.offset = dstOffset,
+					.size = chunk
+				});
+			}
+
+			src += chunk;
+			dstOffset += chunk;
+			size -= chunk;
+		}
+	}
+
+	void UploadHeap::UploadImage(VkImage dst, VkExtent2D extent, uint32_t mipLevels, uint32_t texelSize, const void* data, VkImageLayout finalLayout)
+	{
+		std::lock_guard lock(m_Mutex);
+
+		const VkDeviceSize rowBytes = VkDeviceSize(extent.width) * texelSize;
+		const VkDeviceSize chunkLimit = m_Capacity / 4;
+		if (rowBytes == 0 || extent.height == 0)
+			return;
+
+		const VkImageSubresourceRange allMips{
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.baseMipLevel = 0,
+			.levelCount = mipLevels,
+			.baseArrayLayer = 0,
+			.layerCount = 1
+		};
+
+		const char* src = static_cast<const char*>(data);
+		// bands start at multiples of the queue's transfer granularity, some copy engines only take whole images
+		uint32_t rowsPerChunk = static_cast<uint32_t>(std::min<VkDeviceSize>(chunkLimit / rowBytes, extent.height));
+		if (m_RowGranularity == 0 ? rowsPerChunk < extent.height : rowsPerChunk < std::min(m_RowGranularity, extent.height))
+			throw std::runtime_error("image does not fit the upload heap!");
+		if (m_RowGranularity > 1 && rowsPerChunk < extent.height)
+			rowsPerChunk -= rowsPerChunk % m_RowGranularity;
+		bool transitioned = false;
+
+		for (uint32_t y = 0; y < extent.height; y += rowsPerChunk)
+		{
+			uint32_t rows = std::min(rowsPerChunk, extent.height - y);
+			VkDeviceSize size = rows * rowBytes;
+			VkDeviceSize offset = Allocate(size);
+			memcpy(m_Mapped + offset, src + y * rowBytes, size);
+
+			VkCommandBuffer commandBuffer = OpenBatch();
+			if (!transitioned)
+			{
+				// bands recorded into later batches come after this on the same queue, one transition covers them
+				VkImageMemoryBarrier toTransfer{
+					.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+					.srcAccessMask = 0,
+					.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+					.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+					.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+					.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+					.image = dst,
+					.subresourceRange = allMips
+				};
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+					0, 0, nullptr, 0, nullptr, 1, &toTransfer);
+				transitioned = true;
+			}
+
+			VkBufferImageCopy region{
+				.bufferOffset = offset,
+				.bufferRowLength = 0,
+				.bufferImageHeight = 0,
+				.imageSubresource{
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.mipLevel = 0,
+					.baseArrayLayer = 0,
+					.layerCount = 1,
+				},
+				.imageOffset = { 0, static_cast<int32_t>(y), 0 },
+				.imageExtent = { extent.width, rows, 1 }
+			};
+			vkCmdCopyBufferToImage(commandBuffer, m_Buffer, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+		}
+
+		// the layout change rides on the ownership transfer, or on a plain barrier when there is none
+		VkImageMemoryBarrier toFinal{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
+			.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			.newLayout = finalLayout,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = dst,
+			.subresourceRange = allMips
+		};
+		if (m_Dedicated)
+		{
+			toFinal.dstAccessMask = 0;
+			toFinal.srcQueueFamilyIndex = m_QueueFamily;
+			toFinal.dstQueueFamilyIndex = m_GraphicsFamily;
+			m_ImageBarriers.push_back(toFinal);
+		}
+		else
+		{
+			vkCmdPipelineBarrier(m_Open, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+				0, 0, nullptr, 0, nullptr, 1, &toFinal);
+		}
+	}
+
+	void UploadHeap::Submit()
+	{
+		std::lock_guard lock(m_Mutex);
+		SubmitOpen();
+		AcquirePending(false);
+	}
+
+	void UploadHeap::Stream()
+	{
+		std::lock_guard lock(m_Mutex);
+		SubmitOpen();
+		AcquirePending(true);
+		Retire(false);
+	}
+
+	void UploadHeap::Flush()
+	{
+		std::lock_guard lock(m_Mutex);
+		SubmitOpen();
+		AcquirePending(false);
+		while (!m_InFlight.empty())
+			Retire(true);
+	}
+
+	VkDeviceSize UploadHeap::Allocate(VkDeviceSize size)
+	{
+		while (true)
+		{
+			Retire(false);
+			if (m_Used == 0)
+				m_Head = 0;
+
+			// the free bytes run from m_Head around to the oldest batch, take them from the end of the ring
+			// or, when they do not fit there, skip the tail and start over at 0
+			VkDeviceSize offset = (m_Head + UploadAlignment - 1) & ~(UploadAlignment - 1);
+			VkDeviceSize skipped = offset - m_Head;
+			if (offset + size > m_Capacity)
+			{
+				skipped = m_Capacity - m_Head;
+				offset = 0;
+			}
+
+			if (m_Used + skipped + size <= m_Capacity)
+			{
+				m_Head = offset + size;
+				m_Used += skipped + size;
+				m_OpenBytes += skipped + size;
+				return offset;
+			}
+
+			// the open batch holds the space we are waiting for, it has to go out first
+			if (m_InFlight.empty())
+				SubmitOpen();
+			Retire(true);
+		}
+	}
+
+	VkCommandBuffer UploadHeap::TakeCommandBuffer(std::vector<VkCommandBuffer>& freeList, VkCommandPool pool)
+	{
+		VkCommandBuffer commandBuffer;
+		if (!freeList.empty())
+		{
+			commandBuffer = freeList.back();
+			freeList.pop_back();
+		}
+		else
+		{
+			VkCommandBufferAllocateInfo allocInfo{
+				.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+				.commandPool = pool,
+				.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+				.commandBufferCount = 1,
+			};
+			vkAllocateCommandBuffers(m_Device, &allocInfo, &commandBuffer);
+		}
+
+		// the pools reset command buffers on begin
+		VkCommandBufferBeginInfo beginInfo{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+			.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+		};
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		return commandBuffer;
+	}
+
+	VkFence UploadHeap::TakeFence()
+	{
+		VkFence fence;
+		if (!m_FreeFences.empty())
+		{
+			fence = m_FreeFences.back();
+			m_FreeFences.pop_back();
+		}
+		else
+		{
+			VkFenceCreateInfo fenceInfo{ VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+			vkCreateFence(m_Device, &fenceInfo, nullptr, &fence);
+		}
+		return fence;
+	}
+
+	VkCommandBuffer UploadHeap::OpenBatch()
+	{
+		if (m_Open == VK_NULL_HANDLE)
+			m_Open = TakeCommandBuffer(m_FreeCommandBuffers, m_CommandPool);
+		return m_Open;
+	}
+
+	void UploadHeap::SubmitOpen()
+	{
+		if (m_Open == VK_NULL_HANDLE)
+			return;
+
+		if (m_Dedicated)
+		{
+			// release half of the ownership transfers, Acquire records the other half on the graphics queue
+			vkCmdPipelineBarrier(m_Open, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+				static_cast<uint32_t>(m_BufferBarriers.size()), m_BufferBarriers.data(),
+				static_cast<uint32_t>(m_ImageBarriers.size()), m_ImageBarriers.data());
+		}
+		else
+		{
+			// later submissions read the destinations as vertices, indices, storage or build input
+			VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+			vkCmdPipelineBarrier(m_Open, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+				0, 1, &barrier, 0, nullptr, 0, nullptr);
+		}
+		vkEndCommandBuffer(m_Open);
+
+		if (!m_Coherent)
+			vmaFlushAllocation(m_Allocator, m_Allocation, 0, VK_WHOLE_SIZE);
+
+		Batch batch{ m_Open, TakeFence(), m_OpenBytes };
+		VkSubmitInfo submitInfo{
+			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+			.commandBufferCount = 1,
+			.pCommandBuffers = &m_Open
+		};
+
+		if (m_Dedicated)
+		{
+			if (!m_FreeSemaphores.empty())
+			{
+				batch.semaphore = m_FreeSemaphores.back();
+				m_FreeSemaphores.pop_back();
+			}
+			else
+			{
+				VkSemaphoreCreateInfo semaphoreInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+				vkCreateSemaphore(m_Device, &semaphoreInfo, nullptr, &batch.semaphore);
+			}
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &batch.semaphore;
+
+			batch.bufferBarriers = std::move(m_BufferBarriers);
+			batch.imageBarriers = std::move(m_ImageBarriers);
+			m_BufferBarriers.clear();
+			m_ImageBarriers.clear();
+		}
+		else
+		{
+			batch.acquired = true;
+		}
+
+		if (vkQueueSubmit(m_Queue, 1, &submitInfo, batch.fence) != VK_SUCCESS)
+			throw std::runtime_error("failed to submit upload batch!");
+
+		m_InFlight.push_back(std::move(batch));
+		m_Open = VK_NULL_HANDLE;
+		m_OpenBytes = 0;
+	}
+
+	void UploadHeap::Acquire(Batch& batch)
+	{
+		if (batch.acquired)
+			return;
+
+		// same barriers as the release, with the access masks on the graphics side
+		for (auto& barrier : batch.bufferBarriers)
+		{
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		}
+		for (auto& barrier : batch.imageBarriers)
+		{
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+		}
+
+		batch.acquire = TakeCommandBuffer(m_FreeAcquireBuffers, m_AcquirePool);
+		vkCmdPipelineBarrier(batch.acquire, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr,
+			static_cast<uint32_t>(batch.bufferBarriers.size()), batch.bufferBarriers.data(),
+			static_cast<uint32_t>(batch.imageBarriers.size()), batch.imageBarriers.data());
+		vkEndCommandBuffer(batch.acquire);
+
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		VkSubmitInfo submitInfo{
+			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+			.waitSemaphoreCount = 1,
+			.pWaitSemaphores = &batch.semaphore,
+			.pWaitDstStageMask = &waitStage,
+			.commandBufferCount = 1,
+			.pCommandBuffers = &batch.acquire
+		};
+
+		batch.acquireFence = TakeFence();
+		if (vkQueueSubmit(m_Device.GetGraphicsQueue(), 1, &submitInfo, batch.acquireFence) != VK_SUCCESS)
+			throw std::runtime_error("failed to submit upload acquire!");
+		batch.acquired = true;
+	}
+
+	void UploadHeap::AcquirePending(bool finishedOnly)
+	{
+		// in submission order, a batch is never acquired before the ones copied ahead of it
+		for (auto& batch : m_InFlight)
+		{
+			if (batch.acquired)
+				continue;
+			if (finishedOnly && vkGetFenceStatus(m_Device, batch.fence) != VK_SUCCESS)
+				break;
+			Acquire(batch);
+		}
+	}
+
+	void UploadHeap::Retire(bool wait)
+	{
+		// batches signal in submission order, only the oldest is ever waited on
+		while (!m_InFlight.empty())
+		{
+			Batch& batch = m_InFlight.front();
+			if (wait)
+			{
+				// its destinations would stay owned by the transfer family otherwise
+				Acquire(batch);
+
+				VkFence fences[2] = { batch.fence, batch.acquireFence };
+				vkWaitForFences(m_Device, batch.acquireFence != VK_NULL_HANDLE ? 2 : 1, fences, VK_TRUE, UINT64_MAX);
+				wait = false;
+			}
+			else if (!batch.acquired || vkGetFenceStatus(m_Device, batch.fence) != VK_SUCCESS ||
+				(batch.acquireFence != VK_NULL_HANDLE && vkGetFenceStatus(m_Device, batch.acquireFence) != VK_SUCCESS))
+				break;
+
+			vkResetFences(m_Device, 1, &batch.fence);
+			m_FreeFences.push_back(batch.fence);
+			m_FreeCommandBuffers.push_back(batch.commandBuffer);
+			if (batch.acquireFence != VK_NULL_HANDLE)
+			{
+				vkResetFences(m_Device, 1, &batch.acquireFence);
+				m_FreeFences.push_back(batch.acquireFence);
+				m_FreeAcquireBuffers.push_back(batch.acquire);
+				m_FreeSemaphores.push_back(batch.semaphore);
+			}
+			m_Used -= batch.bytes;
+			m_InFlight.pop_front();
+		}
+	}
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "vma/vk_mem_alloc.h"
+#include "clar_device.h"
+
+namespace CLAR {
+
+	// Persistently mapped staging ring. Upload copies into the ring and records a vkCmdCopyBuffer into the open
+	// batch; Submit hands the batch to the queue with a fence and returns without waiting. The space of a batch
+	// is handed back once its fence signals, so staging memory is reused instead of reallocated per upload.
+	//
+	// On GPUs with a transfer only queue family the copies run there, off the graphics queue. Every batch then
+	// releases its destinations to the graphics family and signals a semaphore; the matching acquire is a small
+	// graphics submission that waits on it. Submit acquires right away, Stream only acquires batches whose copies
+	// already finished, so the graphics queue never waits on a copy in flight.
+	// Either way, graphics submissions made after the acquire see the copied data.
+	class UploadHeap {
+	public:
+		static constexpr VkDeviceSize DefaultCapacity = 64ull << 20;
+
+		UploadHeap(Device& device, VmaAllocator allocator, VkDeviceSize capacity = DefaultCapacity);
+		~UploadHeap();
+
+		UploadHeap(const UploadHeap&) = delete;
+		UploadHeap& operator=(const UploadHeap&) = delete;
+
+		// Uploads larger than the ring are split into chunks, blocking on older batches when the ring is full
+		void Upload(VkBuffer dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset = 0);
+		// Tightly packed texels into mip 0 of an image in VK_IMAGE_LAYOUT_UNDEFINED, which ends up in finalLayout
+		// on the graphics queue. Big images are copied in bands of rows.
+		void UploadImage(VkImage dst, VkExtent2D extent, uint32_t mipLevels, uint32_t texelSize, const void* data, VkImageLayout finalLayout);
+		// Submits the open batch and acquires every batch, does nothing when nothing was recorded
+		void Submit();
+		// Submits the open batch but only acquires the batches whose copies are done
+		void Stream();
+		// Submits and waits for every batch in flight
+		void Flush();
+
+		VkDeviceSize Capacity() const { return m_Capacity; }
+		bool UsesTransferQueue() const { return m_Dedicated; }
+	private:
+		// a submitted batch and the ring bytes it holds until fence signals
+		struct Batch {
+			VkCommandBuffer commandBuffer;
+			VkFence fence;
+			VkDeviceSize bytes;
+			// only used with a dedicated transfer queue
+			VkSemaphore semaphore = VK_NULL_HANDLE;
+			std::vector<VkBufferMemoryBarrier> bufferBarriers;
+			std::vector<VkImageMemoryBarrier> imageBarriers;
+			VkCommandBuffer acquire = VK_NULL_HANDLE;
+			VkFence acquireFence = VK_NULL_HANDLE;
+			bool acquired = false;
+		};
+
+		Device& m_Device;
+		VmaAllocator m_Allocator;
+
+		VkBuffer m_Buffer = VK_NULL_HANDLE;
+		VmaAllocation m_Allocation = VK_NULL_HANDLE;
+		char* m_Mapped = nullptr;
+		bool m_Coherent = true;
+		VkDeviceSize m_Capacity;
+
+		VkDeviceSize m_Head = 0;		// next free byte
+		VkDeviceSize m_Used = 0;		// bytes held by the open batch and the batches in flight
+		VkDeviceSize m_OpenBytes = 0;	// bytes of m_Used that belong to the open batch
+
+		bool m_Dedicated = false;
+		VkQueue m_Queue = VK_NULL_HANDLE;
+		uint32_t m_QueueFamily = 0;
+		uint32_t m_GraphicsFamily = 0;
+		uint32_t m_RowGranularity = 1;	// image copy offsets on m_Queue are multiples of it, 0 for whole images only
+
+		VkCommandPool m_CommandPool = VK_NULL_HANDLE;
+		VkCommandPool m_AcquirePool = VK_NULL_HANDLE;
+		VkCommandBuffer m_Open = VK_NULL_HANDLE;
+		// ownership transfers the open batch has to release
+		std::vector<VkBufferMemoryBarrier> m_BufferBarriers;
+		std::vector<VkImageMemoryBarrier> m_ImageBarriers;
+
+		std::deque<Batch> m_InFlight;
+		std::vector<VkCommandBuffer> m_FreeCommandBuffers;
+		std::vector<VkCommandBuffer> m_FreeAcquireBuffers;
+		std::vector<VkFence> m_FreeFences;
+		std::vector<VkSemaphore> m_FreeSemaphores;
+
+		std::mutex m_Mutex;
+
+		VkDeviceSize Allocate(VkDeviceSize size);
+		void SubmitOpen();
+		void Acquire(Batch& batch);
+		void AcquirePending(bool finishedOnly);
+		void Retire(bool wait);
+		VkCommandBuffer OpenBatch();
+		VkCommandBuffer TakeCommandBuffer(std::vector<VkCommandBuffer>& freeList, VkCommandPool pool);
+		VkFence TakeFence();
+	};
+}
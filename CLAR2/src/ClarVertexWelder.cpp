@@ -0,0 +1,73 @@
+#include "ClarVertexWelder.h"
+
+namespace CLAR {
+
+	static size_t NextPowerOfTwo(size_t value)
+	{
+		size_t result = 16;
+		while (result < value)
+			result <<= 1;
+		return result;
+	}
+
+	VertexWelder::VertexWelder(std::vector<Vertex>& vertices, size_t expectedVertices)
+		: m_Vertices(vertices)
+	{
+		m_Vertices.reserve(m_Vertices.size() + expectedVertices);
+		Rehash(NextPowerOfTwo(expectedVertices * 2));
+
+		// vertices already in the output stay addressable by their current index
+		for (size_t i = 0; i < m_Vertices.size(); i++)
+		{
+			uint32_t hash = static_cast<uint32_t>(HashVertex(m_Vertices[i]));
+			size_t slot = hash & m_Mask;
+			while (m_Slots[slot].index != Empty)
+				slot = (slot + 1) & m_Mask;
+			m_Slots[slot] = { hash, static_cast<uint32_t>(i) };
+			m_Count++;
+		}
+	}
+
+	uint32_t VertexWelder::Insert(const Vertex& vertex)
+	{
+		// keep the load factor under 3/4 so probe sequences stay short
+		if ((m_Count + 1) * 4 > m_Slots.size() * 3)
+			Rehash(m_Slots.size() * 2);
+
+		uint32_t hash = static_cast<uint32_t>(HashVertex(vertex));
+		size_t slot = hash & m_Mask;
+
+		while (m_Slots[slot].index != Empty)
+		{
+			const Slot& candidate = m_Slots[slot];
+			if (candidate.hash == hash && m_Vertices[candidate.index] == vertex)
+				return candidate.index;
+			slot = (slot + 1) & m_Mask;
+		}
+
+		uint32_t index = static_cast<uint32_t>(m_Vertices.size());
+		m_Vertices.push_back(vertex);
+		m_Slots[slot] = { hash, index };
+		m_Count++;
+
+		return index;
+	}
+
+	void VertexWelder::Rehash(size_t capacity)
+	{
+		std::vector<Slot> old = std::move(m_Slots);
+		m_Slots.assign(capacity, Slot{ 0, Empty });
+		m_Mask = capacity - 1;
+
+		for (const Slot& entry : old)
+		{
+			if (entry.index == Empty)
+				continue;
+
+			size_t slot = entry.hash & m_Mask;
+			while (m_Slots[slot].index != Empty)
+				slot = (slot + 1) & m_Mask;
+			m_Slots[slot] = entry;
+		}
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+
+#include "clar_vertex.h"
+
+namespace CLAR {
+
+	// Deduplicates vertices into a caller owned vector through a flat, linearly probed table.
+	// Every slot keeps the full hash next to the vertex index so most mismatches never touch the vertex data.
+	class VertexWelder {
+	public:
+		// expectedVertices only sizes the table, it grows past it if needed
+		VertexWelder(std::vector<Vertex>& vertices, size_t expectedVertices);
+
+		// Returns the index of vertex in the output, appending it if it was not seen yet
+		uint32_t Insert(const Vertex& vertex);
+
+		size_t Count() const { return m_Count; }
+
+	private:
+		struct Slot {
+			uint32_t hash;
+			uint32_t index;
+		};
+		static constexpr uint32_t Empty = UINT32_MAX;
+
+		void Rehash(size_t capacity);
+
+		std::vector<Vertex>& m_Vertices;
+		std::vector<Slot> m_Slots;
+		size_t m_Mask = 0;
+		size_t m_Count = 0;
+	};
+}
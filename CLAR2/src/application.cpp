@@ -1,9 +1,9 @@
 #include <stdexcept>
+#include <cassert>
 #include <cstdlib>
 #include <set>
 #include <unordered_map>
 #include <thread>
-#include <future>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -61,29 +61,51 @@ namespace CLAR {
         m_Window.SetResizeCallback([&]() {
             CreateOffscreenRender();
 
-            VkDescriptorImageInfo imageInfo{ {}, m_OffscreenColor[0].descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL};
+            // every offscreen image was recreated, the transient ones possibly sharing memory differently
             for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
             {
                 DescritorWriter()
-                    .WriteStorageImage(1, &imageInfo)
+                    .WriteStorageImage(1, &m_TransientAttachments.Get(m_PositionMap).descriptor)
+                    .WriteStorageImage(2, &m_TransientAttachments.Get(m_NoisyColor).descriptor)
                     .Update(m_RtDescriptorSets[i], m_Device);
             }
 
             for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
             {
                 DescritorWriter()
-                    .WriteImage(0, &m_OffscreenColor[0].descriptor)
+                    .WriteStorageImage(0, &m_OffscreenColor[(i - 1) % MAX_FRAMES_IN_FLIGHT].descriptor)
+                    .WriteStorageImage(1, &m_OffscreenColor[i].descriptor)
+                    .WriteStorageImage(2, &m_TransientAttachments.Get(m_NoisyColor).descriptor)
+                    .WriteStorageImage(3, &m_TransientAttachments.Get(m_PositionMap).descriptor)
                     .Update(m_PostDescriptorSets[i], m_Device);
             }
 		});
-        m_OffscreenColor.resize(3);
+
+        // the post pass reprojects the noisy image and the position map in raster mode too, showing the last trace,
+        // and raygen reads the previous frame's position map: both span the whole frame and keep their contents.
+        // the depth buffer never leaves the raster pass
+        m_OffscreenColor.resize(2);
+        m_NoisyColor = m_TransientAttachments.Declare(m_OffscreenColorFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+            | VK_IMAGE_USAGE_STORAGE_BIT, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_GENERAL, RasterPass, PostPass);
+        m_PositionMap = m_TransientAttachments.Declare(m_OffscreenPositionBufferFormat, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+            VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_GENERAL, RasterPass, PostPass);
+        m_OffscreenDepth = m_TransientAttachments.Declare(m_OffscreenDepthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+            VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, RasterPass, RasterPass);
         CreateOffscreenRender();
 
-        m_DescriptorSetLayout.PushBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+        // a defragmentation pass moved a geometry block, the ranges inside it and the object table follow it
+        m_GeometryPool.SetRelocationHandler([this](const GeometryRelocation& relocation) {
+            for (auto& [_, model] : m_Models)
+                model->Relocate(relocation);
+            RefreshObjectAddresses();
+        });
+
+        // the buffer bindings live in the frame allocator, the dynamic offsets select the frame
+        m_DescriptorSetLayout.PushBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
             VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_VERTEX_BIT);
-        m_DescriptorSetLayout.PushBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        m_DescriptorSetLayout.PushBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
             VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_VERTEX_BIT);
-        m_DescriptorSetLayout.PushBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
+        m_DescriptorSetLayout.PushBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
 
         m_DescriptorSets = m_DescriptorSetLayout.CreateSets();
 
@@ -95,7 +117,7 @@ namespace CLAR {
         m_PostDescriptorSetLayout.PushBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT);
         m_PostDescriptorSetLayout.PushBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR);
         m_PostDescriptorSetLayout.PushBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR);
-        m_PostDescriptorSetLayout.PushBinding(4, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+        m_PostDescriptorSetLayout.PushBinding(4, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_FRAGMENT_BIT);
 
         m_PostDescriptorSets = m_PostDescriptorSetLayout.CreateSets();
 
@@ -112,24 +134,17 @@ namespace CLAR {
         /*m_Models["house"] = new Model();
         m_Models["house"]->LoadModel("models/Medieval_building.obj");*/
 
-        auto asyncLoad = [](Model* model, const std::string& path) {
-            model->LoadModel(path);
-		};
-
-        m_Models["sphere"] = new Model();
-        //m_Models["sphere"]->LoadModel("models/sphere.obj");
+        // every model is parsed on the thread pool and uploaded by the main thread as soon as it is ready
+        ModelLoader modelLoader{ m_ThreadPool };
+        GeometryUploader uploader{ m_Allocator, m_GeometryPool };
 
-        m_Models["cube"] = new Model();
-        //m_Models["cube"]->LoadModel("models/cube.obj");
-
-        m_Models["grandPiano"] = new Model();
-        //m_Models["grandPiano"]->LoadModel("models/grandPiano.obj");
-
-        m_Models["glass"] = new Model();
-        //m_Models["glass"]->LoadModel("models/glass.obj");
-
-        m_Models["rose"] = new Model();
-        //m_Models["rose"]->LoadModel("models/rose.obj");
+        m_Models["sphere"] = uploader.Add(modelLoader.LoadAsync("models/sphere.obj"));
+        m_Models["cube"] = uploader.Add(modelLoader.LoadAsync("models/cube.obj"));
+        m_Models["grandPiano"] = uploader.Add(modelLoader.LoadAsync("models/grandPiano.obj"));
+        m_Models["glass"] = uploader.Add(modelLoader.LoadAsync("models/glass.obj"));
+        m_Models["rose"] = uploader.Add(modelLoader.LoadAsync("models/rose.obj"));
+        m_Models["koenigsegg"] = uploader.Add(modelLoader.LoadAsync("models/koenigsegg.obj"));
+        m_Models["watchtower"] = uploader.Add(modelLoader.LoadAsync("models/watchtower.obj"));
 
         /*m_Models["sponza"] = new Model();
         m_Models["sponza"]->LoadModel("models/sponza.obj");*/
@@ -141,18 +156,20 @@ namespace CLAR {
                                             { {-1.5f, 0.f, 1.5f} } },
             {0, 1, 3, 1, 2, 3}
         );
-        m_Models["koenigsegg"] = new Model();
-        m_Models["watchtower"] = new Model();
-
+        uploader.Add(m_Models["square"]);
 
+        // a .glb brings its own node hierarchy, every glTF mesh becomes a model and every node an instance below.
+        // the scene is optional, it is only loaded when the file is there
+        GltfScene city;
+        if (std::filesystem::exists("models/city.glb"))
+        {
+            city = GltfLoader::Load("models/city.glb", &m_ThreadPool);
+            for (size_t i = 0; i < city.models.size(); i++)
+                m_Models["city:" + std::to_string(i)] = uploader.Add(city.models[i]);
+        }
 
-        std::async(std::launch::async, asyncLoad, m_Models["sphere"], "models/sphere.obj");
-        std::async(std::launch::async, asyncLoad, m_Models["cube"], "models/cube.obj");
-        std::async(std::launch::async, asyncLoad, m_Models["grandPiano"], "models/grandPiano.obj");
-        std::async(std::launch::async, asyncLoad, m_Models["glass"], "models/glass.obj");
-        std::async(std::launch::async, asyncLoad, m_Models["watchtower"], "models/watchtower.obj");
-        std::async(std::launch::async, asyncLoad, m_Models["koenigsegg"], "models/koenigsegg.obj");
-        std::async(std::launch::async, asyncLoad, m_Models["rose"], "models/rose.obj").get();
+        // layout is picked by GpuVertexFormat, ObjDesc tells the hit shader which one each model uses
+        uploader.UploadAll();
 
 
         /*m_Models["casa"] = new Model();
@@ -164,30 +181,6 @@ namespace CLAR {
         //m_Models["house"]->m_VertexBuffer = m_Allocator.CreateBuffer(m_Models["house"]->mesh, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
         //m_Models["house"]->m_IndexBuffer = m_Allocator.CreateBuffer(m_Models["house"]->indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 
-        m_Models["sphere"]->m_VertexBuffer = m_Allocator.CreateBuffer(m_Models["sphere"]->mesh, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-        m_Models["sphere"]->m_IndexBuffer = m_Allocator.CreateBuffer(m_Models["sphere"]->indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-
-        m_Models["square"]->m_VertexBuffer = m_Allocator.CreateBuffer(m_Models["square"]->mesh, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-        m_Models["square"]->m_IndexBuffer = m_Allocator.CreateBuffer(m_Models["square"]->indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-
-        m_Models["cube"]->m_VertexBuffer = m_Allocator.CreateBuffer(m_Models["cube"]->mesh, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-        m_Models["cube"]->m_IndexBuffer = m_Allocator.CreateBuffer(m_Models["cube"]->indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-
-        m_Models["grandPiano"]->m_VertexBuffer = m_Allocator.CreateBuffer(m_Models["grandPiano"]->mesh, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-        m_Models["grandPiano"]->m_IndexBuffer = m_Allocator.CreateBuffer(m_Models["grandPiano"]->indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-
-        m_Models["glass"]->m_VertexBuffer = m_Allocator.CreateBuffer(m_Models["glass"]->mesh, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-        m_Models["glass"]->m_IndexBuffer = m_Allocator.CreateBuffer(m_Models["glass"]->indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-
-        m_Models["rose"]->m_VertexBuffer = m_Allocator.CreateBuffer(m_Models["rose"]->mesh, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-        m_Models["rose"]->m_IndexBuffer = m_Allocator.CreateBuffer(m_Models["rose"]->indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-
-        m_Models["koenigsegg"]->m_VertexBuffer = m_Allocator.CreateBuffer(m_Models["koenigsegg"]->mesh, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-        m_Models["koenigsegg"]->m_IndexBuffer = m_Allocator.CreateBuffer(m_Models["koenigsegg"]->indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-
-        m_Models["watchtower"]->m_VertexBuffer = m_Allocator.CreateBuffer(m_Models["watchtower"]->mesh, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-        m_Models["watchtower"]->m_IndexBuffer = m_Allocator.CreateBuffer(m_Models["watchtower"]->indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-
         //m_Models["sponza"]->m_VertexBuffer = m_Allocator.CreateBuffer(m_Models["sponza"]->mesh, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
         //m_Models["sponza"]->m_IndexBuffer = m_Allocator.CreateBuffer(m_Models["sponza"]->indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 
@@ -265,12 +258,24 @@ namespace CLAR {
 
 
         //m_Instances.emplace_back("Casa", Instance{ m_Models["casa"], white, glm::vec3(0.0f), glm::vec3(1.f), glm::vec3(0.f), 8 });
+        for (const auto& node : city.nodes)
+        {
+            Instance instance{ node.model, white, glm::vec3(0.f), glm::vec3(1.f), glm::vec3(0.f), static_cast<uint32_t>(m_Instances.size()) };
+            instance.SetTransform(node.transform);
+            instance.modelMaterials = true;
+            m_Instances.emplace_back(node.name, instance);
+        }
         for (const auto& [_, instance] : m_Instances)
         {
             ObjDesc desc{};
 
-            desc.vertexAddress = m_Device.GetBufferDeviceAddress(instance.model->m_VertexBuffer.buffer);
-            desc.indexAddress = m_Device.GetBufferDeviceAddress(instance.model->m_IndexBuffer.buffer);
+            desc.vertexAddress = instance.model->m_VertexRange.address;
+            desc.indexAddress = instance.model->m_IndexRange.address;
+            desc.geometryAddress = instance.model->m_GeometryRange.address;
+            desc.modelMaterials = instance.modelMaterials;
+            desc.colorAddress = instance.model->m_ColorRange.address;
+            desc.attributeAddress = instance.model->m_AttributeRange.address;
+            desc.vertexFormat = static_cast<uint32_t>(instance.model->vertexFormat);
             desc.material = instance.material->GetType();
             desc.albedo = instance.material->GetAlbedo();
             desc.fuzz = instance.material->GetFuzzOrRefractionIndex();
@@ -278,63 +283,39 @@ namespace CLAR {
             m_ObjectDescriptions.push_back(desc);
 		}
 
-        m_BobjDesc = m_Allocator.CreateBuffer(m_ObjectDescriptions, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
-
-        std::vector<LightDesc> lightDescription(10);
         m_pcRay.lightsNumber = 0;
         for (size_t i = 0; i < m_Instances.size(); ++i)
 		{
 			if (m_Instances[i].second.material->GetType() == MaterialType::DIFFUSE_LIGHT)
             {
-                lightDescription[m_pcRay.lightsNumber++] = { m_Instances[i].second.TransformMatrix(), (uint32_t)i };
+                m_LightDescriptions[m_pcRay.lightsNumber++] = { m_Instances[i].second.TransformMatrix(), (uint32_t)i };
             }
 		}
-        m_LightModelsBuffer = m_Allocator.CreateBuffer(lightDescription, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
-
-        
-        
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
-		{
-			m_UniformBuffers.emplace_back(
-                m_Allocator.CreateBuffer(sizeof(UniformBufferObject),
-                    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                    VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT)
-            );
-
-            m_PostUniformBuffers.emplace_back(
-                m_Allocator.CreateBuffer(sizeof(glm::mat4),
-                    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                    VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT)
-            );
-		}
-
-
 
+        // written once, Update pushes the data every frame and binds it with dynamic offsets
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
         {
-            auto bufferInfo = m_UniformBuffers[i].DescriptorInfo();
-            auto odbufferInfo = m_BobjDesc.DescriptorInfo();
-            auto lightModelsInfo = m_LightModelsBuffer.DescriptorInfo();
+            auto bufferInfo = m_FrameAllocator.DescriptorInfo(sizeof(UniformBufferObject));
+            auto odbufferInfo = m_FrameAllocator.DescriptorInfo(m_ObjectDescriptions.size() * sizeof(ObjDesc));
+            auto lightModelsInfo = m_FrameAllocator.DescriptorInfo(m_LightDescriptions.size() * sizeof(LightDesc));
 
             DescritorWriter()
-                .WriteUniformBuffer(0, &bufferInfo)
-                .WriteStorageBuffer(1, &odbufferInfo)
-                .WriteStorageBuffer(2, &lightModelsInfo)
+                .WriteUniformBufferDynamic(0, &bufferInfo)
+                .WriteStorageBufferDynamic(1, &odbufferInfo)
+                .WriteStorageBufferDynamic(2, &lightModelsInfo)
                 .Update(m_DescriptorSets[i], m_Device);
         }
 
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
         {
-            auto postBufferInfo = m_PostUniformBuffers[i].DescriptorInfo();
+            auto postBufferInfo = m_FrameAllocator.DescriptorInfo(sizeof(glm::mat4));
 
             DescritorWriter()
                 .WriteStorageImage(0, &m_OffscreenColor[(i - 1) % MAX_FRAMES_IN_FLIGHT].descriptor)
                 .WriteStorageImage(1, &m_OffscreenColor[i].descriptor)
-                .WriteStorageImage(2, &m_OffscreenColor[2].descriptor)
-                .WriteStorageImage(3, &m_OffscreenPositionBuffer.descriptor)
-                .WriteUniformBuffer(4, &postBufferInfo)
+                .WriteStorageImage(2, &m_TransientAttachments.Get(m_NoisyColor).descriptor)
+                .WriteStorageImage(3, &m_TransientAttachments.Get(m_PositionMap).descriptor)
+                .WriteUniformBufferDynamic(4, &postBufferInfo)
                 .Update(m_PostDescriptorSets[i], m_Device);
         }
 
@@ -438,23 +419,42 @@ namespace CLAR {
         // So we can loop over all the models and then create more geometries for each model
         // This would translate into 2 for loops
 
+        // serialized BLASes of earlier runs, rebuilt when the geometry or the driver changed
+        m_RtBuilder.SetCacheDirectory("cache/blas");
+
         std::vector<BlasInput> allBlas;
         allBlas.reserve(m_Models.size());
 
         for (const auto& [name, model] : m_Models)
 		{
-			allBlas.emplace_back(ModelToVkgeometry(model));
+            for (uint32_t lod = 0; lod < model->LodCount(); ++lod)
+            {
+                allBlas.emplace_back(ModelToVkgeometry(model, lod));
+            }
 		}
 
         buildAs = m_RtBuilder.BuildBlas(allBlas); 
 
+        // the TLAS instances point at BLAS addresses, rewrite them when defragmentation moves one
+        for (size_t i = 0; i < buildAs.size(); ++i)
+        {
+            m_Allocator.SetRelocation(buildAs[i].as, [this, i](const AccelerationStructure& moved) {
+                buildAs[i].as = moved;
+                m_InstanceUpdated = true;
+            });
+        }
+
         // Create the top-level acceleration structure
 
         std::vector<VkAccelerationStructureInstanceKHR> instances;
+        std::vector<InstanceBounds> instanceBounds;
         instances.reserve(m_Instances.size());
+        instanceBounds.reserve(m_Instances.size());
 
         for (const auto& [_, ins] : m_Instances)
         {
+            instanceBounds.push_back({ ins.model->boundsMin, ins.model->boundsMax });
+
             VkAccelerationStructureInstanceKHR instance{};
             instance.transform = glmToVkTransform(ins.TransformMatrix());
             instance.instanceCustomIndex = ins.instanceCustomIndex;
@@ -463,16 +463,11 @@ namespace CLAR {
             instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
             //VK_GEOMETRY_INSTANCE_TRIANGLE_FRONT_COUNTERCLOCKWISE_BIT_KHR;
 
-            // write a function to get the device address of the element in buildas whose blasId is ins.blasId
-			auto blas = std::ranges::find_if(buildAs, [&](const ASBuildInfo& b) { return b.blasId == ins.model->id; });
-
-            VkAccelerationStructureDeviceAddressInfoKHR addressInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR };
-            addressInfo.accelerationStructure = blas->as.handle;
-            instance.accelerationStructureReference = vkGetAccelerationStructureDeviceAddressKHR(m_Device, &addressInfo);
+            instance.accelerationStructureReference = BlasAddress(ins.model, ins.lod);
 
             instances.push_back(instance);
         }
-        m_Tlas = m_RtBuilder.BuildTlas(instances);
+        m_Tlas = m_RtBuilder.BuildTlas(instances, instanceBounds);
 
         CreateRtDescriptorSets();
 
@@ -487,7 +482,6 @@ namespace CLAR {
         while (!m_Window.shouldClose())
         {
             glfwPollEvents();
-            Update(m_Renderer.GetCurrentFrame());
 
             drawFrame();
 
@@ -544,17 +538,15 @@ namespace CLAR {
 
     void HelloTriangleApplication::cleanup() {
 
-        m_Allocator.DestroyBuffer(m_BobjDesc);
-        m_Allocator.DestroyBuffer(m_LightModelsBuffer);
+        // the device is idle, and the deletions still need the allocator the renderer outlives
+        m_Renderer.GetDeletionQueue().Flush();
 
         vkDestroyRenderPass(m_Device, m_OffscreenRenderPass, nullptr);
         vkDestroyFramebuffer(m_Device, m_OffscreenFramebuffer, nullptr);
         m_Allocator.DestroyTexture(m_OffscreenColor[0]);
         m_Allocator.DestroyTexture(m_OffscreenColor[1]);
-        m_Allocator.DestroyTexture(m_OffscreenColor[2]);
 
-        m_Allocator.DestroyTexture(m_OffscreenDepth);
-        m_Allocator.DestroyTexture(m_OffscreenPositionBuffer);
+        m_TransientAttachments.Destroy();
 
 
         vkDestroySampler(m_Device, m_TextureSampler, nullptr);
@@ -563,18 +555,11 @@ namespace CLAR {
 
         for (auto& [name, model] : m_Models)
         {
-            m_Allocator.DestroyBuffer(model->m_VertexBuffer);
-            m_Allocator.DestroyBuffer(model->m_IndexBuffer);
+            model->DestroyBuffers(m_GeometryPool);
             delete model;
         }
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
-		{
-			m_Allocator.DestroyBuffer(m_UniformBuffers[i]);
-            m_Allocator.DestroyBuffer(m_PostUniformBuffers[i]);
-		}
-
-        m_Allocator.DestroyAccelerationStructure(m_Tlas);
+        m_RtBuilder.DestroyTlas(m_Tlas);
         for (auto& blas : buildAs)
 		{
             m_Allocator.DestroyAccelerationStructure(blas.as);
@@ -623,6 +608,12 @@ namespace CLAR {
 
     void HelloTriangleApplication::drawFrame() {
 
+        // copies recorded since the last frame go out without stalling it, whoever needs them done flushes
+        m_Allocator.StreamUploads();
+
+        if (m_Defragment)
+            m_Allocator.Defragment(m_Renderer.GetDeletionQueue(), std::chrono::microseconds(static_cast<int64_t>(m_DefragmentBudgetMs * 1000.0f)));
+
         {
             auto ComputeCommandBuffer = m_Renderer.BeginCompute();
 
@@ -716,6 +707,59 @@ namespace CLAR {
                     ImGui::Checkbox("Ray Tracer mode", &useRaytracer);  // Switch between raster and ray tracing
                     ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
 
+                    if (ImGui::CollapsingHeader("GPU Memory"))
+                    {
+                        constexpr float MiB = 1024.0f * 1024.0f;
+
+                        auto heaps = m_Allocator.GetHeapBudgets();
+                        for (size_t i = 0; i < heaps.size(); i++)
+                        {
+                            const auto& heap = heaps[i];
+                            ImGui::Text("Heap %zu%s: %.1f / %.1f MiB", i, heap.deviceLocal ? " (device local)" : "", heap.usage / MiB, heap.budget / MiB);
+                            ImGui::ProgressBar(heap.budget ? float(heap.usage) / heap.budget : 0.0f, ImVec2(-1.0f, 0.0f));
+                        }
+
+                        auto categories = m_Allocator.GetCategoryStats();
+                        for (size_t i = 0; i < categories.size(); i++)
+                        {
+                            ImGui::Text("%s: %.1f MiB in %u allocations", MemoryCategoryName(static_cast<MemoryCategory>(i)),
+                                categories[i].bytes / MiB, categories[i].allocations);
+                        }
+
+                        ImGui::Text("Transient targets: %.1f MiB in %u slots, %.1f MiB unaliased", m_TransientAttachments.Bytes() / MiB,
+                            m_TransientAttachments.SlotCount(), m_TransientAttachments.UnaliasedBytes() / MiB);
+
+                        const BlasCompactionStats& compaction = m_RtBuilder.GetCompactionStats();
+                        ImGui::Text("BLAS: %.1f MiB, %.1f MiB before compacting %u of %u", compaction.compactedBytes / MiB,
+                            compaction.builtBytes / MiB, compaction.compactedCount, compaction.blasCount);
+
+                        const TextureBudgetStats& textureBudget = tm.GetBudgetStats();
+                        ImGui::Text("Textures over budget: %u shrunk, %u mip levels dropped, %.1f MiB saved", textureBudget.shrunkCount,
+                            textureBudget.droppedLevels, textureBudget.savedBytes / MiB);
+
+                        ImGui::Checkbox("Defragment", &m_Defragment);
+                        ImGui::SliderFloat("Budget (ms/frame)", &m_DefragmentBudgetMs, 0.1f, 4.0f);
+                        ImGui::Text("Moved %llu allocations, %.1f MiB", static_cast<unsigned long long>(m_Allocator.DefragmentedAllocations()),
+                            m_Allocator.DefragmentedBytes() / MiB);
+
+                        if (ImGui::Button("Dump VMA statistics"))
+                            m_Allocator.DumpStatistics("vma_stats.json");
+                    }
+
+                    if (ImGui::CollapsingHeader("TLAS"))
+                    {
+                        const TlasStats& stats = m_Tlas.stats;
+                        ImGui::Text("%llu refits, %llu rebuilds", static_cast<unsigned long long>(stats.refits), static_cast<unsigned long long>(stats.rebuilds));
+                        ImGui::Text("Since the last build: %u refits, bounds grew %.2fx, moved %.2f scene diagonals",
+                            stats.refitsSinceBuild, stats.boundsGrowth, stats.motion);
+
+                        TlasRebuildPolicy policy = m_RtBuilder.GetTlasRebuildPolicy();
+                        bool changed = ImGui::SliderFloat("Max bounds growth", &policy.maxBoundsGrowth, 1.0f, 4.0f);
+                        changed |= ImGui::SliderFloat("Max motion", &policy.maxMotion, 0.1f, 10.0f);
+                        if (changed)
+                            m_RtBuilder.SetTlasRebuildPolicy(policy);
+                    }
+
                     ImGui::SeparatorText("Scene Hierarchy");
 
                     for (size_t i = 0; i < m_Instances.size(); i++) {
@@ -758,6 +802,9 @@ namespace CLAR {
                             m_InstanceUpdated |= ImGui::DragFloat3("Rotation", reinterpret_cast<float*>(&instance.rotation), 0.01f);
                             m_InstanceUpdated |= ImGui::DragFloat3("Scale", reinterpret_cast<float*>(&instance.scale), 0.01f);
 
+                            if (!instance.model->materials.empty() && ImGui::Checkbox("Model Materials", &instance.modelMaterials))
+                                objDescription.modelMaterials = instance.modelMaterials;
+
                             //ImGui::Checkbox("Is Visible", &instance.visible);
                             const char* labels[] = { "Lambertian", "Metal", "Dielectric", "Diffuse Light" };
                             const MaterialType values[] = { MaterialType::LAMBERTIAN, MaterialType::METAL, MaterialType::DIELECTRIC, MaterialType::DIFFUSE_LIGHT };  // Actual values
@@ -824,6 +871,9 @@ namespace CLAR {
 
         if (auto commandBuffer = m_Renderer.BeginFrame())
         {
+            // after BeginFrame, the frame that last used this slot of the frame allocator is done
+            Update(commandBuffer, m_Renderer.GetCurrentFrame());
+
             /*{
                 gridSystem.BindPL(commandBuffer);
                 gridSystem.BindDescSet(commandBuffer, &m_DescriptorSets[m_Renderer.GetCurrentFrame()]);
@@ -843,6 +893,10 @@ namespace CLAR {
             }*/
             if (useRaytracer)
             {
+                // the previous post pass is done reading what this trace overwrites
+                for (auto target : { m_NoisyColor, m_PositionMap })
+                    m_TransientAttachments.Barrier(commandBuffer, target, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+                        VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
 
                 raytrace(commandBuffer, clearColor);
 
@@ -872,6 +926,9 @@ namespace CLAR {
             }
             else
             {
+                m_TransientAttachments.Acquire(commandBuffer, m_OffscreenDepth, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
                 VkRenderPassBeginInfo offscreenRenderPassBeginInfo{ VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
                 offscreenRenderPassBeginInfo.clearValueCount = 2;
                 offscreenRenderPassBeginInfo.pClearValues = clearValues.data();
@@ -881,19 +938,24 @@ namespace CLAR {
 
                 m_Renderer.BeginRenderPass(offscreenRenderPassBeginInfo);
 
-                renderSystem.Prepare(commandBuffer, &m_DescriptorSets[m_Renderer.GetCurrentFrame()]);
+                renderSystem.Prepare(commandBuffer, &m_DescriptorSets[m_Renderer.GetCurrentFrame()], m_SceneDynamicOffsets);
                 m_Models["cube"]->Draw(commandBuffer);
                 m_Models["square"]->Draw(commandBuffer);
 
                 m_Renderer.EndRenderPass();
             }
 
+            // the post pass reads this frame's trace, or the last one in raster mode
+            for (auto target : { m_NoisyColor, m_PositionMap })
+                m_TransientAttachments.Barrier(commandBuffer, target, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_SHADER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
             // QUAD bulshit and iamgui
             {
                 
                 m_Renderer.BeginRenderPass();
 
-                postSystem.Prepare(commandBuffer, &m_PostDescriptorSets[m_Renderer.GetCurrentFrame()]);
+                postSystem.Prepare(commandBuffer, &m_PostDescriptorSets[m_Renderer.GetCurrentFrame()], m_PostDynamicOffsets);
                 postSystem.PushConstants(commandBuffer, m_pcRay);
                 vkCmdDraw(commandBuffer, 3, 1, 0, 0);
 
@@ -907,9 +969,9 @@ namespace CLAR {
 
     }
 
-    void HelloTriangleApplication::Update(uint32_t currentImage) {
+    void HelloTriangleApplication::Update(VkCommandBuffer commandBuffer, uint32_t currentImage) {
 
-        m_ProjMatrices[currentImage] = glm::perspective(glm::radians(60.0f), (float)m_Renderer.GetSwapChainExtent().width / m_Renderer.GetSwapChainExtent().height, 0.1f, 10.0f);
+        m_ProjMatrices[currentImage] = glm::perspective(glm::radians(FOV_Y), (float)m_Renderer.GetSwapChainExtent().width / m_Renderer.GetSwapChainExtent().height, 0.1f, 10.0f);
         m_ProjMatrices[currentImage][1][1] *= -1;
         m_ViewMatrices[currentImage] = camera.LookAt();
 
@@ -921,26 +983,37 @@ namespace CLAR {
                 .proj = glm::inverse(m_ProjMatrices[currentImage])
         };
 
-        m_UniformBuffers[currentImage].Write(&ubo, sizeof(UniformBufferObject));
-        m_BobjDesc.Write(m_ObjectDescriptions.data(), m_ObjectDescriptions.size() * sizeof(ObjDesc));
+        m_FrameAllocator.BeginFrame(currentImage);
 
-        auto reprojectionMatrix = m_ProjMatrices[(currentImage - 1) % 2] * m_ViewMatrices[(currentImage - 1) % 2];
-        m_PostUniformBuffers[currentImage].Write(&reprojectionMatrix, sizeof(glm::mat4));
+        // a LOD switch swaps the BLAS in the TLAS and the index and geometry buffers in ObjDesc
+        if (SelectLods())
+            m_InstanceUpdated = true;
 
         if (m_InstanceUpdated)
         {
-            std::vector<LightDesc> lightDescription(10);
+            m_LightDescriptions.assign(MAX_LIGHTS, LightDesc{});
             m_pcRay.lightsNumber = 0;
             for (size_t i = 0; i < m_Instances.size(); ++i) 
             {
                 if (m_Instances[i].second.material->GetType() == MaterialType::DIFFUSE_LIGHT)
                 {
-                    lightDescription[m_pcRay.lightsNumber++] = { m_Instances[i].second.TransformMatrix(), (uint32_t)i };
+                    m_LightDescriptions[m_pcRay.lightsNumber++] = { m_Instances[i].second.TransformMatrix(), (uint32_t)i };
                 }
             }
+        }
 
-            m_LightModelsBuffer.Write(lightDescription.data(), lightDescription.size() * sizeof(LightDesc));
-            
+        // every frame in flight reads its own copy, so all of it is pushed again each frame
+        m_SceneDynamicOffsets = {
+            m_FrameAllocator.Push(ubo).DynamicOffset(),
+            m_FrameAllocator.Push(m_ObjectDescriptions).DynamicOffset(),
+            m_FrameAllocator.Push(m_LightDescriptions).DynamicOffset()
+        };
+
+        auto reprojectionMatrix = m_ProjMatrices[(currentImage - 1) % 2] * m_ViewMatrices[(currentImage - 1) % 2];
+        m_PostDynamicOffsets = { m_FrameAllocator.Push(reprojectionMatrix).DynamicOffset() };
+
+        if (m_InstanceUpdated)
+        {
 
             m_InstanceUpdated = false;
             std::vector<VkAccelerationStructureInstanceKHR> instances;
@@ -956,28 +1029,80 @@ namespace CLAR {
                 instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
                 //VK_GEOMETRY_INSTANCE_TRIANGLE_FRONT_COUNTERCLOCKWISE_BIT_KHR;
 
-                // write a function to get the device address of the element in buildas whose blasId is ins.blasId
-                auto blas = std::find_if(buildAs.begin(), buildAs.end(), [&](const ASBuildInfo& b) { return b.blasId == ins.model->id; });
-                VkAccelerationStructureDeviceAddressInfoKHR addressInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR };
-                addressInfo.accelerationStructure = blas->as.handle;
-                instance.accelerationStructureReference = vkGetAccelerationStructureDeviceAddressKHR(m_Device, &addressInfo);
+                instance.accelerationStructureReference = BlasAddress(ins.model, ins.lod);
 
                 instances.push_back(instance);
             }
-            m_Tlas = m_RtBuilder.UpdateTlas(m_Tlas, instances);
+            // only the instances that changed are copied, in this frame's command buffer
+            m_RtBuilder.UpdateTlas(commandBuffer, m_Tlas, instances, m_FrameAllocator);
+        }
+    }
+
+    VkDeviceAddress HelloTriangleApplication::BlasAddress(const Model* model, uint32_t lod) const
+    {
+        auto blas = std::ranges::find_if(buildAs, [&](const ASBuildInfo& b) { return b.blasId == model->id && b.lod == lod; });
+
+        // every instance's model and LOD should have a BLAS; without one the instance stays in the TLAS,
+        // so updates keep their indices, but a null reference makes it inactive
+        assert(blas != buildAs.end());
+        if (blas == buildAs.end())
+            return 0;
+
+        VkAccelerationStructureDeviceAddressInfoKHR addressInfo{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR };
+        addressInfo.accelerationStructure = blas->as.handle;
+        return vkGetAccelerationStructureDeviceAddressKHR(m_Device, &addressInfo);
+    }
+
+    // Picks each instance's LOD from its size on screen, returns whether any of them changed
+    bool HelloTriangleApplication::SelectLods()
+    {
+        float pixelScale = m_Renderer.GetSwapChainExtent().height / (2.0f * std::tan(glm::radians(FOV_Y) * 0.5f));
+        bool changed = false;
+
+        for (size_t i = 0; i < m_Instances.size(); ++i)
+        {
+            auto& instance = m_Instances[i].second;
+            uint32_t lod = instance.model->SelectLod(instance.TransformMatrix(), camera.position, pixelScale);
+            if (lod == instance.lod)
+                continue;
+
+            instance.lod = lod;
+            m_ObjectDescriptions[i].indexAddress = instance.model->LodIndexRange(lod).address;
+            m_ObjectDescriptions[i].geometryAddress = instance.model->LodGeometryRange(lod).address;
+            changed = true;
         }
+
+        return changed;
     }
 
-    BlasInput HelloTriangleApplication::ModelToVkgeometry(const Model* model)
+    // Re-reads the geometry addresses of every object description after their ranges moved
+    void HelloTriangleApplication::RefreshObjectAddresses()
+    {
+        for (size_t i = 0; i < m_Instances.size(); ++i)
+        {
+            const auto& instance = m_Instances[i].second;
+            auto& desc = m_ObjectDescriptions[i];
+
+            desc.vertexAddress = instance.model->m_VertexRange.address;
+            desc.indexAddress = instance.model->LodIndexRange(instance.lod).address;
+            desc.geometryAddress = instance.model->LodGeometryRange(instance.lod).address;
+            desc.colorAddress = instance.model->m_ColorRange.address;
+            desc.attributeAddress = instance.model->m_AttributeRange.address;
+        }
+    }
+
+    BlasInput HelloTriangleApplication::ModelToVkgeometry(const Model* model, uint32_t lod)
     {
         VkAccelerationStructureGeometryTrianglesDataKHR triangles{};
         triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
         triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-        triangles.vertexData.deviceAddress = m_Device.GetBufferDeviceAddress(model->m_VertexBuffer.buffer);
-        triangles.vertexStride = sizeof(Vertex);
-        triangles.maxVertex = static_cast<uint32_t>(model->mesh.size()) - 1;
+        triangles.vertexData.deviceAddress = model->m_VertexRange.address;
+        triangles.vertexStride = model->VertexStride();
+        triangles.maxVertex = model->VertexCount() - 1;
         triangles.indexType = VK_INDEX_TYPE_UINT32;
-        triangles.indexData.deviceAddress = m_Device.GetBufferDeviceAddress(model->m_IndexBuffer.buffer);
+        // indices are addressed from the start of the index megabuffer, the ranges carry the model's offset
+        const GeometryRange& indexRange = model->LodIndexRange(lod);
+        triangles.indexData.deviceAddress = indexRange.address - indexRange.offset;
         triangles.transformData = {};
 
         VkAccelerationStructureGeometryKHR asGeom{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR };
@@ -985,13 +1110,24 @@ namespace CLAR {
         asGeom.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
         asGeom.geometry.triangles = triangles;
 
-        VkAccelerationStructureBuildRangeInfoKHR offset;
-        offset.firstVertex = 0;
-        offset.primitiveCount = static_cast<uint32_t>(model->indices.size()) / 3;
-        offset.primitiveOffset = 0;
-        offset.transformOffset = 0;
+        // one geometry per submesh, all of them reading the same index buffer from their own range
+        BlasInput input{ model->id, lod };
+        for (const Submesh& submesh : model->LodSubmeshes(lod))
+        {
+            VkAccelerationStructureBuildRangeInfoKHR offset;
+            offset.firstVertex = 0;
+            offset.primitiveCount = submesh.indexCount / 3;
+            offset.primitiveOffset = static_cast<uint32_t>(indexRange.offset + submesh.firstIndex * sizeof(uint32_t));
+            offset.transformOffset = 0;
+
+            input.asGeometry.push_back(asGeom);
+            input.asBuildOffset.push_back(offset);
+        }
+
+        if (m_RtBuilder.HasCache())
+            input.cacheKey = AsCache::GeometryKey(*model, lod, RTBuilder::BlasBuildFlags(input.compact));
 
-        return { model->id, asGeom, offset };
+        return input;
     }
 
     void HelloTriangleApplication::CreateRtDescriptorSets()
@@ -1007,14 +1143,14 @@ namespace CLAR {
 		{
             VkWriteDescriptorSetAccelerationStructureKHR descASInfo{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR };
             descASInfo.accelerationStructureCount = 1;
-            descASInfo.pAccelerationStructures = &m_Tlas.handle;
+            descASInfo.pAccelerationStructures = &m_Tlas.as.handle;
             /*VkDescriptorImageInfo lastImageInfo{ {}, m_OffscreenColor[(i - 1) % MAX_FRAMES_IN_FLIGHT].descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL};
             VkDescriptorImageInfo currentImageInfo{ {}, m_OffscreenColor[i].descriptor.imageView, VK_IMAGE_LAYOUT_GENERAL };*/
 
 			DescritorWriter()
 				.WriteAccelerationStructure(0, &descASInfo)
-				.WriteStorageImage(1, &m_OffscreenPositionBuffer.descriptor)
-                .WriteStorageImage(2, &m_OffscreenColor[2].descriptor) // use the last image as a buffer for the path tracing calculation
+				.WriteStorageImage(1, &m_TransientAttachments.Get(m_PositionMap).descriptor)
+                .WriteStorageImage(2, &m_TransientAttachments.Get(m_NoisyColor).descriptor) // the buffer for the path tracing calculation
 				.Update(m_RtDescriptorSets[i], m_Device);
 		}
     }
@@ -1091,7 +1227,8 @@ namespace CLAR {
 
         std::vector<VkDescriptorSet> descSets{ m_RtDescriptorSets[m_Renderer.GetCurrentFrame()], m_DescriptorSets[m_Renderer.GetCurrentFrame()] };
         
-        rtSystem.Prepare(cmdBuf, descSets);
+        // the ray tracing set has no dynamic bindings, the offsets are all the scene set's
+        rtSystem.Prepare(cmdBuf, descSets, m_SceneDynamicOffsets);
 
         rtSystem.PushConstants(cmdBuf, m_pcRay);
 
@@ -1102,57 +1239,24 @@ namespace CLAR {
     {
         m_Allocator.DestroyTexture(m_OffscreenColor[0]);
         m_Allocator.DestroyTexture(m_OffscreenColor[1]);
-        m_Allocator.DestroyTexture(m_OffscreenDepth);
-        m_Allocator.DestroyTexture(m_OffscreenPositionBuffer);
-
-        // color image
-        {
-            Image image = m_Allocator.CreateImage(m_Renderer.GetSwapChainExtent(), m_OffscreenColorFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
-                | VK_IMAGE_USAGE_STORAGE_BIT);
-
-            m_OffscreenColor[0] = m_Allocator.CreateTexture(image, m_OffscreenColorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
-            m_Device.transitionImageLayout(image.image, m_OffscreenColorFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1);
-            m_OffscreenColor[0].descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-        }
-
-        {
-            Image image = m_Allocator.CreateImage(m_Renderer.GetSwapChainExtent(), m_OffscreenColorFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
-                | VK_IMAGE_USAGE_STORAGE_BIT);
-
-            m_OffscreenColor[1] = m_Allocator.CreateTexture(image, m_OffscreenColorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
-            m_Device.transitionImageLayout(image.image, m_OffscreenColorFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1);
-            m_OffscreenColor[1].descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-        }
 
+        // accumulation history
+        for (auto& color : m_OffscreenColor)
         {
             Image image = m_Allocator.CreateImage(m_Renderer.GetSwapChainExtent(), m_OffscreenColorFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
-                | VK_IMAGE_USAGE_STORAGE_BIT);
+                | VK_IMAGE_USAGE_STORAGE_BIT, 0, VK_SAMPLE_COUNT_1_BIT, 1, MemoryCategory::RenderTarget);
 
-            m_OffscreenColor[2] = m_Allocator.CreateTexture(image, m_OffscreenColorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+            color = m_Allocator.CreateTexture(image, m_OffscreenColorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
             m_Device.transitionImageLayout(image.image, m_OffscreenColorFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1);
-            m_OffscreenColor[2].descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+            color.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
         }
 
+        // noisy image, position buffer and depth image, laid out in memory by their pass ranges
+        m_TransientAttachments.Build(m_Renderer.GetSwapChainExtent());
 
-        // position buffer
-        {
-            Image image = m_Allocator.CreateImage(m_Renderer.GetSwapChainExtent(), m_OffscreenPositionBufferFormat, VK_IMAGE_USAGE_SAMPLED_BIT
-				| VK_IMAGE_USAGE_STORAGE_BIT);
-            
-			m_OffscreenPositionBuffer = m_Allocator.CreateTexture(image, m_OffscreenPositionBufferFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
-            m_Device.transitionImageLayout(image.image, m_OffscreenPositionBufferFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1);
-            m_OffscreenPositionBuffer.descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-        }
-
-
-        // depth image
-        {
-			Image image = m_Allocator.CreateImage(m_Renderer.GetSwapChainExtent(), m_OffscreenDepthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
-
-			m_OffscreenDepth = m_Allocator.CreateTexture(image, m_OffscreenDepthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
-            m_Device.transitionImageLayout(image.image, m_OffscreenDepthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
-            m_OffscreenDepth.descriptor.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-		}
+        // the trace images are never acquired, they keep their layout from here on
+        m_Device.transitionImageLayout(m_TransientAttachments.Get(m_NoisyColor).image.image, m_OffscreenColorFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1);
+        m_Device.transitionImageLayout(m_TransientAttachments.Get(m_PositionMap).image.image, m_OffscreenPositionBufferFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 1);
 
         VkAttachmentDescription colorAttachment{
             .format = m_OffscreenColorFormat,
@@ -1234,7 +1338,7 @@ namespace CLAR {
             throw std::runtime_error("failed to create render pass!");
         }
 
-        std::array<VkImageView, 2> frameBufferAttachments = { m_OffscreenColor[0].descriptor.imageView, m_OffscreenDepth.descriptor.imageView};
+        std::array<VkImageView, 2> frameBufferAttachments = { m_OffscreenColor[0].descriptor.imageView, m_TransientAttachments.Get(m_OffscreenDepth).descriptor.imageView };
 
         VkFramebufferCreateInfo frameBufferInfo{
             .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
@@ -12,6 +12,9 @@
 
 #include "ClarUbo.h"
 #include "ClarModel.h"
+#include "ClarModelLoader.h"
+#include "ClarGeometryUploader.h"
+#include "ClarGltfLoader.h"
 
 #include "ClarShaderStorageBuffer.h"
 #include "ClarGridSystem.h"
@@ -26,6 +29,8 @@
 #include "imgui/imgui_impl_vulkan.h"
 #include "imgui/imgui_impl_glfw.h"
 #include "ClarAllocator.h"
+#include "ClarFrameAllocator.h"
+#include "ClarTransientAttachments.h"
 
 #include "ClarMaterial.h"
 #include "ClarRTBuilder.h"
@@ -52,6 +57,9 @@ namespace CLAR {
     struct ObjDesc {
         VkDeviceAddress vertexAddress;
         VkDeviceAddress indexAddress;
+        VkDeviceAddress colorAddress; // 0 when the model has no color stream
+        VkDeviceAddress attributeAddress; // VertexAttributes stream of the split layout, 0 otherwise
+        VkDeviceAddress geometryAddress; // GeometryDesc per BLAS geometry of the current LOD
         glm::vec3 albedo;
         MaterialType material;
         union
@@ -60,15 +68,30 @@ namespace CLAR {
             float refractionIndex;
             float lightIntensity;
         };
+        uint32_t vertexFormat; // VertexFormat of the vertex buffer
+        uint32_t modelMaterials; // shade with the GeometryDesc materials instead of the ones above
+        uint32_t padding; // the GLSL scalar layout has no tail padding, keep the stride explicit
     };
+    static_assert(sizeof(ObjDesc) == 72, "ObjDesc must match the scalar layout in raytrace.rchit");
 
     struct LightDesc {
         glm::mat4 model;
         uint32_t index;
 	};
 
+    const uint32_t MAX_LIGHTS = 10;
+
+    // Passes of a frame in recording order, the lifetimes of the transient attachments. A frame runs either the
+    // raster or the trace pass, so targets confined to one of them could share memory with the other's.
+    enum FramePass : uint32_t {
+        RasterPass,
+        TracePass,
+        PostPass
+    };
+
     const uint32_t WIDTH = 1280;
     const uint32_t HEIGHT = 720;
+    const float FOV_Y = 60.0f; // degrees
 
     const std::string MODEL_PATH = "../models/viking_room.obj";
     const std::string TEXTURE_PATH = "../textures/texture.jpg";
@@ -90,12 +113,18 @@ namespace CLAR {
 
         Allocator m_Allocator{ m_Device };
 
-        RTBuilder m_RtBuilder{ m_Device, m_Allocator };
+        // uniforms, object and light tables and TLAS instances of each frame in flight
+        FrameAllocator m_FrameAllocator{ m_Device, m_Allocator };
+
+        // vertex and index megabuffers every model takes its ranges from
+        GeometryPool m_GeometryPool{ m_Device, m_Allocator };
+
+        RTBuilder m_RtBuilder{ m_Device, m_Allocator, m_Renderer.GetDeletionQueue() };
+
+        ThreadPool m_ThreadPool;
 
         std::unordered_map<std::string, Model*> m_Models;
 
-        std::vector<Buffer> m_UniformBuffers;
-        std::vector<Buffer> m_PostUniformBuffers;
         std::vector<Buffer> m_ComputeUniformBuffers;
 
         UniformBufferObject ubo{};
@@ -106,6 +135,8 @@ namespace CLAR {
 
         DescriptorSetLayout m_DescriptorSetLayout{ m_Device };
         std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> m_DescriptorSets;
+        // of the ubo, object description and light bindings, set by Update for the frame being recorded
+        std::array<uint32_t, 3> m_SceneDynamicOffsets{};
         GridSystem gridSystem{ m_Device };
 
         TextureManager tm{ m_Device, m_Allocator };
@@ -122,14 +153,19 @@ namespace CLAR {
         void createTextureSampler();
 
         void drawFrame();
-        void Update(uint32_t currentImage);
-        BlasInput ModelToVkgeometry(const Model* model);
+        // Also records the TLAS refit into the frame's commandBuffer, ahead of raytrace
+        void Update(VkCommandBuffer commandBuffer, uint32_t currentImage);
+        BlasInput ModelToVkgeometry(const Model* model, uint32_t lod = 0);
+        VkDeviceAddress BlasAddress(const Model* model, uint32_t lod) const;
+        bool SelectLods();
+        void RefreshObjectAddresses();
 
         RenderSystem renderSystem{ m_Device };
         PostSystem postSystem{ m_Device };
 
         DescriptorSetLayout m_PostDescriptorSetLayout{ m_Device };
         std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> m_PostDescriptorSets;
+        std::array<uint32_t, 1> m_PostDynamicOffsets{};
 
         DescriptorSetLayout ImGuiDescriptorSetLayout{ m_Device };
         std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> ImGuiDescriptorSets;
@@ -147,7 +183,7 @@ namespace CLAR {
         Buffer m_AccelerationStructureBuffer;
         Buffer m_TLAccelerationStructureBuffer;*/
 
-        AccelerationStructure m_Tlas;
+        TopLevelAS m_Tlas;
         std::vector<ASBuildInfo> buildAs;
 
         DescriptorSetLayout m_RtDescriptorSetLayout{ m_Device };
@@ -156,9 +192,11 @@ namespace CLAR {
 
         VkRenderPass         m_OffscreenRenderPass{ VK_NULL_HANDLE };
         VkFramebuffer        m_OffscreenFramebuffer{ VK_NULL_HANDLE };
-        std::vector<Texture> m_OffscreenColor;
-        Texture              m_OffscreenPositionBuffer;
-        Texture              m_OffscreenDepth;
+        std::vector<Texture> m_OffscreenColor; // accumulation history, read and written by the post pass of alternate frames
+        TransientAttachmentPool m_TransientAttachments{ m_Device, m_Allocator };
+        TransientAttachmentPool::Handle m_NoisyColor;
+        TransientAttachmentPool::Handle m_PositionMap;
+        TransientAttachmentPool::Handle m_OffscreenDepth;
         VkFormat             m_OffscreenColorFormat{ VK_FORMAT_R32G32B32A32_SFLOAT };
         VkFormat             m_OffscreenDepthFormat{ VK_FORMAT_X8_D24_UNORM_PACK32 };
         VkFormat             m_OffscreenPositionBufferFormat{ VK_FORMAT_R32G32B32A32_SFLOAT };
@@ -174,8 +212,7 @@ namespace CLAR {
         void raytrace(const VkCommandBuffer& cmdBuf, const glm::vec4& clearColor);
 
         PushConstantRay m_pcRay {};
-        Buffer m_BobjDesc;
-        Buffer m_LightModelsBuffer;
+        std::vector<LightDesc> m_LightDescriptions = std::vector<LightDesc>(MAX_LIGHTS);
 
 
         std::vector<ObjDesc> m_ObjectDescriptions;
@@ -192,5 +229,9 @@ namespace CLAR {
 
 
         bool m_InstanceUpdated = false;
+
+        // opt-in, moves are done by the GPU within the per frame budget
+        bool m_Defragment = false;
+        float m_DefragmentBudgetMs = 0.5f;
     };
 }
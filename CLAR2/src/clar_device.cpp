@@ -1,5 +1,7 @@
 #include "clar_device.h"
 
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 #include <vector>
 #include <set>
@@ -24,6 +26,9 @@ namespace CLAR {
     PFN_vkCmdTraceRaysKHR vkCmdTraceRaysKHR;
     PFN_vkCmdWriteAccelerationStructuresPropertiesKHR vkCmdWriteAccelerationStructuresPropertiesKHR;
     PFN_vkCmdCopyAccelerationStructureKHR vkCmdCopyAccelerationStructureKHR;
+    PFN_vkCmdCopyAccelerationStructureToMemoryKHR vkCmdCopyAccelerationStructureToMemoryKHR;
+    PFN_vkCmdCopyMemoryToAccelerationStructureKHR vkCmdCopyMemoryToAccelerationStructureKHR;
+    PFN_vkGetDeviceAccelerationStructureCompatibilityKHR vkGetDeviceAccelerationStructureCompatibilityKHR;
     PFN_vkCmdTraceRaysNV vkCmdTraceRaysNV;
     PFN_vkCmdBeginDebugUtilsLabelEXT vkCmdBeginDebugUtilsLabelEXT;
     PFN_vkCmdEndDebugUtilsLabelEXT vkCmdEndDebugUtilsLabelEXT;
@@ -48,6 +53,9 @@ namespace CLAR {
         CLAR::vkCmdTraceRaysKHR = LoadFunction<PFN_vkCmdTraceRaysKHR>(m_Device, "vkCmdTraceRaysKHR");
         CLAR::vkCmdWriteAccelerationStructuresPropertiesKHR = LoadFunction<PFN_vkCmdWriteAccelerationStructuresPropertiesKHR>(m_Device, "vkCmdWriteAccelerationStructuresPropertiesKHR");
         CLAR::vkCmdCopyAccelerationStructureKHR = LoadFunction<PFN_vkCmdCopyAccelerationStructureKHR>(m_Device, "vkCmdCopyAccelerationStructureKHR");
+        CLAR::vkCmdCopyAccelerationStructureToMemoryKHR = LoadFunction<PFN_vkCmdCopyAccelerationStructureToMemoryKHR>(m_Device, "vkCmdCopyAccelerationStructureToMemoryKHR");
+        CLAR::vkCmdCopyMemoryToAccelerationStructureKHR = LoadFunction<PFN_vkCmdCopyMemoryToAccelerationStructureKHR>(m_Device, "vkCmdCopyMemoryToAccelerationStructureKHR");
+        CLAR::vkGetDeviceAccelerationStructureCompatibilityKHR = LoadFunction<PFN_vkGetDeviceAccelerationStructureCompatibilityKHR>(m_Device, "vkGetDeviceAccelerationStructureCompatibilityKHR");
 	    /*CLAR::vkCmdTraceRaysNV = LoadFunction<PFN_vkCmdTraceRaysNV>(m_Device, "vkCmdTraceRaysNV");
         CLAR::vkCmdBeginDebugUtilsLabelEXT = LoadFunction<PFN_vkCmdBeginDebugUtilsLabelEXT>(m_Device, "vkCmdBeginDebugUtilsLabelEXT");
         CLAR::vkCmdEndDebugUtilsLabelEXT = LoadFunction<PFN_vkCmdEndDebugUtilsLabelEXT>(m_Device, "vkCmdEndDebugUtilsLabelEXT");*/
@@ -65,7 +73,16 @@ namespace CLAR {
 
         for (size_t i = 0; i < queueFamilyCount; ++i)
         {
-            if ((queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) && (queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+            VkQueueFlags flags = queueFamilies[i].queueFlags;
+            if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) && !indices.transferFamily)
+            {
+                indices.transferFamily = i;
+            }
+
+            // the transfer family can come after, keep looking for it but not for the others
+            if (indices) continue;
+
+            if ((flags & VK_QUEUE_GRAPHICS_BIT) && (flags & VK_QUEUE_COMPUTE_BIT)) {
                 indices.graphicsFamily = i;
             }
 
@@ -76,8 +93,6 @@ namespace CLAR {
             {
                 indices.presentFamily = i;
             }
-
-            if (indices) break;
         }
 
         return indices;
@@ -93,6 +108,11 @@ namespace CLAR {
         return m_PresentQueue;
     }
 
+    VkQueue Device::GetTransferQueue() const
+    {
+        return m_TransferQueue;
+    }
+
     VkDeviceAddress Device::GetBufferDeviceAddress(VkBuffer buffer) const
     {
         VkBufferDeviceAddressInfoKHR bufferInfo{
@@ -218,6 +238,8 @@ namespace CLAR {
 
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
         std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+        if (indices.transferFamily)
+            uniqueQueueFamilies.insert(indices.transferFamily.value());
 
         float queuePriority = 1.0f;
         for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -247,8 +269,14 @@ namespace CLAR {
             .pEnabledFeatures = &deviceFeatures
         };
 
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+        // the driver's budget, without it VMA estimates one from the heap sizes
+        std::vector<const char*> enabledExtensions = deviceExtensions;
+        m_MemoryBudget = isExtensionAvailable(m_PhysicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        if (m_MemoryBudget)
+            enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+        createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
         if (enableValidationLayer) {
             createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -311,6 +339,8 @@ namespace CLAR {
 
         vkGetDeviceQueue(m_Device, indices.graphicsFamily.value(), 0, &m_GraphicsQueue);
         vkGetDeviceQueue(m_Device, indices.presentFamily.value(), 0, &m_PresentQueue);
+        if (indices.transferFamily)
+            vkGetDeviceQueue(m_Device, indices.transferFamily.value(), 0, &m_TransferQueue);
     }
 
     void Device::CreateCommandPool()
@@ -323,7 +353,8 @@ namespace CLAR {
             .queueFamilyIndex = queueFamilyIndices.graphicsFamily.value()
         };
 
-        if (vkCreateCommandPool(m_Device, &poolInfo, nullptr, &m_CommandPool) != VK_SUCCESS) {
+        if (vkCreateCommandPool(m_Device, &poolInfo, nullptr, &m_CommandPool) != VK_SUCCESS ||
+            vkCreateCommandPool(m_Device, &poolInfo, nullptr, &m_AsyncCommandPool) != VK_SUCCESS) {
             throw std::runtime_error("failed to create command pool!");
         }
     }
@@ -384,6 +415,19 @@ namespace CLAR {
         return requiredExtension.empty();
     }
 
+    bool Device::isExtensionAvailable(VkPhysicalDevice device, const char* extension) const {
+        uint32_t count = 0;
+
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &count, nullptr);
+
+        std::vector<VkExtensionProperties> availableExtensions(count);
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &count, availableExtensions.data());
+
+        return std::ranges::any_of(availableExtensions, [extension](const VkExtensionProperties& properties) {
+            return strcmp(properties.extensionName, extension) == 0;
+            });
+    }
+
     SwapChainSupportDetails Device::querySwapChainSupport(VkPhysicalDevice device) const {
         SwapChainSupportDetails details;
 
@@ -747,9 +791,104 @@ namespace CLAR {
 
     void Device::SingleTimeCommand(const std::function<void(VkCommandBuffer&)>& func) const
     {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        // waits on its own fence, work submitted by others in the meantime does not hold it up
+        SubmitAsync(func).Wait();
+    }
+
+    GpuTicket Device::SubmitAsync(const std::function<void(VkCommandBuffer&)>& func) const
+    {
+        // the pool is externally synchronized, so the lock is held from allocation to submission
+        std::lock_guard lock(m_AsyncMutex);
+        RetireAsync(0, false);
+
+        VkCommandBuffer commandBuffer;
+        if (!m_FreeAsyncCommandBuffers.empty())
+        {
+            commandBuffer = m_FreeAsyncCommandBuffers.back();
+            m_FreeAsyncCommandBuffers.pop_back();
+        }
+        else
+        {
+            VkCommandBufferAllocateInfo allocInfo{
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = m_AsyncCommandPool,
+                .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                .commandBufferCount = 1,
+            };
+            vkAllocateCommandBuffers(m_Device, &allocInfo, &commandBuffer);
+        }
+
+        VkFence fence;
+        if (!m_FreeAsyncFences.empty())
+        {
+            fence = m_FreeAsyncFences.back();
+            m_FreeAsyncFences.pop_back();
+        }
+        else
+        {
+            VkFenceCreateInfo fenceInfo{ VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+            vkCreateFence(m_Device, &fenceInfo, nullptr, &fence);
+        }
+
+        // the pool resets command buffers on begin
+        VkCommandBufferBeginInfo beginInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+        };
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
         func(commandBuffer);
-        endSingleTimeCommands(commandBuffer);
+        vkEndCommandBuffer(commandBuffer);
+
+        VkSubmitInfo submitInfo{
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &commandBuffer
+        };
+        if (vkQueueSubmit(m_GraphicsQueue, 1, &submitInfo, fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit command buffer!");
+        }
+
+        m_AsyncInFlight.push_back({ ++m_AsyncSerial, commandBuffer, fence });
+        return GpuTicket(this, m_AsyncSerial);
+    }
+
+    void Device::RetireAsync(uint64_t serial, bool wait) const
+    {
+        while (!m_AsyncInFlight.empty())
+        {
+            AsyncSubmission& submission = m_AsyncInFlight.front();
+            if (wait && submission.serial <= serial)
+                vkWaitForFences(m_Device, 1, &submission.fence, VK_TRUE, UINT64_MAX);
+            else if (vkGetFenceStatus(m_Device, submission.fence) != VK_SUCCESS)
+                break;
+
+            vkResetFences(m_Device, 1, &submission.fence);
+            m_FreeAsyncFences.push_back(submission.fence);
+            m_FreeAsyncCommandBuffers.push_back(submission.commandBuffer);
+            m_AsyncCompleted = submission.serial;
+            m_AsyncInFlight.pop_front();
+        }
+    }
+
+    bool GpuTicket::IsDone() const
+    {
+        if (m_Device == nullptr)
+            return true;
+
+        std::lock_guard lock(m_Device->m_AsyncMutex);
+        if (m_Serial > m_Device->m_AsyncCompleted)
+            m_Device->RetireAsync(0, false);
+        return m_Serial <= m_Device->m_AsyncCompleted;
+    }
+
+    void GpuTicket::Wait() const
+    {
+        if (m_Device == nullptr)
+            return;
+
+        std::lock_guard lock(m_Device->m_AsyncMutex);
+        if (m_Serial > m_Device->m_AsyncCompleted)
+            m_Device->RetireAsync(m_Serial, true);
     }
 
     VkExtent2D Device::GetExtent() const
@@ -775,6 +914,11 @@ namespace CLAR {
 
     Device::~Device()
     {
+        RetireAsync(m_AsyncSerial, true);
+        for (VkFence fence : m_FreeAsyncFences)
+            vkDestroyFence(m_Device, fence, nullptr);
+
+        vkDestroyCommandPool(m_Device, m_AsyncCommandPool, nullptr);
         vkDestroyCommandPool(m_Device, m_CommandPool, nullptr);
 
         vkDestroyDevice(m_Device, nullptr);
@@ -3,7 +3,9 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <deque>
 #include <functional>
+#include <mutex>
 
 #include "clar_queue_family_indices.h"
 #include "clar_swapchain_support_details.h"
@@ -24,6 +26,9 @@ namespace CLAR {
 	extern PFN_vkCmdTraceRaysKHR vkCmdTraceRaysKHR;
 	extern PFN_vkCmdWriteAccelerationStructuresPropertiesKHR vkCmdWriteAccelerationStructuresPropertiesKHR;
 	extern PFN_vkCmdCopyAccelerationStructureKHR vkCmdCopyAccelerationStructureKHR;
+	extern PFN_vkCmdCopyAccelerationStructureToMemoryKHR vkCmdCopyAccelerationStructureToMemoryKHR;
+	extern PFN_vkCmdCopyMemoryToAccelerationStructureKHR vkCmdCopyMemoryToAccelerationStructureKHR;
+	extern PFN_vkGetDeviceAccelerationStructureCompatibilityKHR vkGetDeviceAccelerationStructureCompatibilityKHR;
 	extern PFN_vkCmdBeginDebugUtilsLabelEXT vkCmdBeginDebugUtilsLabelEXT;
 	extern PFN_vkCmdEndDebugUtilsLabelEXT vkCmdEndDebugUtilsLabelEXT;
 
@@ -39,6 +44,24 @@ namespace CLAR {
 		VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME,
 	};
 
+	class Device;
+
+	// Completion token of a Device::SubmitAsync submission. Copies are cheap and stay valid after the work is
+	// done and its command buffer recycled; a default constructed ticket is always done.
+	class GpuTicket {
+	public:
+		GpuTicket() = default;
+
+		bool IsDone() const;
+		void Wait() const;
+	private:
+		friend class Device;
+		GpuTicket(const Device* device, uint64_t serial) : m_Device(device), m_Serial(serial) {}
+
+		const Device* m_Device = nullptr;
+		uint64_t m_Serial = 0;
+	};
+
 	class Device {
 	public:
 		Device(Window& window);
@@ -65,6 +88,9 @@ namespace CLAR {
 		VkCommandBuffer beginSingleTimeCommands() const;
 		void endSingleTimeCommands(VkCommandBuffer commandBuffer) const;
 		void SingleTimeCommand(const std::function<void(VkCommandBuffer&)>& func) const;
+		// Records func into a recycled command buffer and submits it to the graphics queue with a fence, without
+		// waiting. Later graphics submissions are ordered after it, so only CPU side consumers need the ticket.
+		GpuTicket SubmitAsync(const std::function<void(VkCommandBuffer&)>& func) const;
 		void CreateImage(const VkImageCreateInfo& imageInfo, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) const;
 		VkImageView CreateImageView(VkImage& image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels) const;
 		void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels) const;
@@ -78,11 +104,15 @@ namespace CLAR {
 
 		VkQueue GetGraphicsQueue() const;
 		VkQueue GetPresentQueue() const;
+		// Queue of QueueFamilyIndices::transferFamily, VK_NULL_HANDLE when the GPU has no transfer only family
+		VkQueue GetTransferQueue() const;
 
 		VkPhysicalDevice GPU() const { return m_PhysicalDevice; };
 		operator VkDevice() const { return m_Device; };
 		VkInstance GetInstance() const { return m_Instance; };
 		VkDeviceAddress GetBufferDeviceAddress(VkBuffer buffer) const;
+		// VK_EXT_memory_budget is optional, it is enabled whenever the GPU has it
+		bool HasMemoryBudget() const { return m_MemoryBudget; }
 
 	private:
 		VkInstance m_Instance;
@@ -99,17 +129,37 @@ namespace CLAR {
 
 		VkDevice m_Device;
 		void CreateLogicalDevice();
+		bool m_MemoryBudget = false;
 
 		VkCommandPool m_CommandPool;
+		VkCommandPool m_AsyncCommandPool;	// only touched under m_AsyncMutex, so loader threads never share a pool with the frame
 		void CreateCommandPool();
 
+		friend class GpuTicket;
+		struct AsyncSubmission {
+			uint64_t serial;
+			VkCommandBuffer commandBuffer;
+			VkFence fence;
+		};
+		// SubmitAsync work in submission order, its fences signal in that order too
+		mutable std::deque<AsyncSubmission> m_AsyncInFlight;
+		mutable std::vector<VkCommandBuffer> m_FreeAsyncCommandBuffers;
+		mutable std::vector<VkFence> m_FreeAsyncFences;
+		mutable uint64_t m_AsyncSerial = 0;		// of the last submission
+		mutable uint64_t m_AsyncCompleted = 0;	// every serial up to it is done
+		mutable std::recursive_mutex m_AsyncMutex;	// recursive because a SubmitAsync func may submit itself
+		// Recycles the finished submissions, first blocking until serial is done when wait is set
+		void RetireAsync(uint64_t serial, bool wait) const;
+
 		Window& m_Window;
 
 		VkQueue m_GraphicsQueue;
 		VkQueue m_PresentQueue;
+		VkQueue m_TransferQueue = VK_NULL_HANDLE;
 
 		int rateDeviceSuitability(VkPhysicalDevice device);
 		bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+		bool isExtensionAvailable(VkPhysicalDevice device, const char* extension) const;
 		VkSampleCountFlagBits getMaxUsableSampleCount() const;
 
 		QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device) const;
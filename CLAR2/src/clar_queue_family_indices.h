@@ -7,6 +7,8 @@ namespace CLAR {
     struct QueueFamilyIndices {
         std::optional<uint32_t> graphicsFamily;
         std::optional<uint32_t> presentFamily;
+        // transfer only family backed by the copy engines, missing on GPUs that do not expose one
+        std::optional<uint32_t> transferFamily;
 
         operator bool()
         {
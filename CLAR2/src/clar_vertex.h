@@ -9,6 +9,17 @@
 #include <glm/gtx/hash.hpp>
 #include <glm/glm.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// upload models as PackedVertex instead of the full float Vertex, see VertexFormat
+#define PACKED_VERTICES
+// with PACKED_VERTICES, keep positions in their own stream for BLAS builds and depth-only passes
+#define SPLIT_VERTEX_STREAMS
+
 
 
 struct Vertex
@@ -78,14 +89,177 @@ namespace CLAR {
             return pos == other.pos && color == other.color && texCoord == other.texCoord && normal == other.normal;
         }
     };
+
+    // Hashes every attribute. -0.0 is folded into 0.0 so vertices that compare equal also hash equal.
+    inline uint64_t HashVertex(const Vertex& vertex)
+    {
+        static_assert(sizeof(Vertex) == 11 * sizeof(float), "HashVertex expects a tightly packed Vertex");
+
+        float values[11];
+        memcpy(values, &vertex, sizeof(values));
+
+        uint64_t hash = 0x9E3779B97F4A7C15ull;
+        for (float value : values)
+        {
+            uint32_t bits;
+            if (value == 0.0f)
+                value = 0.0f;
+            memcpy(&bits, &value, sizeof(bits));
+            hash = (hash ^ bits) * 0x100000001B3ull;
+        }
+
+        // murmur3 finalizer, the low bits are used directly as the table slot
+        hash ^= hash >> 33;
+        hash *= 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 33;
+        hash *= 0xC4CEB93FE5EFAD1Full;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    // Layout of a model's vertex buffer on the GPU. Stored in ObjDesc so the hit shader can decode either.
+    enum class VertexFormat : uint32_t {
+        Float = 0,  // Vertex as is, 44 bytes
+        Packed = 1, // PackedVertex, 20 bytes, plus a color stream when the source has colors
+        Split = 2,  // 12 byte positions, VertexAttributes in a second stream, plus the color stream
+    };
+
+#if defined(PACKED_VERTICES) && defined(SPLIT_VERTEX_STREAMS)
+    inline constexpr VertexFormat GpuVertexFormat = VertexFormat::Split;
+#elif defined(PACKED_VERTICES)
+    inline constexpr VertexFormat GpuVertexFormat = VertexFormat::Packed;
+#else
+    inline constexpr VertexFormat GpuVertexFormat = VertexFormat::Float;
+#endif
+
+    // Octahedral mapping of a unit vector onto [-1, 1]^2 (Cigolle et al., "A Survey of Efficient
+    // Representations for Independent Unit Vectors"). OctDecode is mirrored in the shaders.
+    inline glm::vec2 OctEncode(const glm::vec3& normal)
+    {
+        float l1 = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+        if (l1 == 0.0f)
+            return glm::vec2(0.0f);
+
+        glm::vec3 n = normal / l1;
+        if (n.z >= 0.0f)
+            return glm::vec2(n.x, n.y);
+
+        // fold the lower hemisphere over the diagonals
+        return glm::vec2((1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+                         (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+    }
+
+    inline glm::vec3 OctDecode(const glm::vec2& encoded)
+    {
+        glm::vec3 n(encoded.x, encoded.y, 1.0f - std::abs(encoded.x) - std::abs(encoded.y));
+        float t = std::max(-n.z, 0.0f);
+        n.x += n.x >= 0.0f ? -t : t;
+        n.y += n.y >= 0.0f ? -t : t;
+        return glm::normalize(n);
+    }
+
+    // Compact GPU vertex. Positions stay float because the buffer is also the BLAS build input,
+    // normals are octahedral snorm16x2 and texture coordinates half floats.
+    // Colors go to a separate RGBA8 stream on ColorBinding, see Model::CreateBuffers.
+    struct PackedVertex {
+        glm::vec3 pos;
+        uint32_t normal;
+        uint32_t texCoord;
+
+        static constexpr uint32_t ColorBinding = 1;
+
+        PackedVertex() = default;
+
+        explicit PackedVertex(const Vertex& vertex)
+            : pos(vertex.pos), normal(glm::packSnorm2x16(OctEncode(vertex.normal))), texCoord(glm::packHalf2x16(vertex.texCoord))
+        {}
+
+        Vertex Unpack(const glm::vec3& color = { 1.0f, 1.0f, 1.0f }) const {
+            return Vertex(pos, OctDecode(glm::unpackSnorm2x16(normal)), color, glm::unpackHalf2x16(texCoord));
+        }
+
+        static std::vector<VkVertexInputBindingDescription> getBindingDescriptions(bool withColor) {
+            std::vector<VkVertexInputBindingDescription> bindingDescriptions{
+                { .binding = 0, .stride = sizeof(PackedVertex), .inputRate = VK_VERTEX_INPUT_RATE_VERTEX }
+            };
+
+            if (withColor)
+                bindingDescriptions.push_back({ .binding = ColorBinding, .stride = sizeof(uint32_t), .inputRate = VK_VERTEX_INPUT_RATE_VERTEX });
+
+            return bindingDescriptions;
+        }
+
+        // Same locations as Vertex: the shader sees vec3 position, vec2 octahedral normal, vec2 uv and vec4 color
+        static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(bool withColor) {
+            std::vector<VkVertexInputAttributeDescription> attributeDescriptions{
+                { .location = 0, .binding = 0, .format = VK_FORMAT_R32G32B32_SFLOAT, .offset = offsetof(PackedVertex, pos) },
+                { .location = 1, .binding = 0, .format = VK_FORMAT_R16G16_SNORM, .offset = offsetof(PackedVertex, normal) },
+                { .location = 3, .binding = 0, .format = VK_FORMAT_R16G16_SFLOAT, .offset = offsetof(PackedVertex, texCoord) },
+            };
+
+            if (withColor)
+                attributeDescriptions.push_back({ .location = 2, .binding = ColorBinding, .format = VK_FORMAT_R8G8B8A8_UNORM, .offset = 0 });
+
+            return attributeDescriptions;
+        }
+    };
+
+    static_assert(sizeof(PackedVertex) == 20, "PackedVertex must match the scalar layout in the shaders");
+
+    // Shading half of the split layout, encoded like PackedVertex. Only the closest hit shader and the
+    // raster vertex shader read it, the BLAS build and depth-only passes see nothing but the position stream.
+    struct VertexAttributes {
+        uint32_t normal;
+        uint32_t texCoord;
+
+        static constexpr uint32_t Binding = 1;
+        static constexpr uint32_t ColorBinding = 2;
+
+        VertexAttributes() = default;
+
+        explicit VertexAttributes(const Vertex& vertex)
+            : normal(glm::packSnorm2x16(OctEncode(vertex.normal))), texCoord(glm::packHalf2x16(vertex.texCoord))
+        {}
+
+        static std::vector<VkVertexInputBindingDescription> getBindingDescriptions(bool withColor) {
+            std::vector<VkVertexInputBindingDescription> bindingDescriptions{
+                { .binding = 0, .stride = sizeof(glm::vec3), .inputRate = VK_VERTEX_INPUT_RATE_VERTEX },
+                { .binding = Binding, .stride = sizeof(VertexAttributes), .inputRate = VK_VERTEX_INPUT_RATE_VERTEX }
+            };
+
+            if (withColor)
+                bindingDescriptions.push_back({ .binding = ColorBinding, .stride = sizeof(uint32_t), .inputRate = VK_VERTEX_INPUT_RATE_VERTEX });
+
+            return bindingDescriptions;
+        }
+
+        // Same locations and formats as PackedVertex, only spread over the position and attribute bindings
+        static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(bool withColor) {
+            std::vector<VkVertexInputAttributeDescription> attributeDescriptions{
+                { .location = 0, .binding = 0, .format = VK_FORMAT_R32G32B32_SFLOAT, .offset = 0 },
+                { .location = 1, .binding = Binding, .format = VK_FORMAT_R16G16_SNORM, .offset = offsetof(VertexAttributes, normal) },
+                { .location = 3, .binding = Binding, .format = VK_FORMAT_R16G16_SFLOAT, .offset = offsetof(VertexAttributes, texCoord) },
+            };
+
+            if (withColor)
+                attributeDescriptions.push_back({ .location = 2, .binding = ColorBinding, .format = VK_FORMAT_R8G8B8A8_UNORM, .offset = 0 });
+
+            return attributeDescriptions;
+        }
+    };
+
+    static_assert(sizeof(VertexAttributes) == 8, "VertexAttributes must match the scalar layout in the shaders");
+
+    inline uint32_t PackColor(const glm::vec3& color)
+    {
+        return glm::packUnorm4x8(glm::vec4(color, 1.0f));
+    }
 }
 
 namespace std {
     template<> struct hash<CLAR::Vertex> {
         size_t operator()(CLAR::Vertex const& vertex) const {
-            return ((hash<glm::vec3>()(vertex.pos) ^
-                (hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
-                (hash<glm::vec2>()(vertex.texCoord) << 1);
+            return static_cast<size_t>(CLAR::HashVertex(vertex));
         }
     };
 }
@@ -0,0 +1,277 @@
+#include "Json.h"
+
+#include <charconv>
+#include <stdexcept>
+
+namespace CLAR {
+
+	class JsonParser {
+	public:
+		explicit JsonParser(std::string_view text)
+			: m_Text(text)
+		{
+		}
+
+		JsonValue ParseDocument()
+		{
+			JsonValue value = ParseValue(0);
+			SkipWhitespace();
+			if (m_Pos != m_Text.size())
+				Fail("trailing characters");
+			return value;
+		}
+
+	private:
+		// deep enough for any real document, shallow enough to never run out of stack
+		static constexpr int MaxDepth = 256;
+
+		std::string_view m_Text;
+		size_t m_Pos = 0;
+
+		[[noreturn]] void Fail(const char* what) const
+		{
+			throw std::runtime_error("JSON: " + std::string(what) + " at offset " + std::to_string(m_Pos));
+		}
+
+		void SkipWhitespace()
+		{
+			while (m_Pos < m_Text.size() && (m_Text[m_Pos] == ' ' || m_Text[m_Pos] == '\t' || m_Text[m_Pos] == '\n' || m_Text[m_Pos] == '\r'))
+				m_Pos++;
+		}
+
+		bool Consume(char c)
+		{
+			SkipWhitespace();
+			if (m_Pos < m_Text.size() && m_Text[m_Pos] == c)
+			{
+				m_Pos++;
+				return true;
+			}
+			return false;
+		}
+
+		void Expect(char c)
+		{
+			if (!Consume(c))
+				Fail(("expected '" + std::string(1, c) + "'").c_str());
+		}
+
+		void ExpectLiteral(std::string_view literal)
+		{
+			if (m_Text.substr(m_Pos, literal.size()) != literal)
+				Fail("invalid literal");
+			m_Pos += literal.size();
+		}
+
+		JsonValue ParseValue(int depth)
+		{
+			if (depth > MaxDepth)
+				Fail("nesting too deep");
+
+			SkipWhitespace();
+			if (m_Pos >= m_Text.size())
+				Fail("unexpected end");
+
+			JsonValue value;
+			switch (m_Text[m_Pos])
+			{
+			case '{':
+				m_Pos++;
+				value.m_Type = JsonValue::Type::Object;
+				if (Consume('}'))
+					break;
+				do
+				{
+					SkipWhitespace();
+					std::string key = ParseString();
+					Expect(':');
+					value.m_Members.emplace_back(std::move(key), ParseValue(depth + 1));
+				} while (Consume(','));
+				Expect('}');
+				break;
+			case '[':
+				m_Pos++;
+				value.m_Type = JsonValue::Type::Array;
+				if (Consume(']'))
+					break;
+				do
+				{
+					value.m_Elements.push_back(ParseValue(depth + 1));
+				} while (Consume(','));
+				Expect(']');
+				break;
+			case '"':
+				value.m_Type = JsonValue::Type::String;
+				value.m_String = ParseString();
+				break;
+			case 't':
+				ExpectLiteral("true");
+				value.m_Type = JsonValue::Type::Bool;
+				value.m_Bool = true;
+				break;
+			case 'f':
+				ExpectLiteral("false");
+				value.m_Type = JsonValue::Type::Bool;
+				break;
+			case 'n':
+				ExpectLiteral("null");
+				break;
+			default:
+				value.m_Type = JsonValue::Type::Number;
+				value.m_Number = ParseNumber();
+				break;
+			}
+			return value;
+		}
+
+		double ParseNumber()
+		{
+			// from_chars takes no leading '+', JSON allows none either
+			const char* begin = m_Text.data() + m_Pos;
+			const char* end = m_Text.data() + m_Text.size();
+			double number = 0.0;
+			auto [ptr, ec] = std::from_chars(begin, end, number);
+			if (ec != std::errc() || ptr == begin)
+				Fail("invalid number");
+			m_Pos += ptr - begin;
+			return number;
+		}
+
+		uint32_t ParseHex4()
+		{
+			if (m_Pos + 4 > m_Text.size())
+				Fail("truncated escape");
+
+			uint32_t code = 0;
+			for (int i = 0; i < 4; i++)
+			{
+				char c = m_Text[m_Pos++];
+				code <<= 4;
+				if (c >= '0' && c <= '9')
+					code |= c - '0';
+				else if (c >= 'a' && c <= 'f')
+					code |= c - 'a' + 10;
+				else if (c >= 'A' && c <= 'F')
+					code |= c - 'A' + 10;
+				else
+					Fail("invalid escape");
+			}
+			return code;
+		}
+
+		static void AppendUtf8(std::string& out, uint32_t code)
+		{
+			if (code < 0x80)
+				out += static_cast<char>(code);
+			else if (code < 0x800)
+			{
+				out += static_cast<char>(0xC0 | (code >> 6));
+				out += static_cast<char>(0x80 | (code & 0x3F));
+			}
+			else if (code < 0x10000)
+			{
+				out += static_cast<char>(0xE0 | (code >> 12));
+				out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+				out += static_cast<char>(0x80 | (code & 0x3F));
+			}
+			else
+			{
+				out += static_cast<char>(0xF0 | (code >> 18));
+				out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+				out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+				out += static_cast<char>(0x80 | (code & 0x3F));
+			}
+		}
+
+		std::string ParseString()
+		{
+			if (m_Pos >= m_Text.size() || m_Text[m_Pos] != '"')
+				Fail("expected string");
+			m_Pos++;
+
+			std::string out;
+			while (true)
+			{
+				if (m_Pos >= m_Text.size())
+					Fail("unterminated string");
+
+				char c = m_Text[m_Pos++];
+				if (c == '"')
+					return out;
+				if (c != '\\')
+				{
+					out += c;
+					continue;
+				}
+
+				if (m_Pos >= m_Text.size())
+					Fail("unterminated string");
+				switch (m_Text[m_Pos++])
+				{
+				case '"': out += '"'; break;
+				case '\\': out += '\\'; break;
+				case '/': out += '/'; break;
+				case 'b': out += '\b'; break;
+				case 'f': out += '\f'; break;
+				case 'n': out += '\n'; break;
+				case 'r': out += '\r'; break;
+				case 't': out += '\t'; break;
+				case 'u':
+				{
+					uint32_t code = ParseHex4();
+					// a high surrogate needs its low half to make one code point
+					if (code >= 0xD800 && code < 0xDC00 && m_Text.substr(m_Pos, 2) == "\\u")
+					{
+						m_Pos += 2;
+						uint32_t low = ParseHex4();
+						if (low < 0xDC00 || low >= 0xE000)
+							Fail("invalid surrogate pair");
+						code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+					}
+					AppendUtf8(out, code);
+					break;
+				}
+				default:
+					Fail("invalid escape");
+				}
+			}
+		}
+	};
+
+	JsonValue JsonValue::Parse(std::string_view text)
+	{
+		return JsonParser(text).ParseDocument();
+	}
+
+	static const JsonValue& NullValue()
+	{
+		static const JsonValue null;
+		return null;
+	}
+
+	const JsonValue& JsonValue::operator[](std::string_view key) const
+	{
+		for (const auto& [name, value] : m_Members)
+		{
+			if (name == key)
+				return value;
+		}
+		return NullValue();
+	}
+
+	const JsonValue& JsonValue::operator[](size_t index) const
+	{
+		return index < m_Elements.size() ? m_Elements[index] : NullValue();
+	}
+
+	size_t JsonValue::Size() const
+	{
+		return m_Type == Type::Array ? m_Elements.size() : m_Type == Type::Object ? m_Members.size() : 0;
+	}
+
+	const std::string& JsonValue::AsString() const
+	{
+		static const std::string empty;
+		return m_Type == Type::String ? m_String : empty;
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace CLAR {
+
+	// Minimal read-only JSON document, enough for glTF headers. Parse throws std::runtime_error on malformed input.
+	// Looking up a missing key or index yields a null value, so optional fields read as their default.
+	class JsonValue {
+	public:
+		enum class Type { Null, Bool, Number, String, Array, Object };
+
+		static JsonValue Parse(std::string_view text);
+
+		Type GetType() const { return m_Type; }
+		bool IsNull() const { return m_Type == Type::Null; }
+		bool IsNumber() const { return m_Type == Type::Number; }
+		bool IsString() const { return m_Type == Type::String; }
+		bool IsArray() const { return m_Type == Type::Array; }
+		bool IsObject() const { return m_Type == Type::Object; }
+
+		bool Has(std::string_view key) const { return !(*this)[key].IsNull(); }
+		const JsonValue& operator[](std::string_view key) const;
+		const JsonValue& operator[](size_t index) const;
+		// Elements of an array or members of an object, 0 for anything else
+		size_t Size() const;
+
+		bool AsBool(bool defaultValue = false) const { return m_Type == Type::Bool ? m_Bool : defaultValue; }
+		double AsNumber(double defaultValue = 0.0) const { return m_Type == Type::Number ? m_Number : defaultValue; }
+		const std::string& AsString() const;
+
+		const std::vector<JsonValue>& Elements() const { return m_Elements; }
+		const std::vector<std::pair<std::string, JsonValue>>& Members() const { return m_Members; }
+
+	private:
+		friend class JsonParser;
+
+		Type m_Type = Type::Null;
+		bool m_Bool = false;
+		double m_Number = 0.0;
+		std::string m_String;
+		std::vector<JsonValue> m_Elements;
+		std::vector<std::pair<std::string, JsonValue>> m_Members;
+	};
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+namespace CLAR {
+
+	// Read-only memory mapping of a whole file. The view stays valid until Close() or destruction.
+	class MappedFile {
+	public:
+		MappedFile() = default;
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		// Returns false if the file does not exist, is empty or cannot be mapped
+		bool Open(const std::filesystem::path& path);
+		void Close();
+
+		bool IsOpen() const { return m_Data != nullptr; }
+		const uint8_t* Data() const { return m_Data; }
+		size_t Size() const { return m_Size; }
+
+		template<typename T>
+		std::span<const T> View(size_t offset, size_t count) const
+		{
+			return { reinterpret_cast<const T*>(m_Data + offset), count };
+		}
+
+	private:
+		const uint8_t* m_Data = nullptr;
+		size_t m_Size = 0;
+
+#ifdef _WIN32
+		void* m_File = nullptr;
+		void* m_Mapping = nullptr;
+#endif
+	};
+}
@@ -0,0 +1,144 @@
+#include "ThreadPool.h"
+
+namespace CLAR {
+
+	// Pool and worker index owning the current thread, t_Pool stays null outside of any pool
+	static thread_local const ThreadPool* t_Pool = nullptr;
+	static thread_local uint32_t t_WorkerIndex = 0;
+
+	ThreadPool::ThreadPool(uint32_t threadCount)
+	{
+		threadCount = std::max(1u, threadCount);
+
+		m_Queues.reserve(threadCount);
+		for (uint32_t i = 0; i < threadCount; ++i)
+			m_Queues.emplace_back(std::make_unique<WorkQueue>());
+
+		m_Workers.reserve(threadCount);
+		for (uint32_t i = 0; i < threadCount; ++i)
+			m_Workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		WaitIdle();
+
+		{
+			std::lock_guard<std::mutex> lock(m_WakeMutex);
+			m_Stopping = true;
+		}
+		m_WakeCondition.notify_all();
+
+		for (auto& worker : m_Workers)
+			worker.join();
+	}
+
+	void ThreadPool::WaitIdle()
+	{
+		// A worker waiting on its own pool would never wake up, so it helps draining the queues instead. Its own
+		// job is pending, and so is the job of every other worker in here; counting them all keeps two waiters
+		// from waiting on each other
+		if (t_Pool == this)
+		{
+			m_Waiting++;
+
+			Job job;
+			while (m_Pending > m_Waiting)
+			{
+				if (TryPop(t_WorkerIndex, job) || TrySteal(t_WorkerIndex, job))
+					Run(job);
+				else
+					std::this_thread::yield();
+			}
+
+			m_Waiting--;
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(m_WakeMutex);
+		m_IdleCondition.wait(lock, [this]() { return m_Pending == 0; });
+	}
+
+	void ThreadPool::Push(Job job)
+	{
+		// Jobs spawned by a worker stay on its own deque, everything else is spread round-robin
+		uint32_t index = t_Pool == this ? t_WorkerIndex : m_NextQueue++ % ThreadCount();
+
+		// counted before anyone can pop it, so the pops never take the counters below zero
+		m_Pending++;
+		m_Queued++;
+		{
+			std::lock_guard<std::mutex> lock(m_Queues[index]->mutex);
+			m_Queues[index]->jobs.push_back(std::move(job));
+		}
+
+		// a worker checks m_Queued under this lock before it sleeps, taking it here means it either saw the job or gets the notify
+		{
+			std::lock_guard<std::mutex> lock(m_WakeMutex);
+		}
+		m_WakeCondition.notify_one();
+	}
+
+	bool ThreadPool::TryPop(uint32_t index, Job& job)
+	{
+		std::lock_guard<std::mutex> lock(m_Queues[index]->mutex);
+		if (m_Queues[index]->jobs.empty())
+			return false;
+
+		job = std::move(m_Queues[index]->jobs.back());
+		m_Queues[index]->jobs.pop_back();
+		m_Queued--;
+		return true;
+	}
+
+	bool ThreadPool::TrySteal(uint32_t thief, Job& job)
+	{
+		for (uint32_t i = 1; i < ThreadCount(); ++i)
+		{
+			auto& victim = *m_Queues[(thief + i) % ThreadCount()];
+
+			std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+			if (!lock.owns_lock() || victim.jobs.empty())
+				continue;
+
+			job = std::move(victim.jobs.front());
+			victim.jobs.pop_front();
+			m_Queued--;
+			return true;
+		}
+		return false;
+	}
+
+	void ThreadPool::Run(Job& job)
+	{
+		job();
+		job = nullptr;
+
+		if (--m_Pending == 0)
+		{
+			std::lock_guard<std::mutex> lock(m_WakeMutex);
+			m_IdleCondition.notify_all();
+		}
+	}
+
+	void ThreadPool::WorkerLoop(uint32_t index)
+	{
+		t_Pool = this;
+		t_WorkerIndex = index;
+
+		Job job;
+		while (true)
+		{
+			if (TryPop(index, job) || TrySteal(index, job))
+			{
+				Run(job);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(m_WakeMutex);
+			m_WakeCondition.wait(lock, [this]() { return m_Stopping || m_Queued > 0; });
+			if (m_Stopping && m_Queued == 0)
+				return;
+		}
+	}
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace CLAR {
+
+	// Work-stealing thread pool. Every worker owns a deque: it pops its own jobs from the back
+	// and, when it runs dry, steals from the front of the other workers' deques.
+	// Jobs submitted from outside the pool are spread round-robin over the workers.
+	class ThreadPool {
+	public:
+		explicit ThreadPool(uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency()));
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		template<typename F, typename... Args>
+		auto Submit(F&& func, Args&&... args) -> std::future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>;
+
+		// Runs func(i) for every i in [0, count) and returns once all of them finished.
+		// The calling thread takes part, so this is safe to call from inside a job.
+		template<typename F>
+		void ParallelFor(size_t count, F&& func);
+
+		// Blocks until every submitted job has finished. From inside a job it runs queued jobs meanwhile and
+		// returns once everything but the jobs waiting in here has finished.
+		void WaitIdle();
+
+		uint32_t ThreadCount() const { return static_cast<uint32_t>(m_Queues.size()); }
+
+	private:
+		using Job = std::function<void()>;
+
+		struct WorkQueue {
+			std::mutex mutex;
+			std::deque<Job> jobs;
+		};
+
+		std::vector<std::unique_ptr<WorkQueue>> m_Queues;
+		std::vector<std::thread> m_Workers;
+
+		std::mutex m_WakeMutex;
+		std::condition_variable m_WakeCondition;
+		std::condition_variable m_IdleCondition;
+
+		std::atomic<size_t> m_Queued{ 0 };   // jobs sitting in a deque, counted before they get there
+		std::atomic<size_t> m_Pending{ 0 };  // jobs queued or running
+		std::atomic<size_t> m_Waiting{ 0 };  // jobs blocked in WaitIdle, pending but never finishing while they wait
+		std::atomic<uint32_t> m_NextQueue{ 0 };
+		bool m_Stopping = false;
+
+		void Push(Job job);
+		bool TryPop(uint32_t index, Job& job);
+		bool TrySteal(uint32_t thief, Job& job);
+		void Run(Job& job);
+		void WorkerLoop(uint32_t index);
+	};
+
+	template<typename F, typename... Args>
+	inline auto ThreadPool::Submit(F&& func, Args&&... args) -> std::future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>
+	{
+		using R = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+
+		// std::function needs a copyable target, so the packaged task lives behind a shared_ptr
+		auto task = std::make_shared<std::packaged_task<R()>>(
+			[func = std::forward<F>(func), ...args = std::forward<Args>(args)]() mutable {
+				return std::invoke(std::move(func), std::move(args)...);
+			});
+
+		std::future<R> result = task->get_future();
+		Push([task]() { (*task)(); });
+		return result;
+	}
+
+	template<typename F>
+	inline void ThreadPool::ParallelFor(size_t count, F&& func)
+	{
+		if (count == 0)
+			return;
+
+		struct State {
+			std::atomic<size_t> next{ 0 };
+			std::atomic<size_t> remaining;
+			std::mutex errorMutex;
+			std::exception_ptr error;
+		};
+
+		auto state = std::make_shared<State>();
+		state->remaining = count;
+
+		// Helpers that only start after every index was claimed return without touching func,
+		// which may be gone by then; only the shared state outlives this call
+		auto drain = [state, count, fn = &func]() {
+			for (size_t i = state->next++; i < count; i = state->next++)
+			{
+				try
+				{
+					(*fn)(i);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(state->errorMutex);
+					if (!state->error)
+						state->error = std::current_exception();
+				}
+				state->remaining--;
+			}
+		};
+
+		size_t helpers = std::min<size_t>(count, ThreadCount()) - 1;
+		for (size_t i = 0; i < helpers; ++i)
+			Push(drain);
+
+		drain();
+
+		// whatever is left is already running on other threads, just wait for it
+		while (state->remaining > 0)
+			std::this_thread::yield();
+
+		if (state->error)
+			std::rethrow_exception(state->error);
+	}
+}